@@ -13,10 +13,233 @@ limitations under the License.
 */
 
 #include "bitset_util.h"
+#include <cstring>
+#include <stdexcept>
+#include <vector>
 #include "params.h"
 
 namespace spring {
 
+static int dict_backend_global = DICT_BACKEND_BBHASH;
+
+int parse_dict_backend(const std::string &backend) {
+  if (backend == "bbhash") return DICT_BACKEND_BBHASH;
+  if (backend == "pilot") return DICT_BACKEND_PILOT;
+  throw std::runtime_error("Invalid dictionary backend: " + backend);
+}
+
+void set_dict_backend(const int backend) { dict_backend_global = backend; }
+
+int get_dict_backend() { return dict_backend_global; }
+
+void bbhashdict::build_index(const uint64_t *keys, const uint32_t n,
+                             const int num_thr) {
+  if (dict_backend_global == DICT_BACKEND_PILOT) {
+    phf = new pilot_hash();
+    phf->build(keys, n, num_thr);
+    numkeys = phf->size();
+    return;
+  }
+  auto data_iterator =
+      boomphf::range(static_cast<const u_int64_t *>(keys),
+                     static_cast<const u_int64_t *>(keys + n));
+  double gammaFactor = 5.0;  // balance between speed and memory
+  bphf = new boomphf::mphf<u_int64_t, hasher_t>(n, data_iterator, num_thr,
+                                                gammaFactor, true, false);
+  numkeys = n;
+}
+
+// Each thread scatters its own chunk, with per thread bucket offsets in chunk
+// order so that equal keys keep their order.
+void radix_sort_pairs(uint64_t *keys, uint32_t *vals, uint64_t *keys_tmp,
+                      uint32_t *vals_tmp, const uint64_t n,
+                      const int key_bits) {
+  const int num_passes = (key_bits + 7) / 8;
+  std::vector<uint64_t> hist((size_t)omp_get_max_threads() * 256);
+  uint64_t *src_keys = keys, *dst_keys = keys_tmp;
+  uint32_t *src_vals = vals, *dst_vals = vals_tmp;
+  for (int pass = 0; pass < num_passes; pass++) {
+    const int shift = 8 * pass;
+    bool skip_pass = false;
+#pragma omp parallel
+    {
+      int tid = omp_get_thread_num();
+      int nthr = omp_get_num_threads();
+      uint64_t begin = n * tid / nthr, stop = n * (tid + 1) / nthr;
+      uint64_t *thread_hist = &hist[(size_t)tid * 256];
+      std::fill(thread_hist, thread_hist + 256, 0);
+      for (uint64_t i = begin; i < stop; i++)
+        thread_hist[(src_keys[i] >> shift) & 0xFF]++;
+#pragma omp barrier
+#pragma omp single
+      {
+        uint64_t sum = 0;
+        for (int d = 0; d < 256; d++) {
+          uint64_t count = 0;
+          for (int t = 0; t < nthr; t++) count += hist[(size_t)t * 256 + d];
+          if (count == n) skip_pass = true;  // all keys have the same digit
+          for (int t = 0; t < nthr; t++) {
+            uint64_t c = hist[(size_t)t * 256 + d];
+            hist[(size_t)t * 256 + d] = sum;
+            sum += c;
+          }
+        }
+      }  // implicit barrier
+      if (!skip_pass) {
+        for (uint64_t i = begin; i < stop; i++) {
+          uint64_t pos = thread_hist[(src_keys[i] >> shift) & 0xFF]++;
+          dst_keys[pos] = src_keys[i];
+          dst_vals[pos] = src_vals[i];
+        }
+      }
+    }  // parallel end
+    if (!skip_pass) {
+      std::swap(src_keys, dst_keys);
+      std::swap(src_vals, dst_vals);
+    }
+  }
+  if (src_keys != keys) {
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < (int64_t)n; i++) {
+      keys[i] = src_keys[i];
+      vals[i] = src_vals[i];
+    }
+  }
+  return;
+}
+
+void build_dict_from_keys(bbhashdict &dict, uint64_t *keys, uint32_t *read_ids,
+                          const uint32_t n, const int key_bits,
+                          const int num_thr) {
+  dict.dict_numreads = n;
+  if (n == 0) {
+    // single empty bin for a dummy key, so that lookups and findpos stay
+    // within bounds
+    uint64_t dummy_key = 0;
+    dict.build_index(&dummy_key, 1, 1);
+    dict.startpos = alloc_array<uint32_t>(dict.numkeys + 1);
+    for (uint64_t i = dict.lookup(dummy_key) + 1; i <= dict.numkeys; i++)
+      dict.startpos[i] = 1;
+    dict.read_id = alloc_array<uint32_t>(1);
+    dict.read_id[0] = MAX_NUM_READS;  // i.e. the only read was removed
+    dict.empty_bin = alloc_array<bool>(dict.numkeys);
+    for (uint64_t i = 0; i < dict.numkeys; i++) dict.empty_bin[i] = 1;
+    return;
+  }
+
+  // sort by key, read ids stay increasing within a key
+  uint64_t *keys_tmp = new uint64_t[n];
+  uint32_t *read_ids_tmp = new uint32_t[n];
+  radix_sort_pairs(keys, read_ids, keys_tmp, read_ids_tmp, n, key_bits);
+  delete[] keys_tmp;
+  delete[] read_ids_tmp;
+
+  // deduplicate: unique keys and the start of their run in the sorted array
+  std::vector<uint32_t> thread_offset(omp_get_max_threads() + 1);
+  uint64_t *unique_keys = NULL;
+  uint32_t *run_start = NULL;
+  uint32_t num_unique = 0;
+#pragma omp parallel
+  {
+    int tid = omp_get_thread_num();
+    int nthr = omp_get_num_threads();
+    uint64_t begin = uint64_t(n) * tid / nthr, stop = uint64_t(n) * (tid + 1) / nthr;
+    uint32_t count = 0;
+    for (uint64_t i = begin; i < stop; i++)
+      if (i == 0 || keys[i] != keys[i - 1]) count++;
+    thread_offset[tid + 1] = count;
+#pragma omp barrier
+#pragma omp single
+    {
+      thread_offset[0] = 0;
+      for (int t = 0; t < nthr; t++) thread_offset[t + 1] += thread_offset[t];
+      num_unique = thread_offset[nthr];
+      unique_keys = new uint64_t[num_unique];
+      run_start = new uint32_t[num_unique + 1];
+      run_start[num_unique] = n;
+    }  // implicit barrier
+    uint32_t k = thread_offset[tid];
+    for (uint64_t i = begin; i < stop; i++)
+      if (i == 0 || keys[i] != keys[i - 1]) {
+        unique_keys[k] = keys[i];
+        run_start[k] = i;
+        k++;
+      }
+  }  // parallel end
+
+  dict.build_index(unique_keys, num_unique, num_thr);
+
+  // bin sizes indexed by hash, then prefix sums give the bin starts
+  uint32_t *key_hash = new uint32_t[num_unique];
+  dict.startpos = alloc_array<uint32_t>(dict.numkeys + 1);
+#pragma omp parallel for schedule(static)
+  for (int64_t k = 0; k < (int64_t)num_unique; k++) {
+    key_hash[k] = dict.lookup(unique_keys[k]);
+    dict.startpos[key_hash[k] + 1] = run_start[k + 1] - run_start[k];
+  }
+  delete[] unique_keys;
+#pragma omp parallel
+  {
+    int tid = omp_get_thread_num();
+    int nthr = omp_get_num_threads();
+    uint64_t begin = 1 + uint64_t(dict.numkeys) * tid / nthr;
+    uint64_t stop = 1 + uint64_t(dict.numkeys) * (tid + 1) / nthr;
+    for (uint64_t i = begin + 1; i < stop; i++)
+      dict.startpos[i] += dict.startpos[i - 1];
+    thread_offset[tid + 1] = (stop > begin) ? dict.startpos[stop - 1] : 0;
+#pragma omp barrier
+#pragma omp single
+    {
+      thread_offset[0] = 0;
+      for (int t = 0; t < nthr; t++) thread_offset[t + 1] += thread_offset[t];
+    }  // implicit barrier
+    for (uint64_t i = begin; i < stop; i++)
+      dict.startpos[i] += thread_offset[tid];
+  }  // parallel end
+
+  // fill the bins
+  dict.read_id = alloc_array<uint32_t>(n);
+  dict.empty_bin = alloc_array<bool>(dict.numkeys);
+#pragma omp parallel for schedule(static)
+  for (int64_t k = 0; k < (int64_t)num_unique; k++)
+    std::memcpy(dict.read_id + dict.startpos[key_hash[k]], read_ids + run_start[k],
+                (run_start[k + 1] - run_start[k]) * sizeof(uint32_t));
+  delete[] key_hash;
+  delete[] run_start;
+  dict.index_large_bins();
+  return;
+}
+
+void bbhashdict::index_large_bins() {
+  num_large = 0;
+  uint64_t num_large_reads = 0;
+  for (uint64_t i = 0; i < numkeys; i++) {
+    uint32_t size = startpos[i + 1] - startpos[i];
+    if (size >= DICT_LARGE_BIN) {
+      num_large++;
+      num_large_reads += size;
+    }
+  }
+  large_bin = alloc_array<uint32_t>(num_large);
+  large_start = alloc_array<uint32_t>(num_large + 1);
+  large_read_id = alloc_array<uint32_t>(num_large_reads);
+  large_pos = alloc_array<uint32_t>(num_large_reads);
+  uint32_t k = 0;
+  for (uint64_t i = 0; i < numkeys; i++)
+    if (startpos[i + 1] - startpos[i] >= DICT_LARGE_BIN) {
+      large_bin[k] = i;
+      large_start[k + 1] = large_start[k] + startpos[i + 1] - startpos[i];
+      k++;
+    }
+#pragma omp parallel for schedule(dynamic)
+  for (int64_t k1 = 0; k1 < (int64_t)num_large; k1++) {
+    uint32_t size = large_start[k1 + 1] - large_start[k1];
+    std::memcpy(large_read_id + large_start[k1], read_id + startpos[large_bin[k1]],
+                size * sizeof(uint32_t));
+    for (uint32_t i = 0; i < size; i++) large_pos[large_start[k1] + i] = i;
+  }
+}
+
 void bbhashdict::findpos(int64_t *dictidx, const uint64_t &startposidx) {
   dictidx[0] = startpos[startposidx];
   auto endidx = startpos[startposidx + 1];
@@ -42,13 +265,29 @@ void bbhashdict::remove(int64_t *dictidx, const uint64_t &startposidx,
     empty_bin[startposidx] = 1;
     return;  // need to keep one read to check during matching
   }
-  int64_t pos =
-      std::lower_bound(read_id + dictidx[0], read_id + dictidx[1], current) -
-      (read_id + dictidx[0]);
-
-  for (int64_t i = dictidx[0] + pos; i < dictidx[1] - 1; i++)
-    read_id[i] = read_id[i + 1];
   auto endidx = startpos[startposidx + 1];
+  if (endidx - startpos[startposidx] >= DICT_LARGE_BIN) {
+    // find the slot of current with the position index and move the last
+    // read of the bin there
+    uint32_t k = std::lower_bound(large_bin, large_bin + num_large,
+                                  (uint32_t)startposidx) -
+                 large_bin;
+    uint32_t *bin_read_id = large_read_id + large_start[k];
+    uint32_t *bin_end = large_read_id + large_start[k + 1];
+    uint32_t *bin_pos = large_pos + large_start[k];
+    uint32_t pos =
+        bin_pos[std::lower_bound(bin_read_id, bin_end, (uint32_t)current) -
+                bin_read_id];
+    uint32_t moved = read_id[dictidx[1] - 1];
+    read_id[dictidx[0] + pos] = moved;
+    bin_pos[std::lower_bound(bin_read_id, bin_end, moved) - bin_read_id] = pos;
+  } else {
+    int64_t pos =
+        std::lower_bound(read_id + dictidx[0], read_id + dictidx[1], current) -
+        (read_id + dictidx[0]);
+    for (int64_t i = dictidx[0] + pos; i < dictidx[1] - 1; i++)
+      read_id[i] = read_id[i + 1];
+  }
   if (dictidx[1] == endidx)  // this is first read to be deleted
     read_id[endidx - 1] = MAX_NUM_READS;
   else if (read_id[endidx - 1] ==
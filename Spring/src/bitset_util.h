@@ -19,50 +19,128 @@ limitations under the License.
 #include <algorithm>
 #include <bitset>
 #include <fstream>
+#include <iostream>
 #include <string>
+#include <vector>
 #include "BooPHF.h"
+#include "memory_util.h"
 #include "params.h"
+#include "pilot_hash.h"
+#include "read_bits.h"
 namespace spring {
 
 typedef boomphf::SingleHashFunctor<u_int64_t> hasher_t;
 typedef boomphf::mphf<u_int64_t, hasher_t> boophf_t;
 
+// hash function used to index the dictionary bins
+// bbhash: BBHash minimal perfect hash
+// pilot: PTHash style perfect hash (pilot_hash.h), smaller and faster to query
+const int DICT_BACKEND_BBHASH = 0;
+const int DICT_BACKEND_PILOT = 1;
+
+int parse_dict_backend(const std::string &backend);
+
+void set_dict_backend(const int backend);
+
+int get_dict_backend();
+
+// bins with at least this many reads get a position index so that a read is
+// removed by moving the last read of the bin into its slot. Smaller bins keep
+// their reads sorted and shift them on removal.
+const uint32_t DICT_LARGE_BIN = 64;
+
 class bbhashdict {
  public:
   boophf_t *bphf;
+  pilot_hash *phf;
   int start;
   int end;
-  uint32_t numkeys;
+  uint32_t numkeys;  // number of bins (larger than the number of distinct
+                     // keys for the pilot backend, the extra bins are empty)
   uint32_t dict_numreads;  // number of reads in this dict (for variable length)
   uint32_t *startpos;
   uint32_t *read_id;
   bool *empty_bin;
+  // position index of the large bins: large_bin holds their bin numbers in
+  // increasing order and large_start[i] the offset of bin large_bin[i] in
+  // large_read_id (read ids of the bin as built, sorted) and large_pos
+  // (current offset of each of these reads within the bin)
+  uint32_t num_large;
+  uint32_t *large_bin;
+  uint32_t *large_start;
+  uint32_t *large_read_id;
+  uint32_t *large_pos;
   void findpos(int64_t *dictidx, const uint64_t &startposidx);
   void remove(int64_t *dictidx, const uint64_t &startposidx,
               const int64_t current);
+  // build the position index, called once the bins are filled
+  void index_large_bins();
+  // bin of key, >= numkeys or the bin of another key if key is not in the
+  // dictionary (callers compare with the key of the first read in the bin)
+  uint64_t lookup(const uint64_t key) {
+    if (phf != NULL) return phf->lookup(key);
+    return bphf->lookup(key);
+  }
+  // build the hash function over n distinct keys with the selected backend
+  // and set numkeys
+  void build_index(const uint64_t *keys, const uint32_t n, const int num_thr);
   bbhashdict() {
     bphf = NULL;
+    phf = NULL;
     startpos = NULL;
     read_id = NULL;
     empty_bin = NULL;
+    num_large = 0;
+    large_bin = NULL;
+    large_start = NULL;
+    large_read_id = NULL;
+    large_pos = NULL;
   }
   ~bbhashdict() {
-    if (startpos != NULL) delete[] startpos;
-    if (read_id != NULL) delete[] read_id;
-    if (empty_bin != NULL) delete[] empty_bin;
+    // arrays allocated with alloc_array in constructdictionary
+    if (startpos != NULL) free_array(startpos, numkeys + 1);
+    if (read_id != NULL)
+      free_array(read_id, std::max<uint32_t>(dict_numreads, 1));
+    if (empty_bin != NULL) free_array(empty_bin, numkeys);
+    if (large_start != NULL) {
+      free_array(large_read_id, large_start[num_large]);
+      free_array(large_pos, large_start[num_large]);
+      free_array(large_start, num_large + 1);
+      free_array(large_bin, num_large);
+    }
     if (bphf != NULL) delete bphf;
+    if (phf != NULL) delete phf;
   }
 };
 
 template <size_t bitset_size>
 void stringtobitset(const std::string &s, const uint16_t readlen,
-                    std::bitset<bitset_size> &b,
-                    std::bitset<bitset_size> **basemask) {
+                    read_bits_ref<bitset_size> b,
+                    read_bits<bitset_size> **basemask) {
   for (int i = 0; i < readlen; i++) b |= basemask[i][(uint8_t)s[i]];
 }
 
+// bits [pos, pos+len) of b (len <= 64), bits past the end of b are zero
 template <size_t bitset_size>
-void generateindexmasks(std::bitset<bitset_size> *mask1, bbhashdict *dict,
+inline uint64_t extract_bits(read_bits_cref<bitset_size> b, const int pos,
+                             const int len) {
+  const int num_words = read_bits_traits<bitset_size>::num_words();
+  const uint64_t *words = bits_words(b);
+  const int i = pos / 64, offset = pos % 64;
+  uint64_t x = (i < num_words) ? words[i] >> offset : 0;
+  if (offset != 0 && i + 1 < num_words) x |= words[i + 1] << (64 - offset);
+  return (len == 64) ? x : x & ((1ULL << len) - 1);
+}
+
+template <size_t bitset_size>
+inline void prefetch_bitset(read_bits_cref<bitset_size> b) {
+  const size_t bytes = read_bits_traits<bitset_size>::num_words() * 8;
+  for (size_t i = 0; i < bytes; i += 64)
+    __builtin_prefetch(reinterpret_cast<const char *>(bits_words(b)) + i);
+}
+
+template <size_t bitset_size>
+void generateindexmasks(read_bits<bitset_size> *mask1, bbhashdict *dict,
                         int numdict, int bpb) {
   for (int j = 0; j < numdict; j++) mask1[j].reset();
   for (int j = 0; j < numdict; j++)
@@ -71,35 +149,56 @@ void generateindexmasks(std::bitset<bitset_size> *mask1, bbhashdict *dict,
   return;
 }
 
+// approximate peak bytes per read used by the in-memory dictionary
+// construction (keys and read ids with their sort buffers, unique keys, run
+// starts and hashes, read_id)
+const uint64_t DICT_BYTES_PER_READ = 48;
+
+// stable LSD radix sort of (keys, vals) pairs by the low key_bits bits of the
+// keys, 8 bits per pass. keys_tmp and vals_tmp are scratch arrays of size n.
+void radix_sort_pairs(uint64_t *keys, uint32_t *vals, uint64_t *keys_tmp,
+                      uint32_t *vals_tmp, const uint64_t n, const int key_bits);
+
+// build the dictionary from the keys of its reads. keys and read_ids (n
+// entries, read_ids increasing) are overwritten.
+void build_dict_from_keys(bbhashdict &dict, uint64_t *keys, uint32_t *read_ids,
+                          const uint32_t n, const int key_bits,
+                          const int num_thr);
+
 template <size_t bitset_size>
-void constructdictionary(std::bitset<bitset_size> *read, bbhashdict *dict,
-                         uint16_t *read_lengths, const int numdict,
-                         const uint32_t &numreads, const int bpb,
-                         const std::string &basedir, const int &num_thr) {
-  std::bitset<bitset_size> *mask = new std::bitset<bitset_size>[numdict];
+void constructdictionary_disk(read_bits_array<bitset_size> read,
+                              bbhashdict *dict, uint16_t *read_lengths,
+                              const int numdict, const uint32_t &numreads,
+                              const int bpb,
+                              const std::string &basedir, const int &num_thr,
+                              const uint8_t *exclude, const uint32_t begin) {
+  // same as constructdictionary but keys and hashes go through temporary
+  // files in basedir, for use when memory is limited
+  read_bits<bitset_size> *mask = new read_bits<bitset_size>[numdict];
   generateindexmasks<bitset_size>(mask, dict, numdict, bpb);
+  const uint64_t n = numreads - begin;
   for (int j = 0; j < numdict; j++) {
-    uint64_t *ull = new uint64_t[numreads];
+    uint64_t *ull = new uint64_t[n];
 #pragma omp parallel
     {
-      std::bitset<bitset_size> b;
+      read_bits<bitset_size> b;
       int tid = omp_get_thread_num();
       uint64_t i, stop;
-      i = uint64_t(tid) * numreads / omp_get_num_threads();
-      stop = uint64_t(tid + 1) * numreads / omp_get_num_threads();
-      if (tid == omp_get_num_threads() - 1) stop = numreads;
+      i = uint64_t(tid) * n / omp_get_num_threads();
+      stop = uint64_t(tid + 1) * n / omp_get_num_threads();
+      if (tid == omp_get_num_threads() - 1) stop = n;
       // compute keys and and store in ull
       for (; i < stop; i++) {
-        b = read[i] & mask[j];
+        b = read[begin + i] & mask[j];
         ull[i] = (b >> bpb * dict[j].start).to_ullong();
       }
     }  // parallel end
 
-    // remove keys corresponding to reads shorter than dict_end[j]
+    // remove keys corresponding to reads shorter than dict_end[j] or excluded
     dict[j].dict_numreads = 0;
-    for (uint32_t i = 0; i < numreads; i++) {
-      if (read_lengths[i] > dict[j].end) {
-        ull[dict[j].dict_numreads] = ull[i];
+    for (uint32_t i = begin; i < numreads; i++) {
+      if (read_lengths[i] > dict[j].end && !(exclude && exclude[i])) {
+        ull[dict[j].dict_numreads] = ull[i - begin];
         dict[j].dict_numreads++;
       }
     }
@@ -124,14 +223,7 @@ void constructdictionary(std::bitset<bitset_size> *read, bbhashdict *dict,
     uint32_t k = 0;
     for (uint32_t i = 1; i < dict[j].dict_numreads; i++)
       if (ull[i] != ull[k]) ull[++k] = ull[i];
-    dict[j].numkeys = k + 1;
-    // construct mphf
-    auto data_iterator =
-        boomphf::range(static_cast<const u_int64_t *>(ull),
-                       static_cast<const u_int64_t *>(ull + dict[j].numkeys));
-    double gammaFactor = 5.0;  // balance between speed and memory
-    dict[j].bphf = new boomphf::mphf<u_int64_t, hasher_t>(
-        dict[j].numkeys, data_iterator, num_thr, gammaFactor, true, false);
+    dict[j].build_index(ull, k + 1, num_thr);
 
     delete[] ull;
 
@@ -152,7 +244,7 @@ void constructdictionary(std::bitset<bitset_size> *read, bbhashdict *dict,
       if (tid == omp_get_num_threads() - 1) stop = dict[j].dict_numreads;
       for (; i < stop; i++) {
         finkey.read((char *)&currentkey, sizeof(uint64_t));
-        currenthash = (dict[j].bphf)->lookup(currentkey);
+        currenthash = dict[j].lookup(currentkey);
         fouthash.write((char *)&currenthash, sizeof(uint64_t));
       }
       finkey.close();
@@ -162,6 +254,15 @@ void constructdictionary(std::bitset<bitset_size> *read, bbhashdict *dict,
     }  // parallel end
   }
 
+  // allocated (and first touched) on all threads before the dictionaries
+  // are filled one per thread
+  for (int j = 0; j < numdict; j++) {
+    dict[j].startpos = alloc_array<uint32_t>(
+        dict[j].numkeys + 1);  // 1 extra to store end pos of last key
+    dict[j].empty_bin = alloc_array<bool>(dict[j].numkeys);
+    dict[j].read_id = alloc_array<uint32_t>(dict[j].dict_numreads);
+  }
+
   // for rest of the function, use numdict threads to parallelize
   omp_set_num_threads(std::min(numdict, num_thr));
 #pragma omp parallel
@@ -169,9 +270,6 @@ void constructdictionary(std::bitset<bitset_size> *read, bbhashdict *dict,
 #pragma omp for
     for (int j = 0; j < numdict; j++) {
       // fill startpos by first storing numbers and then doing cumulative sum
-      dict[j].startpos =
-          new uint32_t[dict[j].numkeys +
-                       1]();  // 1 extra to store end pos of last key
       uint64_t currenthash;
       for (int tid = 0; tid < num_thr; tid++) {
         std::ifstream finhash(basedir + std::string("/hash.bin.") +
@@ -185,20 +283,19 @@ void constructdictionary(std::bitset<bitset_size> *read, bbhashdict *dict,
         finhash.close();
       }
 
-      dict[j].empty_bin = new bool[dict[j].numkeys]();
       for (uint32_t i = 1; i < dict[j].numkeys; i++)
         dict[j].startpos[i] = dict[j].startpos[i] + dict[j].startpos[i - 1];
 
       // insert elements in the dict array
-      dict[j].read_id = new uint32_t[dict[j].dict_numreads];
-      uint32_t i = 0;
+      uint32_t i = begin;
       for (int tid = 0; tid < num_thr; tid++) {
         std::ifstream finhash(basedir + std::string("/hash.bin.") +
                                   std::to_string(tid) + '.' + std::to_string(j),
                               std::ios::binary);
         finhash.read((char *)&currenthash, sizeof(uint64_t));
         while (!finhash.eof()) {
-          while (read_lengths[i] <= dict[j].end) i++;
+          while (read_lengths[i] <= dict[j].end || (exclude && exclude[i]))
+            i++;
           dict[j].read_id[dict[j].startpos[currenthash]++] = i;
           i++;
           finhash.read((char *)&currenthash, sizeof(uint64_t));
@@ -213,6 +310,7 @@ void constructdictionary(std::bitset<bitset_size> *read, bbhashdict *dict,
       for (int64_t keynum = dict[j].numkeys; keynum >= 1; keynum--)
         dict[j].startpos[keynum] = dict[j].startpos[keynum - 1];
       dict[j].startpos[0] = 0;
+      dict[j].index_large_bins();
     }  // for end
   }    // parallel end
   omp_set_num_threads(num_thr);
@@ -221,23 +319,159 @@ void constructdictionary(std::bitset<bitset_size> *read, bbhashdict *dict,
 }
 
 template <size_t bitset_size>
-void generatemasks(std::bitset<bitset_size> **mask, const int max_readlen,
+void constructdictionary(read_bits_array<bitset_size> read, bbhashdict *dict,
+                         uint16_t *read_lengths, const int numdict,
+                         const uint32_t &numreads, const int bpb,
+                         const std::string &basedir, const int &num_thr,
+                         const uint8_t *exclude = NULL,
+                         const uint32_t begin = 0) {
+  // dictionaries of the reads begin, ..., numreads - 1 (by their read ids).
+  // Reads with exclude[i] != 0 are left out of the dictionaries.
+  if (!fits_in_memory((uint64_t)(numreads - begin) * DICT_BYTES_PER_READ)) {
+    std::cout << "Memory limit reached, constructing dictionaries with "
+                 "temporary files\n";
+    constructdictionary_disk<bitset_size>(read, dict, read_lengths, numdict,
+                                          numreads, bpb, basedir, num_thr,
+                                          exclude, begin);
+    return;
+  }
+  read_bits<bitset_size> *mask = new read_bits<bitset_size>[numdict];
+  generateindexmasks<bitset_size>(mask, dict, numdict, bpb);
+  std::vector<uint32_t> thread_offset(omp_get_max_threads() + 1);
+  for (int j = 0; j < numdict; j++) {
+    uint64_t *keys = NULL;
+    uint32_t *read_ids = NULL;
+    uint32_t dict_numreads = 0;
+    // compute keys of the reads longer than dict[j].end, in read order
+#pragma omp parallel
+    {
+      read_bits<bitset_size> b;
+      int tid = omp_get_thread_num();
+      int nthr = omp_get_num_threads();
+      uint64_t start = begin + uint64_t(tid) * (numreads - begin) / nthr;
+      uint64_t stop = begin + uint64_t(tid + 1) * (numreads - begin) / nthr;
+      uint32_t count = 0;
+      for (uint64_t i = start; i < stop; i++)
+        if (read_lengths[i] > dict[j].end && !(exclude && exclude[i]))
+          count++;
+      thread_offset[tid + 1] = count;
+#pragma omp barrier
+#pragma omp single
+      {
+        thread_offset[0] = 0;
+        for (int t = 0; t < nthr; t++)
+          thread_offset[t + 1] += thread_offset[t];
+        dict_numreads = thread_offset[nthr];
+        keys = new uint64_t[dict_numreads];
+        read_ids = new uint32_t[dict_numreads];
+      }  // implicit barrier
+      uint32_t pos = thread_offset[tid];
+      for (uint64_t i = start; i < stop; i++) {
+        if (read_lengths[i] <= dict[j].end || (exclude && exclude[i]))
+          continue;
+        b = read[i] & mask[j];
+        keys[pos] = (b >> bpb * dict[j].start).to_ullong();
+        read_ids[pos] = i;
+        pos++;
+      }
+    }  // parallel end
+    build_dict_from_keys(dict[j], keys, read_ids, dict_numreads,
+                         bpb * (dict[j].end - dict[j].start + 1), num_thr);
+    delete[] keys;
+    delete[] read_ids;
+  }
+  delete[] mask;
+  return;
+}
+
+// Order of the reads in [begin, end) by their key in dict, reads too short
+// for the dictionary last. perm[begin..end) gets the read ids in that order.
+// In the out-of-core mode the reads are renumbered in this order, so that the
+// reads of a bin are next to each other in the mapped read array and a bin
+// scan pages in a few contiguous pages instead of one page per read.
+template <size_t bitset_size>
+void key_order(read_bits_array<bitset_size> read,
+               const uint16_t *read_lengths, const bbhashdict &dict,
+               const int bpb, const uint32_t begin, const uint32_t end,
+               uint32_t *perm) {
+  const uint64_t n = end - begin;
+  if (n == 0) return;
+  const int key_bits = bpb * (dict.end - dict.start + 1);
+  const uint64_t last_key = (key_bits == 64) ? ~0ULL : (1ULL << key_bits) - 1;
+  uint64_t *keys = new uint64_t[n];
+  uint64_t *keys_tmp = new uint64_t[n];
+  uint32_t *perm_tmp = new uint32_t[n];
+#pragma omp parallel for schedule(static)
+  for (int64_t i = 0; i < (int64_t)n; i++) {
+    uint32_t rid = begin + i;
+    perm[rid] = rid;
+    keys[i] = (read_lengths[rid] > dict.end)
+                  ? extract_bits<bitset_size>(read[rid], bpb * dict.start,
+                                              key_bits)
+                  : last_key;
+  }
+  radix_sort_pairs(keys, perm + begin, keys_tmp, perm_tmp, n, key_bits);
+  delete[] keys;
+  delete[] keys_tmp;
+  delete[] perm_tmp;
+}
+
+// new array with arr[perm[i]] at position i, allocated like arr (file backed
+// or not). arr is freed.
+template <typename T>
+T *permute_array(T *arr, const uint32_t *perm, const uint32_t n) {
+  if (n == 0) return arr;
+  T *out = is_mapped(arr) ? static_cast<T *>(alloc_mapped_pages(n * sizeof(T)))
+                          : alloc_array<T>(n);
+#pragma omp parallel for schedule(static)
+  for (int64_t i = 0; i < (int64_t)n; i++) out[i] = arr[perm[i]];
+  free_array(arr, n);
+  return out;
+}
+
+inline runtime_bitset_array permute_array(const runtime_bitset_array &arr,
+                                          const uint32_t *perm,
+                                          const uint32_t n) {
+  if (n == 0) return arr;
+  const size_t num_words = runtime_bitset::num_words;
+  runtime_bitset_array out = {
+      is_mapped(arr) ? static_cast<uint64_t *>(alloc_mapped_pages(
+                           n * num_words * sizeof(uint64_t)))
+                     : alloc_array<uint64_t>(n * num_words)};
+#pragma omp parallel for schedule(static)
+  for (int64_t i = 0; i < (int64_t)n; i++) out[i] = arr[perm[i]];
+  free_array(arr, n);
+  return out;
+}
+
+template <size_t bitset_size>
+void generatemasks(read_bits<bitset_size> *mask, const int max_readlen,
                    const int bpb) {
   // mask for zeroing the end bits (needed while reordering to compute Hamming
-  // distance between shifted reads)
-  for (int i = 0; i < max_readlen; i++) {
-    for (int j = 0; j < max_readlen; j++) {
-      mask[i][j].reset();
-      for (int k = bpb * i; k < bpb * max_readlen - bpb * j; k++)
-        mask[i][j][k] = 1;
-    }
-  }
+  // distance between shifted reads): mask[j] has the first
+  // bpb*(max_readlen-j) bits set
+  const int num_bits = 64 * read_bits_traits<bitset_size>::num_words();
+  read_bits<bitset_size> ones;
+  ones.set();
+  for (int j = 0; j < max_readlen; j++)
+    mask[j] = ones >> (num_bits - bpb * (max_readlen - j));
+  return;
+}
+
+template <size_t bitset_size>
+void generateshiftmasks(read_bits<bitset_size> *shiftmask,
+                        const int max_readlen, const int bpb) {
+  // mask for zeroing the start bits: shiftmask[i] has all bits from bpb*i on
+  // set. mask[j] & shiftmask[i] selects bits [bpb*i, bpb*(max_readlen-j))
+  read_bits<bitset_size> ones;
+  ones.set();
+  for (int i = 0; i < max_readlen; i++) shiftmask[i] = ones << (bpb * i);
   return;
 }
 
 template <size_t bitset_size>
-void chartobitset(char *s, const int readlen, std::bitset<bitset_size> &b,
-                  std::bitset<bitset_size> **basemask) {
+void chartobitset(char *s, const int readlen, read_bits_ref<bitset_size> b,
+                  read_bits<bitset_size> **basemask) {
   b.reset();
   for (int i = 0; i < readlen; i++) b |= basemask[i][(uint8_t)s[i]];
   return;
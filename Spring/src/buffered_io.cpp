@@ -0,0 +1,231 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#include "buffered_io.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include "params.h"
+
+namespace spring {
+
+// O_DIRECT needs buffers, sizes and file offsets aligned to the block size
+const size_t IO_ALIGNMENT = 4096;
+
+static std::atomic<uint64_t> read_ns(0), write_ns(0), read_bytes(0),
+    write_bytes(0);
+static std::atomic<bool> direct_io(false);
+static bool temp_gzip = false;
+
+io_stats get_io_stats() {
+  io_stats stats;
+  stats.read_seconds = read_ns / 1e9;
+  stats.write_seconds = write_ns / 1e9;
+  stats.read_bytes = read_bytes;
+  stats.write_bytes = write_bytes;
+  return stats;
+}
+
+void print_io_stats(const io_stats &before) {
+  io_stats now = get_io_stats();
+  std::cout << "Temporary file I/O: "
+            << now.read_seconds - before.read_seconds << " s reading "
+            << (now.read_bytes - before.read_bytes) / 1000000 << " MB, "
+            << now.write_seconds - before.write_seconds << " s writing "
+            << (now.write_bytes - before.write_bytes) / 1000000 << " MB\n";
+}
+
+void set_direct_io(const bool direct) { direct_io = direct; }
+
+bool parse_temp_compression(const std::string &method) {
+  if (method == "none") return false;
+  if (method == "gzip") return true;
+  throw std::runtime_error("Invalid temporary file compression: " + method);
+}
+
+void set_temp_gzip(const bool gzip) { temp_gzip = gzip; }
+
+bool get_temp_gzip() { return temp_gzip; }
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+buffered_filebuf::~buffered_filebuf() {
+  close();
+  free(buffer);
+}
+
+bool buffered_filebuf::open(const std::string &path,
+                            std::ios_base::openmode mode) {
+  close();
+  writing = (mode & std::ios::out) != 0;
+  int flags;
+  if (!writing)
+    flags = O_RDONLY;
+  else if (mode & std::ios::app)
+    flags = O_WRONLY | O_CREAT | O_APPEND;
+  else
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+  direct = false;
+#ifdef O_DIRECT
+  if (direct_io && !(mode & std::ios::app)) {
+    fd = ::open(path.c_str(), flags | O_DIRECT, 0644);
+    direct = (fd >= 0);
+  }
+#endif
+  // file systems without O_DIRECT (like tmpfs) refuse it
+  if (fd < 0) fd = ::open(path.c_str(), flags, 0644);
+  if (fd < 0) return false;
+  if (buffer == NULL &&
+      posix_memalign((void **)&buffer, IO_ALIGNMENT, IO_BUFFER_SIZE) != 0) {
+    buffer = NULL;
+    ::close(fd);
+    fd = -1;
+    return false;
+  }
+  failed = false;
+  if (writing)
+    setp(buffer, buffer + IO_BUFFER_SIZE);
+  else
+    setg(buffer, buffer, buffer);
+  return true;
+}
+
+bool buffered_filebuf::close() {
+  if (fd < 0) return true;
+  if (writing) write_buffer();
+  ::close(fd);
+  fd = -1;
+  setp(NULL, NULL);
+  setg(NULL, NULL, NULL);
+  return !failed;
+}
+
+void buffered_filebuf::disable_direct() {
+#ifdef O_DIRECT
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+  direct = false;
+}
+
+bool buffered_filebuf::write_buffer() {
+  size_t size = pptr() - pbase();
+  // only whole blocks can be written with O_DIRECT, which is the case for
+  // all but the last buffer
+  if (direct && size % IO_ALIGNMENT != 0) disable_direct();
+  auto start = std::chrono::steady_clock::now();
+  const char *data = pbase();
+  while (size > 0) {
+    ssize_t written = ::write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      failed = true;
+      break;
+    }
+    data += written;
+    size -= written;
+  }
+  write_ns += elapsed_ns(start);
+  write_bytes += data - pbase();
+  setp(buffer, buffer + IO_BUFFER_SIZE);
+  return !failed;
+}
+
+buffered_filebuf::int_type buffered_filebuf::overflow(int_type c) {
+  if (fd < 0 || !writing || !write_buffer()) return traits_type::eof();
+  if (!traits_type::eq_int_type(c, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int buffered_filebuf::sync() {
+  if (fd >= 0 && writing && !write_buffer()) return -1;
+  return 0;
+}
+
+buffered_filebuf::int_type buffered_filebuf::underflow() {
+  if (fd < 0 || writing) return traits_type::eof();
+  if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  auto start = std::chrono::steady_clock::now();
+  ssize_t count;
+  do {
+    count = ::read(fd, buffer, IO_BUFFER_SIZE);
+    // O_DIRECT reads can be refused for some files, read normally then
+    if (count < 0 && errno == EINVAL && direct) {
+      disable_direct();
+      errno = EINTR;
+    }
+  } while (count < 0 && errno == EINTR);
+  read_ns += elapsed_ns(start);
+  if (count <= 0) return traits_type::eof();
+  read_bytes += count;
+  setg(buffer, buffer, buffer + count);
+  return traits_type::to_int_type(*gptr());
+}
+
+temp_ofstream::temp_ofstream(const std::string &path)
+    : std::ostream(NULL), file(path, std::ios::binary) {
+  if (temp_gzip) {
+    filter.push(boost::iostreams::gzip_compressor());
+    filter.push(file);
+    rdbuf(&filter);
+  } else {
+    rdbuf(file.rdbuf());
+  }
+}
+
+temp_ofstream::~temp_ofstream() { close(); }
+
+void temp_ofstream::close() {
+  // the characters put since the last overflow are only handed to the gzip
+  // filter by a sync through filter itself, popping the file then closes the
+  // chain, which flushes the filter into it
+  if (!filter.empty()) {
+    filter.pubsync();
+    filter.pop();
+    filter.reset();
+  }
+  file.close();
+}
+
+temp_ifstream::temp_ifstream(const std::string &path)
+    : std::istream(NULL), file(path, std::ios::binary) {
+  if (temp_gzip) {
+    filter.push(boost::iostreams::gzip_decompressor());
+    filter.push(file);
+    rdbuf(&filter);
+  } else {
+    rdbuf(file.rdbuf());
+  }
+}
+
+void temp_ifstream::close() {
+  if (!filter.empty()) filter.reset();
+  file.close();
+}
+
+}  // namespace spring
@@ -0,0 +1,161 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#ifndef SPRING_BUFFERED_IO_H_
+#define SPRING_BUFFERED_IO_H_
+
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+namespace spring {
+
+// Buffered binary file streams for the temporary files passed between the
+// stages. They are drop-in replacements for std::ifstream and std::ofstream
+// that read and write through IO_BUFFER_SIZE byte aligned buffers, with one
+// system call per buffer (optionally bypassing the page cache, see
+// set_direct_io()), and count the time spent in these calls.
+
+// I/O of the buffered streams since the start of the process
+struct io_stats {
+  double read_seconds;
+  double write_seconds;
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+};
+
+io_stats get_io_stats();
+
+// print the I/O time and volume since before
+void print_io_stats(const io_stats &before);
+
+// open the buffered streams with O_DIRECT from now on, where the file system
+// supports it (appending streams never use it)
+void set_direct_io(const bool direct);
+
+// compression of the temporary files that reorder passes to the encoder
+// (--temp-compression): "none" (default) or "gzip". parse returns true for
+// gzip and throws for other values.
+bool parse_temp_compression(const std::string &method);
+void set_temp_gzip(const bool gzip);
+bool get_temp_gzip();
+
+class buffered_filebuf : public std::streambuf {
+ public:
+  buffered_filebuf() {}
+  ~buffered_filebuf();
+  buffered_filebuf(const buffered_filebuf &) = delete;
+  buffered_filebuf &operator=(const buffered_filebuf &) = delete;
+
+  // mode is std::ios::in for reading or std::ios::out (with std::ios::app to
+  // append) for writing. Returns false if the file could not be opened.
+  bool open(const std::string &path, std::ios_base::openmode mode);
+  bool is_open() const { return fd >= 0; }
+  // flush and close, returns false if a write failed
+  bool close();
+
+ protected:
+  int_type overflow(int_type c) override;
+  int_type underflow() override;
+  int sync() override;
+
+ private:
+  bool write_buffer();
+  void disable_direct();
+  int fd = -1;
+  bool writing = false;
+  bool direct = false;  // O_DIRECT in effect
+  bool failed = false;
+  char *buffer = NULL;
+};
+
+class buffered_ofstream : public std::ostream {
+ public:
+  buffered_ofstream() : std::ostream(NULL) { rdbuf(&buf); }
+  explicit buffered_ofstream(const std::string &path,
+                             std::ios_base::openmode mode = std::ios::out)
+      : std::ostream(NULL) {
+    rdbuf(&buf);
+    open(path, mode);
+  }
+  void open(const std::string &path,
+            std::ios_base::openmode mode = std::ios::out) {
+    if (buf.open(path, mode | std::ios::out))
+      clear();
+    else
+      setstate(std::ios::failbit);
+  }
+  bool is_open() const { return buf.is_open(); }
+  void close() {
+    if (!buf.close()) setstate(std::ios::failbit);
+  }
+
+ private:
+  buffered_filebuf buf;
+};
+
+class buffered_ifstream : public std::istream {
+ public:
+  buffered_ifstream() : std::istream(NULL) { rdbuf(&buf); }
+  explicit buffered_ifstream(const std::string &path,
+                             std::ios_base::openmode mode = std::ios::in)
+      : std::istream(NULL) {
+    rdbuf(&buf);
+    open(path, mode);
+  }
+  void open(const std::string &path,
+            std::ios_base::openmode mode = std::ios::in) {
+    if (buf.open(path, mode | std::ios::in))
+      clear();
+    else
+      setstate(std::ios::failbit);
+  }
+  bool is_open() const { return buf.is_open(); }
+  void close() { buf.close(); }
+
+ private:
+  buffered_filebuf buf;
+};
+
+// temporary file passed from reorder to the encoder, written through a gzip
+// filter if get_temp_gzip() and directly to the buffered file otherwise
+class temp_ofstream : public std::ostream {
+ public:
+  explicit temp_ofstream(const std::string &path);
+  ~temp_ofstream();
+  void close();
+
+ private:
+  buffered_ofstream file;
+  boost::iostreams::filtering_streambuf<boost::iostreams::output> filter;
+};
+
+class temp_ifstream : public std::istream {
+ public:
+  explicit temp_ifstream(const std::string &path);
+  void close();
+
+ private:
+  buffered_ifstream file;
+  boost::iostreams::filtering_streambuf<boost::iostreams::input> filter;
+};
+
+}  // namespace spring
+
+#endif  // SPRING_BUFFERED_IO_H_
@@ -6,136 +6,58 @@
 
 namespace spring {
 
-void call_reorder(const std::string &temp_dir, compression_params &cp) {
-  size_t bitset_size_reorder = (2 * cp.max_readlen - 1) / 64 * 64 + 64;
+// The reorder and encoder code is compiled for the widths of the common
+// Illumina read lengths 2x150 and 2x250 (2 bits per base for reorder, 3 for
+// encoder, rounded up to whole 64-bit words), and otherwise run with the
+// run time width kernel (bitset_size 0, see read_bits.h) on the number of
+// words that fits the longest read.
+static const size_t REORDER_BITSET_SIZES[] = {320, 512};
+static const size_t ENCODER_BITSET_SIZES[] = {512, 768};
+
+template <size_t N>
+static size_t select_bitset_size(const size_t (&sizes)[N],
+                                 const size_t num_bits) {
+  const size_t num_words = (num_bits + 63) / 64;
+  if (num_words > (size_t)RUNTIME_BITSET_MAX_WORDS)
+    throw std::runtime_error("Wrong bitset size.");
+  for (size_t i = 0; i < N; i++)
+    if (sizes[i] == 64 * num_words) return sizes[i];
+  runtime_bitset::num_words = num_words;
+  return 0;
+}
+
+void call_reorder(const std::string &temp_dir, compression_params &cp,
+                  const int &num_parts, const reorder_params &rp) {
+  size_t bitset_size_reorder =
+      select_bitset_size(REORDER_BITSET_SIZES, 2 * cp.max_readlen);
   switch (bitset_size_reorder) {
-    case 64:
-      reorder_main<64>(temp_dir, cp);
-      break;
-    case 128:
-      reorder_main<128>(temp_dir, cp);
-      break;
-    case 192:
-      reorder_main<192>(temp_dir, cp);
-      break;
-    case 256:
-      reorder_main<256>(temp_dir, cp);
+    case 0:
+      reorder_main<0>(temp_dir, cp, num_parts, rp);
       break;
     case 320:
-      reorder_main<320>(temp_dir, cp);
-      break;
-    case 384:
-      reorder_main<384>(temp_dir, cp);
-      break;
-    case 448:
-      reorder_main<448>(temp_dir, cp);
+      reorder_main<320>(temp_dir, cp, num_parts, rp);
       break;
     case 512:
-      reorder_main<512>(temp_dir, cp);
-      break;
-    case 576:
-      reorder_main<576>(temp_dir, cp);
-      break;
-    case 640:
-      reorder_main<640>(temp_dir, cp);
-      break;
-    case 704:
-      reorder_main<704>(temp_dir, cp);
-      break;
-    case 768:
-      reorder_main<768>(temp_dir, cp);
-      break;
-    case 832:
-      reorder_main<832>(temp_dir, cp);
-      break;
-    case 896:
-      reorder_main<896>(temp_dir, cp);
-      break;
-    case 960:
-      reorder_main<960>(temp_dir, cp);
-      break;
-    case 1024:
-      reorder_main<1024>(temp_dir, cp);
+      reorder_main<512>(temp_dir, cp, num_parts, rp);
       break;
     default:
       throw std::runtime_error("Wrong bitset size.");
   }
 }
 
-void call_encoder(const std::string &temp_dir, compression_params &cp, bool deep, int gpu_id) {
-  size_t bitset_size_encoder = (3 * cp.max_readlen - 1) / 64 * 64 + 64;
+void call_encoder(const std::string &temp_dir, compression_params &cp,
+                  const int &num_parts, const encoder_params &ep, bool deep) {
+  size_t bitset_size_encoder =
+      select_bitset_size(ENCODER_BITSET_SIZES, 3 * cp.max_readlen);
   switch (bitset_size_encoder) {
-    case 64:
-      encoder_main<64>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 128:
-      encoder_main<128>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 192:
-      encoder_main<192>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 256:
-      encoder_main<256>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 320:
-      encoder_main<320>(temp_dir, cp,deep, gpu_id);
-      break;
-    case 384:
-      encoder_main<384>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 448:
-      encoder_main<448>(temp_dir, cp, deep, gpu_id);
+    case 0:
+      encoder_main<0>(temp_dir, cp, num_parts, ep, deep);
       break;
     case 512:
-      encoder_main<512>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 576:
-      encoder_main<576>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 640:
-      encoder_main<640>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 704:
-      encoder_main<704>(temp_dir, cp, deep, gpu_id);
+      encoder_main<512>(temp_dir, cp, num_parts, ep, deep);
       break;
     case 768:
-      encoder_main<768>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 832:
-      encoder_main<832>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 896:
-      encoder_main<896>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 960:
-      encoder_main<960>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1024:
-      encoder_main<1024>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1088:
-      encoder_main<1088>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1152:
-      encoder_main<1152>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1216:
-      encoder_main<1216>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1280:
-      encoder_main<1280>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1344:
-      encoder_main<1344>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1408:
-      encoder_main<1408>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1472:
-      encoder_main<1472>(temp_dir, cp, deep, gpu_id);
-      break;
-    case 1536:
-      encoder_main<1536>(temp_dir, cp, deep, gpu_id);
+      encoder_main<768>(temp_dir, cp, num_parts, ep, deep);
       break;
     default:
       throw std::runtime_error("Wrong bitset size.");
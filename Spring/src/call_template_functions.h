@@ -6,9 +6,11 @@
 
 namespace spring {
 
-void call_reorder(const std::string &temp_dir, compression_params &cp);
+void call_reorder(const std::string &temp_dir, compression_params &cp,
+                  const int &num_parts, const reorder_params &rp);
 
-void call_encoder(const std::string &temp_dir, compression_params &cp, bool deep, int gpu_id);
+void call_encoder(const std::string &temp_dir, compression_params &cp,
+                  const int &num_parts, const encoder_params &ep, bool deep);
 
 }  // namespace spring
 
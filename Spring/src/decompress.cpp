@@ -16,11 +16,15 @@ This code is a modified version of SPRING, originally developed by the Universit
 
 #include "decompress.h"
 #include <omp.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 #include "libbsc/bsc.h"
+#include "nucleotide_cm.h"
+#include "params.h"
 #include "util.h"
 
 #include <filesystem>  // 헤더 파일 포함
@@ -31,27 +35,14 @@ namespace fs = std::filesystem;
 
 namespace spring {
 
-fs::path find_unique_folder(const fs::path& basedir) {
-    fs::path unique_folder;
-
-    for (const auto& entry : fs::directory_iterator(basedir)) {
-        if (entry.is_directory()) {
-            // 유일한 폴더를 찾았으면 바로 반환
-            unique_folder = entry.path();
-            break;
-        }
-    }
-
-    return unique_folder;
-}
-
 void set_dec_noise_array(char **dec_noise);
 
 void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
                       const std::string &outfile_2,
                       const compression_params &cp, const int &num_thr,
                       const uint64_t &start_num, const uint64_t &end_num,
-                      const bool &gzip_flag, const int &gzip_level, const bool &deep_flag, const int &gpu_id) {
+                      const bool &gzip_flag, const int &gzip_level,
+                      const bool &append_flag, const int &gpu_id) {
   std::string basedir = temp_dir;
 
   std::string file_seq = basedir + "read_seq.bin";
@@ -86,10 +77,11 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
 
   for (int j = 0; j < 2; j++) {
     if (j == 1 && !paired_end) continue;
-    if (gzip_flag)
-      fout[j].open(outfile[j], std::ios::binary);
-    else
-      fout[j].open(outfile[j]);
+    std::ios::openmode mode = std::ios::out;
+    if (gzip_flag) mode |= std::ios::binary;
+    // later segments of the archive are appended (gzip members concatenate)
+    if (append_flag) mode |= std::ios::app;
+    fout[j].open(outfile[j], mode);
   }
 
   // Check that we were able to open the output files
@@ -126,7 +118,7 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
   // Decompress read_seq and store in a string
   std::string seq;
   int num_thr_e = cp.num_thr;  // number of encoding threads
-  decompress_unpack_seq(file_seq, num_thr_e, num_thr, basedir, deep_flag, gpu_id);
+  decompress_unpack_seq(file_seq, num_thr_e, num_thr, basedir, gpu_id);
   for (int tid_e = 0; tid_e < num_thr_e; tid_e++) {
     uint64_t prev_len = seq.size();
     uint64_t file_len;
@@ -172,75 +164,37 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
             // Read decompression done when j = 0 (even for PE)
             uint32_t block_num = num_blocks_done + tid;
 
-            // Decompress files with zpaq
-            std::string outfile_zpaq = file_flag + '.' + std::to_string(block_num);
-            std::string infile_zpaq = outfile_zpaq + ".zpaq";
-            std::string command = "zpaq x " + infile_zpaq + " -to " + basedir;
-            std::system(command.c_str());
-            remove(infile_zpaq.c_str());
-
-            outfile_zpaq = file_pos + '.' + std::to_string(block_num);
-            infile_zpaq = outfile_zpaq + ".zpaq";
-            command = "zpaq x " + infile_zpaq + " -to " + basedir;
-            std::system(command.c_str());
-            remove(infile_zpaq.c_str());
-
-            outfile_zpaq = file_noise + '.' + std::to_string(block_num);
-            infile_zpaq = outfile_zpaq + ".zpaq";
-            command = "zpaq x " + infile_zpaq + " -to " + basedir;
-            std::system(command.c_str());
-            remove(infile_zpaq.c_str());
-
-            outfile_zpaq = file_noisepos + '.' + std::to_string(block_num);
-            infile_zpaq = outfile_zpaq + ".zpaq";
-            command = "zpaq x " + infile_zpaq + " -to " + basedir;
-            std::system(command.c_str());
-            remove(infile_zpaq.c_str());
-
-            outfile_zpaq = file_unaligned + '.' + std::to_string(block_num);
-            infile_zpaq = outfile_zpaq + ".zpaq";
-            command = "zpaq x " + infile_zpaq + " -to " + basedir;
-            std::system(command.c_str());
-            remove(infile_zpaq.c_str());
-
-            outfile_zpaq = file_readlength + '.' + std::to_string(block_num);
-            infile_zpaq = outfile_zpaq + ".zpaq";
-            command = "zpaq x " + infile_zpaq + " -to " + basedir;
-            std::system(command.c_str());
-            remove(infile_zpaq.c_str());
-
-            outfile_zpaq = file_RC + '.' + std::to_string(block_num);
-            infile_zpaq = outfile_zpaq + ".zpaq";
-            command = "zpaq x " + infile_zpaq + " -to " + basedir;
-            std::system(command.c_str());
-            remove(infile_zpaq.c_str());
-
-            if (paired_end) {
-              outfile_zpaq = file_pos_pair + '.' + std::to_string(block_num);
-              infile_zpaq = outfile_zpaq + ".zpaq";
-              command = "zpaq x " + infile_zpaq + " -to " + basedir;
-              std::system(command.c_str());
-              remove(infile_zpaq.c_str());
-
-              outfile_zpaq = file_RC_pair + '.' + std::to_string(block_num);
-              infile_zpaq = outfile_zpaq + ".zpaq";
-              command = "zpaq x " + infile_zpaq + " -to " + basedir;
-              std::system(command.c_str());
+            // Decompress files with zpaq, each block into a directory of
+            // its own so that the extracted files are found without a search
+            const std::string block_str = '.' + std::to_string(block_num);
+            const std::string block_dir = basedir + "blk" + block_str;
+            auto extract_block_file = [&](const std::string &file,
+                                          const std::string &name) {
+              std::string infile_zpaq = file + block_str + ".zpaq";
+              fs::path path =
+                  zpaq_extract(infile_zpaq, block_dir, name + block_str);
               remove(infile_zpaq.c_str());
+              return path;
+            };
+            fs::path file_flag_path = extract_block_file(file_flag, "e");
+            fs::path file_pos_path = extract_block_file(file_pos, "a");
+            fs::path file_noise_path = extract_block_file(file_noise, "b");
+            fs::path file_noisepos_path =
+                extract_block_file(file_noisepos, "c");
+            fs::path file_unaligned_path =
+                extract_block_file(file_unaligned, "f");
+            fs::path file_readlength_path;
+            if (!cp.fixed_readlen)
+              file_readlength_path = extract_block_file(file_readlength, "g");
+            fs::path file_RC_path = extract_block_file(file_RC, "d");
+            fs::path file_pos_pair_path, file_RC_pair_path;
+            if (paired_end) {
+              file_pos_pair_path =
+                  extract_block_file(file_pos_pair, "read_pos_pair.bin");
+              file_RC_pair_path =
+                  extract_block_file(file_RC_pair, "read_rev_pair.txt");
             }
 
-            // 최신 폴더 찾기 및 경로 설정
-            fs::path decompressed_folder = find_unique_folder(basedir);
-            fs::path file_flag_path = decompressed_folder / ("e." + std::to_string(block_num));
-            fs::path file_pos_path = decompressed_folder / ("a." + std::to_string(block_num));
-            fs::path file_pos_pair_path = decompressed_folder / ("read_pos_pair.bin." + std::to_string(block_num));
-            fs::path file_RC_path = decompressed_folder / ("d." + std::to_string(block_num));
-            fs::path file_RC_pair_path = decompressed_folder / ("read_rev_pair.txt." + std::to_string(block_num));
-            fs::path file_readlength_path = decompressed_folder / ("g." + std::to_string(block_num));
-            fs::path file_unaligned_path = decompressed_folder / ("f." + std::to_string(block_num));
-            fs::path file_noise_path = decompressed_folder / ("b." + std::to_string(block_num));
-            fs::path file_noisepos_path = decompressed_folder / ("c." + std::to_string(block_num));
-            
             // 파일 경로들을 체크하는 함수
             auto check_file_open = [](const fs::path& file_path) {
                 std::ifstream file(file_path);
@@ -254,7 +208,7 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
             check_file_open(file_flag_path);
             check_file_open(file_pos_path);
             check_file_open(file_RC_path);
-            check_file_open(file_readlength_path);
+            if (!cp.fixed_readlen) check_file_open(file_readlength_path);
             check_file_open(file_unaligned_path);
             check_file_open(file_noise_path);
             check_file_open(file_noisepos_path);
@@ -269,9 +223,12 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
                                 std::ios::binary);
             std::ifstream f_RC(file_RC_path);
             std::ifstream f_unaligned(file_unaligned_path);
-            std::ifstream f_readlength(
-                file_readlength_path,
-                std::ios::binary);
+            // no read lengths are stored if all reads have the same length
+            std::ifstream f_readlength;
+            if (!cp.fixed_readlen)
+              f_readlength.open(file_readlength_path, std::ios::binary);
+            const uint16_t fixed_readlen =
+                cp.fixed_readlen ? cp.max_readlen : 0;
             std::ifstream f_pos_pair;
             std::ifstream f_RC_pair;
             if (paired_end) {
@@ -291,7 +248,25 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
             for (uint32_t i = tid * num_reads_per_block;
                  i < tid * num_reads_per_block + num_reads_thr; i++) {
               f_flag >> flag;
-              f_readlength.read((char *)&rl, sizeof(uint16_t));
+              if (flag == '5' || flag == '6') {
+                // same as the previous read (pair) of the block, or its
+                // reverse complement
+                read_lengths_array_1[i] = read_lengths_array_1[i - 1];
+                if (flag == '5')
+                  read_array_1[i] = read_array_1[i - 1];
+                else
+                  read_array_1[i] = reverse_complement(
+                      read_array_1[i - 1], read_lengths_array_1[i]);
+                if (paired_end) {
+                  read_lengths_array_2[i] = read_lengths_array_2[i - 1];
+                  read_array_2[i] = read_array_2[i - 1];
+                }
+                continue;
+              }
+              if (fixed_readlen)
+                rl = fixed_readlen;
+              else
+                f_readlength.read((char *)&rl, sizeof(uint16_t));
               read_lengths_array_1[i] = rl;
               singleton_1 = (flag == '2') || (flag == '4');
               if (!singleton_1) {
@@ -338,7 +313,10 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
               if (paired_end) {
                 int16_t pos_pair_16;
                 singleton_2 = (flag == '2') || (flag == '3');
-                f_readlength.read((char *)&rl, sizeof(uint16_t));
+                if (fixed_readlen)
+                  rl = fixed_readlen;
+                else
+                  f_readlength.read((char *)&rl, sizeof(uint16_t));
                 read_lengths_array_2[i] = rl;
                 if (!singleton_2) {
                   if (flag == '1' || flag == '4') {
@@ -394,17 +372,7 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
             }
 
             // Remove temporary decompressed files
-            remove(file_flag_path.c_str());
-            remove(file_pos_path.c_str());
-            remove(file_RC_path.c_str());
-            remove(file_readlength_path.c_str());
-            remove(file_unaligned_path.c_str());
-            remove(file_noise_path.c_str());
-            remove(file_noisepos_path.c_str());
-            if (paired_end) {
-                remove(file_pos_pair_path.c_str());
-                remove(file_RC_pair_path.c_str());
-            }
+            fs::remove_all(block_dir);
 
           }
           // Decompress ids and quality
@@ -492,7 +460,7 @@ void decompress_long(const std::string &temp_dir, const std::string &outfile_1,
                      const std::string &outfile_2, const compression_params &cp,
                      const int &num_thr, const uint64_t &start_num,
                      const uint64_t &end_num, const bool &gzip_flag,
-                     const int &gzip_level, const bool &deep_flag, const int &gpu_id) {
+                     const int &gzip_level, const bool &append_flag) {
   std::string infileread[2];
   std::string infilequality[2];
   std::string infileid[2];
@@ -520,10 +488,11 @@ void decompress_long(const std::string &temp_dir, const std::string &outfile_1,
 
   for (int j = 0; j < 2; j++) {
     if (j == 1 && !paired_end) continue;
-    if (gzip_flag)
-      fout[j].open(outfile[j], std::ios::binary);
-    else
-      fout[j].open(outfile[j]);
+    std::ios::openmode mode = std::ios::out;
+    if (gzip_flag) mode |= std::ios::binary;
+    // later segments of the archive are appended (gzip members concatenate)
+    if (append_flag) mode |= std::ios::app;
+    fout[j].open(outfile[j], mode);
   }
 
   // Check that we were able to open the output files
@@ -580,11 +549,13 @@ void decompress_long(const std::string &temp_dir, const std::string &outfile_1,
           // Decompress read lengths file using zpaq and read into array
           std::string infile_name = infilereadlength[j] + "." +
                                     std::to_string(num_blocks_done + tid) + ".zpaq";
-          std::string outfile_name =
-              infilereadlength[j] + "." + std::to_string(num_blocks_done + tid);
-          // Use zpaq to decompress the file
-          std::string command = "zpaq x " + infile_name + " -to " + basedir;
-          std::system(command.c_str());
+          // Use zpaq to decompress the file into a directory of its own
+          std::string block_dir =
+              basedir + "/blk." + std::to_string(num_blocks_done + tid);
+          std::string outfile_name = zpaq_extract(
+              infile_name, block_dir,
+              fs::path(infilereadlength[j]).filename().string() + "." +
+                  std::to_string(num_blocks_done + tid));
           // Remove the zpaq compressed file
           remove(infile_name.c_str());
                 std::ifstream fin_readlength(outfile_name, std::ios::binary);
@@ -593,7 +564,7 @@ void decompress_long(const std::string &temp_dir, const std::string &outfile_1,
                   fin_readlength.read((char *)&read_lengths_array[i],
                                       sizeof(uint32_t));
                 fin_readlength.close();
-          remove(outfile_name.c_str());
+          fs::remove_all(block_dir);
 
           // Decompress reads
           infile_name =
@@ -668,7 +639,22 @@ void decompress_long(const std::string &temp_dir, const std::string &outfile_1,
 }
 
 void decompress_unpack_seq(const std::string &infile_seq, const int &num_thr_e,
-                           const int &num_thr, const std::string &temp_dir, const bool &deep_flag, const int &gpu_id) {
+                           const int &num_thr, const std::string &temp_dir, const int &gpu_id) {
+  bool deep_native = fs::exists(infile_seq + ".0.deep");
+  if (deep_native || fs::exists(infile_seq + ".0.cm")) {
+    // coded with --deep or --seq-codec cm (whatever the flags now)
+    std::vector<std::string> infiles, outfiles;
+    for (int tid_e = 0; tid_e < num_thr_e; tid_e++) {
+      outfiles.push_back(infile_seq + '.' + std::to_string(tid_e));
+      infiles.push_back(outfiles.back() + (deep_native ? ".deep" : ".cm"));
+    }
+    if (deep_native)
+      deep_decompress_bases(infiles, outfiles, num_thr);
+    else
+      cm_decompress_bases(infiles, outfiles, num_thr);
+    for (const std::string &infile : infiles) remove(infile.c_str());
+    return;
+  }
 #pragma omp parallel
   {
     std::string basedir = temp_dir;
@@ -678,10 +664,12 @@ void decompress_unpack_seq(const std::string &infile_seq, const int &num_thr_e,
 
       std::string outfile = infile_seq + '.' + std::to_string(tid_e);
       // std::ifstream in_seq;
-      fs::path input_file_path;    
-      if(deep_flag){
-      // Define input and output file names for Trace decompression
+      fs::path input_file_path;
+      std::string seq_dir;
+      // archives of the former Python deep mode (Trace/, needs PyTorch),
+      // format version 0 with tail files
       std::string trace = outfile + ".tmp.compressed.combined";
+      if(fs::exists(trace)){
       // std::string trace = outfile + ".compressed.combined";
       std::cout << "Infile trace: " << trace << std::endl;
       std::string bash_cmd = "python3 -u ../Trace/decompressor.py --input_dir " + trace + " --batch_size 512 --gpu_id " + std::to_string(gpu_id) + " --hidden_dim 256 --ffn_dim 4096 --seq_len 8 --learning_rate 1e-3 --vocab_dim 64" ;
@@ -700,53 +688,56 @@ void decompress_unpack_seq(const std::string &infile_seq, const int &num_thr_e,
       // Define input and output file names for zpaq decompression
       std::string infile_zpaq = infile_seq + '.' + std::to_string(tid_e) + ".zpaq";
 
-      // Use zpaq to decompress the file
-      std::string command = "zpaq x " + infile_zpaq + " -to " +basedir;
-      std::system(command.c_str());
+      // Use zpaq to decompress the file into a directory of its own
+      seq_dir = (fs::path(basedir) / ("seq." + std::to_string(tid_e))).string();
+      input_file_path = zpaq_extract(
+          infile_zpaq, seq_dir, "read_seq.bin." + std::to_string(tid_e) + ".tmp");
       // Remove the zpaq compressed file
       remove(infile_zpaq.c_str());
-
-      // 최신 폴더 찾기
-      fs::path decompressed_folder = find_unique_folder(basedir);
-      input_file_path = decompressed_folder / ("read_seq.bin." + std::to_string(tid_e) + ".tmp");
-      std::cout << decompressed_folder << std::endl;
-      // in_seq.open(input_file_path, std::ios::binary);
-      // if (!in_seq) {
-      //     std::cerr << "Error: File " << input_file_path << " could not be opened." << std::endl;
-      // }
       }
 
       //std::cout << "현재 경로: " << std::filesystem::current_path() << std::endl;
-      std::ofstream f_seq(infile_seq + '.' + std::to_string(tid_e) + ".tmp");
+      std::ofstream f_seq(infile_seq + '.' + std::to_string(tid_e) + ".tmp",
+                          std::ios::binary);
       std::ifstream in_seq(input_file_path, std::ios::binary);
-      std::ifstream in_seq_tail(infile_seq + '.' + std::to_string(tid_e) +
-                                ".tail");
-      char inttobase[4];
-      inttobase[0] = 'A';
-      inttobase[1] = 'C';
-      inttobase[2] = 'G';
-      inttobase[3] = 'T';
-
-      uint8_t dnabin;
-      in_seq.read((char *)&dnabin, sizeof(uint8_t));
-      while (!in_seq.eof()) {
-        f_seq << inttobase[dnabin % 4];
-        dnabin /= 4;
-        f_seq << inttobase[dnabin % 4];
-        dnabin /= 4;
-        f_seq << inttobase[dnabin % 4];
-        dnabin /= 4;
-        f_seq << inttobase[dnabin % 4];
-        in_seq.read((char *)&dnabin, sizeof(uint8_t));
+      // archives of format version 0 (zpaq or the Python deep mode) keep the
+      // last file_len % 4 bases in a tail file and every byte of the packed
+      // file is full
+      std::string tail_file = outfile + ".tail";
+      bool legacy_tail = fs::exists(tail_file);
+      uint64_t num_bases;
+      if (legacy_tail) {
+        num_bases = 4 * fs::file_size(input_file_path);
+      } else {
+        // the last byte of the packed file is the number of bases in the byte
+        // before it (0 if that one is full)
+        uint64_t num_bytes = fs::file_size(input_file_path) - 1;
+        uint8_t tail_len;
+        in_seq.seekg(num_bytes);
+        in_seq.read((char *)&tail_len, sizeof(uint8_t));
+        in_seq.seekg(0);
+        num_bases = 4 * num_bytes - (tail_len == 0 ? 0 : 4 - tail_len);
+      }
+      std::vector<uint8_t> dnabin(PACK_BLOCK_SIZE / 4);
+      std::vector<char> dnabase(PACK_BLOCK_SIZE);
+      for (uint64_t i = 0; i < num_bases; i += PACK_BLOCK_SIZE) {
+        uint64_t block_len = std::min((uint64_t)PACK_BLOCK_SIZE, num_bases - i);
+        in_seq.read((char *)dnabin.data(), (block_len + 3) / 4);
+        unpack_bases(dnabin.data(), block_len, dnabase.data());
+        f_seq.write(dnabase.data(), block_len);
       }
       in_seq.close();
-
-      f_seq << in_seq_tail.rdbuf();
-      in_seq_tail.close();
+      if (legacy_tail) {
+        if (fs::file_size(tail_file) > 0) {
+          std::ifstream in_seq_tail(tail_file);
+          f_seq << in_seq_tail.rdbuf();
+        }
+        remove(tail_file.c_str());
+      }
       f_seq.close();
 
       remove(input_file_path.c_str());
-      remove((infile_seq + '.' + std::to_string(tid_e) + ".tail").c_str());
+      if (!seq_dir.empty()) fs::remove_all(seq_dir);
       rename((infile_seq + '.' + std::to_string(tid_e) + ".tmp").c_str(),
              (infile_seq + '.' + std::to_string(tid_e)).c_str());
     
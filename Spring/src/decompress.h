@@ -26,16 +26,17 @@ void decompress_short(const std::string &temp_dir, const std::string &outfile_1,
                       const std::string &outfile_2,
                       const compression_params &cp, const int &num_thr,
                       const uint64_t &start_num, const uint64_t &end_num,
-                      const bool &gzip_flag, const int &gzip_level, const bool &deep_flag, const int &gpu_id);
+                      const bool &gzip_flag, const int &gzip_level,
+                      const bool &append_flag, const int &gpu_id);
 
 void decompress_long(const std::string &temp_dir, const std::string &outfile_1,
                      const std::string &outfile_2, const compression_params &cp,
                      const int &num_thr, const uint64_t &start_num,
                      const uint64_t &end_num, const bool &gzip_flag,
-                     const int &gzip_level, const bool &deep_flag, const int &gpu_id);
+                     const int &gzip_level, const bool &append_flag);
 
 void decompress_unpack_seq(const std::string &infile_seq, const int &num_thr_e,
-                           const int &num_thr,const std::string &temp_dir, const bool &deep_flag, const int &gpu_id);
+                           const int &num_thr,const std::string &temp_dir, const int &gpu_id);
                            
 
 }  // namespace spring
@@ -17,153 +17,380 @@ This code is a modified version of SPRING, originally developed by the Universit
 #include "encoder.h"
 #include <omp.h>
 #include <algorithm>
-#include <array>
 #include <bitset>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <list>
 #include <string>
 #include <vector>
 #include "libbsc/bsc.h"
+#include "nucleotide_cm.h"
+#include "permute.h"
 
 namespace spring {
 
-std::string buildcontig(std::list<contig_reads> &current_contig,
-                        const uint32_t &list_size) {
-  static const char longtochar[5] = {'A', 'C', 'G', 'T', 'N'};
-  static const long chartolong[128] = {
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 1, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 3, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-  };
-  if (list_size == 1) return (current_contig.front()).read;
-  auto current_contig_it = current_contig.begin();
-  int64_t currentpos = 0, currentsize = 0, to_insert;
-  std::vector<std::array<long, 4>> count;
-  for (; current_contig_it != current_contig.end(); ++current_contig_it) {
-    if (current_contig_it == current_contig.begin())  // first read
-      to_insert = (*current_contig_it).read_length;
-    else {
-      currentpos = (*current_contig_it).pos;
-      if (currentpos + (*current_contig_it).read_length > currentsize)
-        to_insert = currentpos + (*current_contig_it).read_length - currentsize;
-      else
-        to_insert = 0;
+void substituted_N::load(const std::string &file, const uint32_t num_reads) {
+  has_N.assign(num_reads, false);
+  start.assign(1, 0);
+  buffered_ifstream fin(file, std::ios::binary);
+  uint32_t read_num;
+  uint16_t num_N;
+  while (fin.read((char *)&read_num, sizeof(uint32_t))) {
+    fin.read((char *)&num_N, sizeof(uint16_t));
+    pos.resize(pos.size() + num_N);
+    fin.read((char *)&pos[pos.size() - num_N], num_N * sizeof(uint16_t));
+    has_N[read_num] = true;
+    reads.push_back(read_num);
+    start.push_back(pos.size());
+  }
+}
+
+void contig_arena::clear() {
+  bases.clear();
+  start.clear();
+  pos.clear();
+  RC.clear();
+  order.clear();
+  read_length.clear();
+}
+
+void contig_arena::push_back(const std::string &read, const int64_t read_pos,
+                             const char rc, const uint32_t read_order,
+                             const uint16_t rl) {
+  start.push_back(bases.size());
+  bases.append(read, 0, rl);
+  pos.push_back(read_pos);
+  RC.push_back(rc);
+  order.push_back(read_order);
+  read_length.push_back(rl);
+}
+
+void contig_arena::sort_by_pos() {
+  const uint32_t n = size();
+  sorted.resize(n);
+  for (uint32_t i = 0; i < n; i++) sorted[i] = i;
+  if (n < 64) {
+    // insertion sort, reads mostly arrive in order of pos
+    for (uint32_t i = 1; i < n; i++) {
+      uint32_t r = sorted[i];
+      uint32_t j = i;
+      for (; j > 0 && pos[sorted[j - 1]] > pos[r]; j--)
+        sorted[j] = sorted[j - 1];
+      sorted[j] = r;
     }
-    count.insert(count.end(), to_insert, {0, 0, 0, 0});
-    currentsize = currentsize + to_insert;
-    for (long i = 0; i < (*current_contig_it).read_length; i++)
-      count[currentpos + i]
-           [chartolong[(uint8_t)(*current_contig_it).read[i]]] += 1;
+    return;
   }
-  std::string ref(count.size(), 'A');
-  for (size_t i = 0; i < count.size(); i++) {
-    long max = 0, indmax = 0;
-    for (long j = 0; j < 4; j++)
-      if (count[i][j] > max) {
-        max = count[i][j];
-        indmax = j;
-      }
+  int64_t min_pos = *std::min_element(pos.begin(), pos.end());
+  uint64_t max_key = 0;
+  keys.resize(n);
+  for (uint32_t i = 0; i < n; i++) {
+    keys[i] = (uint64_t)(pos[i] - min_pos);
+    max_key = std::max(max_key, keys[i]);
+  }
+  int key_bits = 0;
+  while (key_bits < 64 && (max_key >> key_bits) != 0) key_bits++;
+  keys_tmp.resize(n);
+  sorted_tmp.resize(n);
+  radix_sort_pairs(keys.data(), sorted.data(), keys_tmp.data(),
+                   sorted_tmp.data(), n, key_bits);
+}
+
+std::string buildcontig(contig_arena &contig) {
+  static const char longtochar[4] = {'A', 'C', 'G', 'T'};
+  // 0-3 for ACGT, 4 for N and other characters (not counted)
+  static const uint8_t chartolong[256] = {
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0,
+      4, 1, 4, 4, 4, 2, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 3, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+      4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+  };
+  const uint32_t n = contig.size();
+  if (n == 1) return contig.bases;
+  // positions start at 0 so the contig ends at the furthest read end
+  uint64_t len = 0;
+  for (uint32_t i = 0; i < n; i++)
+    len = std::max(len, (uint64_t)(contig.pos[i] + contig.read_length[i]));
+  // one count plane per base (plus one for N), so that each read adds to a
+  // contiguous run of each plane and the consensus loop scans the planes
+  // linearly
+  std::vector<uint32_t> &count = contig.count;
+  count.assign(5 * len, 0);
+  for (uint32_t i = 0; i < n; i++) {
+    const char *read = &contig.bases[contig.start[i]];
+    uint32_t *count_pos = count.data() + contig.pos[i];
+    for (uint16_t j = 0; j < contig.read_length[i]; j++)
+      count_pos[chartolong[(uint8_t)read[j]] * len + j]++;
+  }
+  std::string ref(len, 'A');
+  const uint32_t *count_A = count.data(), *count_C = count_A + len,
+                 *count_G = count_C + len, *count_T = count_G + len;
+  for (uint64_t i = 0; i < len; i++) {
+    uint32_t max = count_A[i];
+    int indmax = 0;
+    if (count_C[i] > max) {
+      max = count_C[i];
+      indmax = 1;
+    }
+    if (count_G[i] > max) {
+      max = count_G[i];
+      indmax = 2;
+    }
+    if (count_T[i] > max) indmax = 3;
     ref[i] = longtochar[indmax];
   }
   return ref;
 }
 
 void writecontig(const std::string &ref,
-                 std::list<contig_reads> &current_contig, std::ofstream &f_seq,
-                 std::ofstream &f_pos, std::ofstream &f_noise,
-                 std::ofstream &f_noisepos, std::ofstream &f_order,
-                 std::ofstream &f_RC, std::ofstream &f_readlength,
+                 const contig_arena &contig, std::ostream &f_seq,
+                 std::ostream &f_pos, std::ostream &f_noise,
+                 std::ostream &f_noisepos, std::ostream &f_order,
+                 std::ostream &f_RC, std::ostream &f_readlength,
                  const encoder_global &eg, uint64_t &abs_pos) {
   f_seq << ref;
   uint16_t pos_var;
   long prevj = 0;
-  auto current_contig_it = current_contig.begin();
-  long currentpos;
   uint64_t abs_current_pos;
-  for (; current_contig_it != current_contig.end(); ++current_contig_it) {
-    currentpos = (*current_contig_it).pos;
+  for (uint32_t i : contig.sorted) {
+    const char *read = &contig.bases[contig.start[i]];
+    const char *ref_read = &ref[contig.pos[i]];
     prevj = 0;
-    for (long j = 0; j < (*current_contig_it).read_length; j++)
-      if ((*current_contig_it).read[j] != ref[currentpos + j]) {
-        f_noise << eg.enc_noise[(uint8_t)ref[currentpos + j]]
-                               [(uint8_t)(*current_contig_it).read[j]];
+    for (long j = 0; j < contig.read_length[i]; j++)
+      if (read[j] != ref_read[j]) {
+        f_noise << eg.enc_noise[(uint8_t)ref_read[j]][(uint8_t)read[j]];
         pos_var = j - prevj;
         f_noisepos.write((char *)&pos_var, sizeof(uint16_t));
         prevj = j;
       }
     f_noise << "\n";
-    abs_current_pos = abs_pos + currentpos;
+    abs_current_pos = abs_pos + contig.pos[i];
     f_pos.write((char *)&abs_current_pos, sizeof(uint64_t));
-    f_order.write((char *)&((*current_contig_it).order), sizeof(uint32_t));
-    f_readlength.write((char *)&((*current_contig_it).read_length),
-                       sizeof(uint16_t));
-    f_RC << (*current_contig_it).RC;
+    f_order.write((char *)&contig.order[i], sizeof(uint32_t));
+    if (!eg.fixed_readlen)
+      f_readlength.write((char *)&contig.read_length[i], sizeof(uint16_t));
+    f_RC << contig.RC[i];
   }
   abs_pos += ref.size();
   return;
 }
 
-void pack_compress_seq(const encoder_global &eg, uint64_t *file_len_seq_thr, bool deep, int gpu_id) {
-#pragma omp parallel
+// invertible mix of a k-mer, so that minimizers are not biased towards
+// low complexity k-mers
+static uint64_t hash_kmer(uint64_t kmer) {
+  kmer ^= kmer >> 33;
+  kmer *= 0xff51afd7ed558ccdULL;
+  kmer ^= kmer >> 33;
+  kmer *= 0xc4ceb9fe1a85ec53ULL;
+  kmer ^= kmer >> 33;
+  return kmer;
+}
+
+// (hash, offset) of the minimizers of s: the k-mer with the smallest hash
+// (leftmost on ties) of every W_SINGLETON_INDEX consecutive k-mers, or of
+// all k-mers if there are fewer. K-mers with N are skipped.
+static void find_minimizers(const char *s, const uint64_t len,
+                            std::vector<std::pair<uint64_t, uint64_t>> &out) {
+  static const int k = K_SINGLETON_INDEX, w = W_SINGLETON_INDEX;
+  const uint64_t kmer_mask = (1ULL << (2 * k)) - 1;
+  out.clear();
+  if (len < (uint64_t)k) return;
+  const uint64_t num_kmers = len - k + 1;
+  uint64_t window[w];  // hashes of the last w k-mers (UINT64_MAX if N)
+  uint64_t kmer = 0;
+  int valid = 0;  // bases since the last N
+  for (uint64_t i = 0; i < len; i++) {
+    int code;
+    switch (s[i]) {
+      case 'A': code = 0; break;
+      case 'C': code = 1; break;
+      case 'G': code = 2; break;
+      case 'T': code = 3; break;
+      default: code = -1;
+    }
+    if (code < 0) {
+      valid = 0;
+      kmer = 0;
+    } else {
+      valid++;
+      kmer = ((kmer << 2) | code) & kmer_mask;
+    }
+    if (i + 1 < (uint64_t)k) continue;
+    const uint64_t start = i + 1 - k;
+    window[start % w] = (valid >= k) ? hash_kmer(kmer) : UINT64_MAX;
+    if (start + 1 < (uint64_t)w && start + 1 < num_kmers) continue;
+    const uint64_t first = (start + 1 < (uint64_t)w) ? 0 : start + 1 - w;
+    uint64_t min_start = first;
+    for (uint64_t j = first + 1; j <= start; j++)
+      if (window[j % w] < window[min_start % w]) min_start = j;
+    const uint64_t min_hash = window[min_start % w];
+    if (min_hash != UINT64_MAX &&
+        (out.empty() || out.back().second != min_start))
+      out.push_back({min_hash, min_start});
+  }
+}
+
+// mismatching bases of a and b, stopping early once above limit. The inner
+// loop has no branch so that it is vectorized.
+static int count_mismatches(const char *a, const char *b, const uint64_t len,
+                            const int limit) {
+  int mismatches = 0;
+  for (uint64_t i = 0; i < len && mismatches <= limit; i += 64) {
+    const uint64_t end = std::min(len, i + 64);
+    for (uint64_t j = i; j < end; j++) mismatches += (a[j] != b[j]);
+  }
+  return mismatches;
+}
+
+void consensus_index::build(const int num_thr) {
+  // minimizers of the contigs in chunks of consecutive contigs, so that
+  // the entries of each bucket end up in order of position
+  const uint64_t num_contigs = contig_end.size();
+  const uint64_t num_chunks =
+      std::max<uint64_t>(1, std::min<uint64_t>(num_contigs, 64 * num_thr));
+  std::vector<std::vector<std::pair<uint64_t, uint64_t>>> chunk_entries(
+      num_chunks);
+#pragma omp parallel num_threads(num_thr)
   {
-    int tid = omp_get_thread_num();
-    // seq
-    std::ifstream in_seq(eg.outfile_seq + '.' + std::to_string(tid));
-    std::ofstream f_seq(eg.outfile_seq + '.' + std::to_string(tid) + ".tmp",
-                        std::ios::binary);
-    std::ofstream f_seq_tail(eg.outfile_seq + '.' + std::to_string(tid) +
-                             ".tail");
-    uint64_t file_len = 0;
-    char c;
-    while (in_seq >> std::noskipws >> c) file_len++;
-    file_len_seq_thr[tid] = file_len;
-    uint8_t basetoint[128];
-    basetoint[(uint8_t)'A'] = 0;
-    basetoint[(uint8_t)'C'] = 1;
-    basetoint[(uint8_t)'G'] = 2;
-    basetoint[(uint8_t)'T'] = 3;
+    std::vector<std::pair<uint64_t, uint64_t>> minimizers;
+#pragma omp for schedule(dynamic)
+    for (int64_t chunk = 0; chunk < (int64_t)num_chunks; chunk++) {
+      for (uint64_t c = num_contigs * chunk / num_chunks;
+           c < num_contigs * (chunk + 1) / num_chunks; c++) {
+        uint64_t start = (c == 0) ? 0 : contig_end[c - 1];
+        find_minimizers(&seq[start], contig_end[c] - start, minimizers);
+        for (auto &m : minimizers)
+          chunk_entries[chunk].push_back({m.first, start + m.second});
+      }
+    }
+  }
+  uint64_t num_entries = 0;
+  for (auto &entries : chunk_entries) num_entries += entries.size();
+  uint64_t num_buckets = 1;
+  while (num_buckets < num_entries) num_buckets *= 2;
+  // counting sort of the entries by bucket
+  bucket_start.assign(num_buckets + 1, 0);
+  for (auto &entries : chunk_entries)
+    for (auto &e : entries) bucket_start[(e.first & (num_buckets - 1)) + 1]++;
+  for (uint64_t b = 0; b < num_buckets; b++)
+    bucket_start[b + 1] += bucket_start[b];
+  entry_pos.resize(num_entries);
+  std::vector<uint64_t> fill_pos(bucket_start.begin(), bucket_start.end() - 1);
+  for (auto &entries : chunk_entries) {
+    for (auto &e : entries)
+      entry_pos[fill_pos[e.first & (num_buckets - 1)]++] = e.second;
+    std::vector<std::pair<uint64_t, uint64_t>>().swap(entries);
+  }
+}
 
-    in_seq.close();
-    in_seq.open(eg.outfile_seq + '.' + std::to_string(tid));
-    char dnabase[8];
-    uint8_t dnabin;
-    for (uint64_t i = 0; i < file_len / 4; i++) {
-      in_seq.read(dnabase, 4);
-
-      dnabin = 64 * basetoint[(uint8_t)dnabase[3]] +
-               16 * basetoint[(uint8_t)dnabase[2]] +
-               4 * basetoint[(uint8_t)dnabase[1]] +
-               basetoint[(uint8_t)dnabase[0]];
-      f_seq.write((char *)&dnabin, sizeof(uint8_t));
+bool consensus_index::place(const std::string &read, uint64_t &pos, bool &rev,
+                            scratch &buf) const {
+  const uint64_t len = read.size();
+  if (len < (uint64_t)K_SINGLETON_INDEX || entry_pos.empty()) return false;
+  const uint64_t num_buckets = bucket_start.size() - 1;
+  buf.read_rc = reverse_complement(read, len);
+  int best = THRESH_SINGLETON_INDEX + 1;
+  for (int r = 0; r < 2 && best > 0; r++) {
+    const char *s = r ? buf.read_rc.data() : read.data();
+    find_minimizers(s, len, buf.minimizers);
+    // starts in seq where a minimizer of s occurs, with s within a contig
+    buf.candidates.clear();
+    for (auto &m : buf.minimizers) {
+      uint64_t b = m.first & (num_buckets - 1);
+      for (uint64_t e = bucket_start[b];
+           e < bucket_start[b + 1] &&
+           e < bucket_start[b] + MAX_HITS_SINGLETON_INDEX;
+           e++) {
+        uint64_t p = entry_pos[e];
+        if (p < m.second ||
+            seq.compare(p, K_SINGLETON_INDEX, s + m.second,
+                        K_SINGLETON_INDEX) != 0)
+          continue;
+        uint64_t start = p - m.second;
+        uint64_t c =
+            std::upper_bound(contig_end.begin(), contig_end.end(), p) -
+            contig_end.begin();
+        if ((c > 0 && start < contig_end[c - 1]) || start + len > contig_end[c])
+          continue;
+        buf.candidates.push_back(start);
+      }
     }
-    f_seq.close();
-    in_seq.read(dnabase, file_len % 4);
-    for (unsigned int i = 0; i < file_len % 4; i++) f_seq_tail << dnabase[i];
-    f_seq_tail.close();
-    in_seq.close();
+    std::sort(buf.candidates.begin(), buf.candidates.end());
+    buf.candidates.erase(
+        std::unique(buf.candidates.begin(), buf.candidates.end()),
+        buf.candidates.end());
+    for (uint64_t start : buf.candidates) {
+      int mismatches = count_mismatches(s, &seq[start], len, best - 1);
+      if (mismatches < best) {
+        best = mismatches;
+        pos = start;
+        rev = r;
+        if (best == 0) break;
+      }
+    }
+  }
+  return best <= THRESH_SINGLETON_INDEX;
+}
 
-    // Compress using zpaq and remove uncompressed files if deep is false
-    if(deep){
-      // Define the command to run the Python script
-      std::string infile_deep = eg.outfile_seq + '.' + std::to_string(tid) + ".tmp";
-      // std::string infile_deep = eg.outfile_seq + '.' + std::to_string(tid);
-      std::string python_cmd = "python3 -u ../Trace/compressor.py --input_dir " + infile_deep + " --batch_size 512 --gpu_id " + std::to_string(gpu_id) + " --hidden_dim 256 --ffn_dim 4096 --seq_len 8 --learning_rate 1e-3 --vocab_dim 64" ;
-      // Execute the command
-      system(python_cmd.c_str());
+void pack_compress_seq(const encoder_global &eg, uint64_t *file_len_seq_thr,
+                       const encoder_params &ep, bool deep) {
+  if (deep || ep.seq_cm) {
+    // the deep model and the nucleotide CM codec take the bases as they are,
+    // in chunks coded on all threads
+    std::vector<std::string> infiles, outfiles;
+    for (int tid = 0; tid < eg.num_parts; tid++) {
+      infiles.push_back(eg.outfile_seq + '.' + std::to_string(tid));
+      outfiles.push_back(infiles.back() + (deep ? ".deep" : ".cm"));
     }
-    else {
-      std::string infile_zpaq = eg.outfile_seq + '.' + std::to_string(tid) + ".tmp";
-      std::string outfile_zpaq = eg.outfile_seq + '.' + std::to_string(tid) + ".zpaq";
-      std::string compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-      system(compress_cmd.c_str());
+    std::vector<uint64_t> file_len =
+        deep ? deep_compress_bases(infiles, outfiles, eg.num_thr,
+                                   ep.deep_save_weights)
+             : cm_compress_bases(infiles, outfiles, eg.num_thr);
+    for (int tid = 0; tid < eg.num_parts; tid++) {
+      file_len_seq_thr[tid] = file_len[tid];
+      remove(infiles[tid].c_str());
     }
+    return;
+  }
+#pragma omp parallel for schedule(dynamic)
+  for (int tid = 0; tid < eg.num_parts; tid++) {
+    // seq: packed in a single pass, a block at a time. The packed file ends
+    // with the number of bases in its last byte (0 if that byte is full), so
+    // that no separate tail file is needed.
+    buffered_ifstream in_seq(eg.outfile_seq + '.' + std::to_string(tid));
+    buffered_ofstream f_seq(eg.outfile_seq + '.' + std::to_string(tid) + ".tmp",
+                            std::ios::binary);
+    std::vector<char> dnabase(PACK_BLOCK_SIZE);
+    std::vector<uint8_t> dnabin(PACK_BLOCK_SIZE / 4);
+    uint64_t file_len = 0;
+    uint64_t block_len;
+    do {
+      in_seq.read(dnabase.data(), PACK_BLOCK_SIZE);
+      block_len = in_seq.gcount();
+      pack_bases(dnabase.data(), block_len, dnabin.data());
+      f_seq.write((char *)dnabin.data(), (block_len + 3) / 4);
+      file_len += block_len;
+    } while (block_len == PACK_BLOCK_SIZE);
+    uint8_t tail_len = file_len % 4;
+    f_seq.write((char *)&tail_len, sizeof(uint8_t));
+    f_seq.close();
+    in_seq.close();
+    file_len_seq_thr[tid] = file_len;
+
+    // Compress using zpaq
+    std::string infile_zpaq = eg.outfile_seq + '.' + std::to_string(tid) + ".tmp";
+    std::string outfile_zpaq = eg.outfile_seq + '.' + std::to_string(tid) + ".zpaq";
+    zpaq_compress(infile_zpaq, outfile_zpaq);
         // Remove the uncompressed and temporary files
     remove((eg.outfile_seq + '.' + std::to_string(tid)).c_str());
     remove((eg.outfile_seq + '.' + std::to_string(tid) + ".tmp").c_str());
@@ -178,7 +405,7 @@ void getDataParams(encoder_global &eg, const compression_params &cp) {
   numreads_clean = cp.num_reads_clean[0] + cp.num_reads_clean[1];
   numreads_total = cp.num_reads;
 
-  std::ifstream myfile_s_count(eg.infile + ".singleton"+".count", std::ifstream::in);
+  buffered_ifstream myfile_s_count(eg.infile + ".singleton"+".count", std::ifstream::in);
   myfile_s_count.read((char*)&eg.numreads_s, sizeof(uint32_t));
   myfile_s_count.close();
   std::string file_s_count = eg.infile + ".singleton"+".count";
@@ -193,49 +420,32 @@ void getDataParams(encoder_global &eg, const compression_params &cp) {
 }
 
 void correct_order(uint32_t *order_s, const encoder_global &eg) {
+  // the reads were numbered among the clean reads, clean_to_all maps these
+  // numbers to the ones among all reads (skipping the reads with N)
   uint32_t numreads_total = eg.numreads + eg.numreads_s + eg.numreads_N;
-  bool *read_flag_N = new bool[numreads_total]();
-  // bool array indicating N reads
-  for (uint32_t i = 0; i < eg.numreads_N; i++) {
-    read_flag_N[order_s[eg.numreads_s + i]] = true;
-  }
-
-  uint32_t *cumulative_N_reads = new uint32_t[eg.numreads + eg.numreads_s];
-  // number of reads occuring before pos in clean reads
-  uint32_t pos_in_clean = 0, num_N_reads_till_now = 0;
-  for (uint32_t i = 0; i < numreads_total; i++) {
-    if (read_flag_N[i] == true)
-      num_N_reads_till_now++;
-    else
-      cumulative_N_reads[pos_in_clean++] = num_N_reads_till_now;
-  }
+  uint32_t numreads_clean = eg.numreads + eg.numreads_s;
+  uint32_t *clean_to_all = alloc_array<uint32_t>(numreads_clean);
+  remaining_indices(order_s + eg.numreads_s, eg.numreads_N, numreads_total,
+                    clean_to_all, eg.num_thr);
 
   // First correct the order for singletons
-  for (uint32_t i = 0; i < eg.numreads_s; i++)
-    order_s[i] += cumulative_N_reads[order_s[i]];
+  remap(order_s, eg.numreads_s, clean_to_all, eg.num_thr);
 
   // Now correct for clean reads (this is stored on file)
-  for (int tid = 0; tid < eg.num_thr; tid++) {
-    std::ifstream fin_order(eg.infile_order + '.' + std::to_string(tid),
-                            std::ios::binary);
-    std::ofstream fout_order(
-        eg.infile_order + '.' + std::to_string(tid) + ".tmp", std::ios::binary);
-    uint32_t pos;
-    fin_order.read((char *)&pos, sizeof(uint32_t));
-    while (!fin_order.eof()) {
-      pos += cumulative_N_reads[pos];
-      fout_order.write((char *)&pos, sizeof(uint32_t));
-      fin_order.read((char *)&pos, sizeof(uint32_t));
-    }
-    fin_order.close();
-    fout_order.close();
-    remove((eg.infile_order + '.' + std::to_string(tid)).c_str());
-    rename((eg.infile_order + '.' + std::to_string(tid) + ".tmp").c_str(),
-           (eg.infile_order + '.' + std::to_string(tid)).c_str());
+  for (int tid = 0; tid < eg.num_parts; tid++) {
+    std::string file_order = eg.infile_order + '.' + std::to_string(tid);
+    uint64_t num_order =
+        std::filesystem::file_size(file_order) / sizeof(uint32_t);
+    uint32_t *order = alloc_array<uint32_t>(num_order);
+    read_uint32_file(file_order, order, num_order);
+    remap(order, num_order, clean_to_all, eg.num_thr);
+    write_uint32_file(file_order + ".tmp", order, num_order);
+    free_array(order, num_order);
+    remove(file_order.c_str());
+    rename((file_order + ".tmp").c_str(), file_order.c_str());
   }
   remove(eg.infile_order_N.c_str());
-  delete[] read_flag_N;
-  delete[] cumulative_N_reads;
+  free_array(clean_to_all, numreads_clean);
   return;
 }
 
@@ -29,7 +29,10 @@ This code is a modified version of SPRING, originally developed by the Universit
 #include <iostream>
 #include <list>
 #include <string>
+#include <vector>
 #include "bitset_util.h"
+#include "buffered_io.h"
+#include "memory_util.h"
 #include "params.h"
 #include "util.h"
 
@@ -37,17 +40,17 @@ namespace spring {
 
 template <size_t bitset_size>
 struct encoder_global_b {
-  std::bitset<bitset_size> **basemask;
+  read_bits<bitset_size> **basemask;
   int max_readlen;
   // bitset for A,G,C,T,N at each position
   // used in stringtobitset, and bitsettostring
-  std::bitset<bitset_size> mask63;  // bitset with 63 bits set to 1 (used in
-                                    // bitsettostring for conversion to ullong)
+  read_bits<bitset_size> mask63;  // bitset with 63 bits set to 1 (used in
+                                  // bitsettostring for conversion to ullong)
   encoder_global_b(int max_readlen_param) {
     max_readlen = max_readlen_param;
-    basemask = new std::bitset<bitset_size> *[max_readlen_param];
+    basemask = new read_bits<bitset_size> *[max_readlen_param];
     for (int i = 0; i < max_readlen_param; i++)
-      basemask[i] = new std::bitset<bitset_size>[128];
+      basemask[i] = new read_bits<bitset_size>[128];
   }
   ~encoder_global_b() {
     for (int i = 0; i < max_readlen; i++) delete[] basemask[i];
@@ -55,11 +58,48 @@ struct encoder_global_b {
   }
 };
 
+// reads with a few N that went through reorder with the N substituted (see
+// preprocess), with the positions of their N
+struct substituted_N {
+  std::vector<bool> has_N;      // per read number
+  std::vector<uint32_t> reads;  // read numbers of the reads, increasing
+  std::vector<uint64_t> start;  // offset of the N positions of each read
+  std::vector<uint16_t> pos;
+
+  void load(const std::string &file, const uint32_t num_reads);
+  // put the N back in read (of length rl, reverse complemented if rc is 'r')
+  // if read number ord had any
+  void restore(std::string &read, const uint32_t ord, const char rc,
+               const uint16_t rl) const {
+    if (!has_N[ord]) return;
+    uint64_t k = std::lower_bound(reads.begin(), reads.end(), ord) -
+                 reads.begin();
+    for (uint64_t i = start[k]; i < start[k + 1]; i++)
+      read[rc == 'r' ? rl - 1 - pos[i] : pos[i]] = 'N';
+  }
+};
+
 struct encoder_global {
   uint32_t numreads, numreads_s, numreads_N;
   int numdict_s = NUM_DICT_ENCODER;
 
   int max_readlen, num_thr;
+  // max_readlen if all reads have that length (no read lengths are read or
+  // written then), 0 otherwise
+  uint16_t fixed_readlen;
+  // number of parts written by reorder, each encoded into its own
+  // read_seq.bin.<part> (stored as cp.num_thr in the archive). Without
+  // --deterministic the parts are encoded concurrently (one per thread) and
+  // place singletons from all of them with shared dictionaries. With it
+  // (independent_parts), the contigs of part p only place the singletons
+  // part_begin_s(p), ..., part_begin_s(p + 1) - 1, with dictionaries of
+  // their own, so that the parts can run on any number of threads with the
+  // same output.
+  int num_parts;
+  bool independent_parts = false;
+  uint32_t part_begin_s(const int part) const {
+    return (uint64_t)(numreads_s + numreads_N) * part / num_parts;
+  }
 
   std::string basedir;
   std::string infile;
@@ -69,6 +109,7 @@ struct encoder_global {
   std::string infile_RC;
   std::string infile_readlength;
   std::string infile_N;
+  std::string infile_N_pos;
   std::string outfile_unaligned;
   std::string outfile_seq;
   std::string outfile_pos;
@@ -78,34 +119,77 @@ struct encoder_global {
   std::string infile_order_N;
 
   char enc_noise[128][128];
+  substituted_N subst_N;
+};
+
+// reads of the contig being encoded, kept in flat arrays that each thread
+// reuses from one contig to the next (no allocation per read)
+struct contig_arena {
+  std::string bases;             // bases of all reads back to back
+  std::vector<uint64_t> start;   // offset of each read in bases
+  std::vector<int64_t> pos;      // position of each read in the contig
+  std::vector<char> RC;
+  std::vector<uint32_t> order;
+  std::vector<uint16_t> read_length;
+  std::vector<uint32_t> sorted;  // read indices by pos (see sort_by_pos())
+  // scratch space for sort_by_pos() and buildcontig()
+  std::vector<uint64_t> keys, keys_tmp;
+  std::vector<uint32_t> sorted_tmp;
+  std::vector<uint32_t> count;
+
+  uint32_t size() const { return pos.size(); }
+  void clear();
+  void push_back(const std::string &read, const int64_t read_pos,
+                 const char rc, const uint32_t read_order,
+                 const uint16_t rl);
+  // stable sort of the reads by pos into sorted
+  void sort_by_pos();
 };
 
-struct contig_reads {
-  std::string read;
-  int64_t pos;
-  char RC;
-  uint32_t order;
-  uint16_t read_length;
+// minimizer index over the consensus of all contigs, used to place the
+// singleton reads with --singleton-index
+struct consensus_index {
+  std::string seq;                     // consensus of all contigs back to back
+  std::vector<uint64_t> contig_end;    // end of each contig in seq
+  std::vector<uint64_t> bucket_start;  // entries of each hash bucket
+  std::vector<uint64_t> entry_pos;     // minimizer positions in seq
+
+  // per thread buffers of place()
+  struct scratch {
+    std::string read_rc;
+    std::vector<std::pair<uint64_t, uint64_t>> minimizers;
+    std::vector<uint64_t> candidates;
+  };
+
+  // index the minimizers of each contig of seq
+  void build(const int num_thr);
+  // place read (or its reverse complement if rev) within a contig with the
+  // fewest mismatching bases, at most THRESH_SINGLETON_INDEX. pos is the start
+  // in seq. Returns false if there is no such place.
+  bool place(const std::string &read, uint64_t &pos, bool &rev,
+             scratch &buf) const;
 };
 
-std::string buildcontig(std::list<contig_reads> &current_contig,
-                        const uint32_t &list_size);
+// consensus of the reads of the contig (positions start at 0)
+std::string buildcontig(contig_arena &contig);
 
+// write the reads of the contig in the order of sorted
 void writecontig(const std::string &ref,
-                 std::list<contig_reads> &current_contig, std::ofstream &f_seq,
-                 std::ofstream &f_pos, std::ofstream &f_noise,
-                 std::ofstream &f_noisepos, std::ofstream &f_order,
-                 std::ofstream &f_RC, std::ofstream &f_readlength,
+                 const contig_arena &contig, std::ostream &f_seq,
+                 std::ostream &f_pos, std::ostream &f_noise,
+                 std::ostream &f_noisepos, std::ostream &f_order,
+                 std::ostream &f_RC, std::ostream &f_readlength,
                  const encoder_global &eg, uint64_t &abs_pos);
 
-void pack_compress_seq(const encoder_global &eg, uint64_t *file_len_seq_thr, bool deep, int gpu_id);
+void pack_compress_seq(const encoder_global &eg, uint64_t *file_len_seq_thr,
+                       const encoder_params &ep, bool deep);
 
 void getDataParams(encoder_global &eg, const compression_params &cp);
 
 void correct_order(uint32_t *order_s, const encoder_global &eg);
 
 template <size_t bitset_size>
-std::string bitsettostring(std::bitset<bitset_size> b, const uint16_t readlen,
+std::string bitsettostring(read_bits<bitset_size> b, const uint16_t readlen,
                            const encoder_global_b<bitset_size> &egb) {
   // destroys bitset b
   static const char revinttochar[8] = {'A', 'N', 'G', 0, 'C', 0, 'T', 0};
@@ -123,66 +207,97 @@ std::string bitsettostring(std::bitset<bitset_size> b, const uint16_t readlen,
   return s;
 }
 
+// read part tid of the reordered reads and call process_contig(contig) for
+// each of its contigs, with the reads sorted by pos and the first pos 0
+template <typename F>
+void for_each_contig(const encoder_global &eg, const int tid,
+                     contig_arena &contig, F process_contig) {
+  buffered_ifstream f(eg.infile + '.' + std::to_string(tid), std::ios::binary);
+  temp_ifstream in_flag(eg.infile_flag + '.' + std::to_string(tid));
+  temp_ifstream in_pos(eg.infile_pos + '.' + std::to_string(tid));
+  buffered_ifstream in_order(eg.infile_order + '.' + std::to_string(tid),
+                             std::ios::binary);
+  temp_ifstream in_RC(eg.infile_RC + '.' + std::to_string(tid));
+  temp_ifstream in_readlength(eg.infile_readlength + '.' +
+                              std::to_string(tid));
+
+  std::string current;
+  char c = '0', rc = 'd';
+  int64_t p;
+  uint16_t rl;
+  uint32_t ord;
+  uint64_t num_reads_thr = 0;
+  bool done = false;
+  contig.clear();
+  while (!done) {
+    if (!(in_flag >> c)) done = true;
+    if (!done) {
+      read_dna_from_bits(current, f, eg.fixed_readlen);
+      rc = in_RC.get();
+      in_pos.read((char *)&p, sizeof(int64_t));
+      in_order.read((char *)&ord, sizeof(uint32_t));
+      if (eg.fixed_readlen)
+        rl = eg.fixed_readlen;
+      else
+        in_readlength.read((char *)&rl, sizeof(uint16_t));
+      eg.subst_N.restore(current, ord, rc, rl);
+      if (tid == 0 && ++num_reads_thr % 1000000 == 0) trim_mapped_pages();
+    }
+    if (c == '0' || done || contig.size() > 10000000) {
+      if (contig.size() != 0) {
+        contig.sort_by_pos();
+        int64_t first_pos = contig.pos[contig.sorted[0]];
+        for (int64_t &read_pos : contig.pos) read_pos -= first_pos;
+        process_contig(contig);
+      }
+      if (!done) {
+        contig.clear();
+        contig.push_back(current, p, rc, ord, rl);
+      }
+    } else if (c == '1') {
+      contig.push_back(current, p, rc, ord, rl);
+    }
+  }
+}
+
+// encode the contigs of each part, placing the remaining singleton reads (and
+// reads with N) in a contig by looking up the dictionaries at every position
+// of its consensus
 template <size_t bitset_size>
-void encode(std::bitset<bitset_size> *read, bbhashdict *dict, uint32_t *order_s,
-            uint16_t *read_lengths_s, const encoder_global &eg,
-            const encoder_global_b<bitset_size> &egb, bool deep, int gpu_id) {
+void encode_with_dict(read_bits_array<bitset_size> read, bbhashdict *dicts,
+                      uint32_t *order_s, uint16_t *read_lengths_s,
+                      bool *remainingreads, const encoder_global &eg,
+                      const encoder_global_b<bitset_size> &egb) {
+  // dicts holds one set of eg.numdict_s dictionaries, or one set per part for
+  // independent parts (which need no locks)
   static const int thresh_s = THRESH_ENCODER;
   static const int maxsearch = MAX_SEARCH_ENCODER;
-  omp_lock_t *read_lock = new omp_lock_t[eg.numreads_s + eg.numreads_N];
-  omp_lock_t *dict_lock = new omp_lock_t[eg.numreads_s + eg.numreads_N];
-  for (uint64_t j = 0; j < eg.numreads_s + eg.numreads_N; j++) {
-    omp_init_lock(&read_lock[j]);
-    omp_init_lock(&dict_lock[j]);
-  }
-  bool *remainingreads = new bool[eg.numreads_s + eg.numreads_N];
-  std::fill(remainingreads, remainingreads + eg.numreads_s + eg.numreads_N, 1);
-
-  std::bitset<bitset_size> *mask1 = new std::bitset<bitset_size>[eg.numdict_s];
-  generateindexmasks<bitset_size>(mask1, dict, eg.numdict_s, 3);
-  std::bitset<bitset_size> **mask =
-      new std::bitset<bitset_size> *[eg.max_readlen];
-  for (int i = 0; i < eg.max_readlen; i++)
-    mask[i] = new std::bitset<bitset_size>[eg.max_readlen];
+  const bool shared = !eg.independent_parts;
+  omp_lock_t *read_lock =
+      shared ? alloc_lock_array(eg.numreads_s + eg.numreads_N) : NULL;
+  // one lock per bin (the pilot backend can have more bins than reads)
+  uint64_t num_dict_locks = eg.numreads_s + eg.numreads_N;
+  for (int l = 0; l < eg.numdict_s; l++)
+    num_dict_locks = std::max<uint64_t>(num_dict_locks, dicts[l].numkeys);
+  omp_lock_t *dict_lock = shared ? alloc_lock_array(num_dict_locks) : NULL;
+
+  read_bits<bitset_size> *mask1 = new read_bits<bitset_size>[eg.numdict_s];
+  generateindexmasks<bitset_size>(mask1, dicts, eg.numdict_s, 3);
+  read_bits<bitset_size> *mask = new read_bits<bitset_size>[eg.max_readlen];
   generatemasks<bitset_size>(mask, eg.max_readlen, 3);
-  std::cout << "Encoding reads\n";
-#pragma omp parallel
-  {
-    int tid = omp_get_thread_num();
-    std::ifstream f(eg.infile + '.' + std::to_string(tid),std::ios::binary);
-
-    std::ifstream fin_flag(eg.infile_flag + '.' + std::to_string(tid));
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf_flag;
-    inbuf_flag.push(boost::iostreams::gzip_decompressor());
-    inbuf_flag.push(fin_flag);
-    std::istream in_flag(&inbuf_flag);
-    std::ifstream fin_pos(eg.infile_pos + '.' + std::to_string(tid),
-                         std::ios::binary);
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf_pos;
-    inbuf_pos.push(boost::iostreams::gzip_decompressor());
-    inbuf_pos.push(fin_pos);
-    std::istream in_pos(&inbuf_pos);
-    std::ifstream in_order(eg.infile_order + '.' + std::to_string(tid),
-                           std::ios::binary);
-    std::ifstream fin_RC(eg.infile_RC + '.' + std::to_string(tid));
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf_RC;
-    inbuf_RC.push(boost::iostreams::gzip_decompressor());
-    inbuf_RC.push(fin_RC);
-    std::istream in_RC(&inbuf_RC);
-    std::ifstream fin_readlength(
-        eg.infile_readlength + '.' + std::to_string(tid), std::ios::binary);
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbuf_readlength;
-    inbuf_readlength.push(boost::iostreams::gzip_decompressor());
-    inbuf_readlength.push(fin_readlength);
-    std::istream in_readlength(&inbuf_readlength);
-    std::ofstream f_seq(eg.outfile_seq + '.' + std::to_string(tid));
-    std::ofstream f_pos(eg.outfile_pos + '.' + std::to_string(tid), std::ios::binary);
-    std::ofstream f_noise(eg.outfile_noise + '.' + std::to_string(tid));
-    std::ofstream f_noisepos(eg.outfile_noisepos + '.' + std::to_string(tid), std::ios::binary);
-    std::ofstream f_order(eg.infile_order + '.' + std::to_string(tid) + ".tmp",
-                          std::ios::binary);
-    std::ofstream f_RC(eg.infile_RC + '.' + std::to_string(tid) + ".tmp");
-    std::ofstream f_readlength(
+  // with shared dictionaries, the num_thr parts run concurrently (one per
+  // thread)
+#pragma omp parallel for schedule(static, 1)
+  for (int tid = 0; tid < eg.num_parts; tid++) {
+    bbhashdict *dict = dicts + (shared ? 0 : tid * eg.numdict_s);
+    buffered_ofstream f_seq(eg.outfile_seq + '.' + std::to_string(tid));
+    buffered_ofstream f_pos(eg.outfile_pos + '.' + std::to_string(tid), std::ios::binary);
+    buffered_ofstream f_noise(eg.outfile_noise + '.' + std::to_string(tid));
+    buffered_ofstream f_noisepos(eg.outfile_noisepos + '.' + std::to_string(tid), std::ios::binary);
+    buffered_ofstream f_order(eg.infile_order + '.' + std::to_string(tid) + ".tmp",
+                              std::ios::binary);
+    buffered_ofstream f_RC(eg.infile_RC + '.' + std::to_string(tid) + ".tmp");
+    buffered_ofstream f_readlength(
         eg.infile_readlength + '.' + std::to_string(tid) + ".tmp",
         std::ios::binary);
 
@@ -194,187 +309,139 @@ void encode(std::bitset<bitset_size> *read, bbhashdict *dict, uint32_t *order_s,
     // of all contigs till now)
     bool flag = 0;
     // flag to check if match was found or not
-    std::string current, ref;
-    std::bitset<bitset_size> forward_bitset, reverse_bitset, b;
-    char c = '0', rc = 'd';
-    std::list<contig_reads> current_contig;
-    int64_t p;
-    uint16_t rl;
-    uint32_t ord, list_size = 0;  // list_size variable introduced because
-                                  // list::size() was running very slowly
-                                  // on UIUC machine
+    std::string ref;
+    read_bits<bitset_size> forward_bitset, reverse_bitset, b;
+    contig_arena contig;
     std::list<uint32_t> *deleted_rids = new std::list<uint32_t>[eg.numdict_s];
-    bool done = false;
-    while (!done) {
-      if (!(in_flag >> c)) done = true;
-      if (!done) {
-	read_dna_from_bits(current,f);
-        rc = in_RC.get();
-	in_pos.read((char*)&p, sizeof(int64_t));
-        in_order.read((char *)&ord, sizeof(uint32_t));
-        in_readlength.read((char *)&rl, sizeof(uint16_t));
-      }
-      if (c == '0' || done || list_size > 10000000)  // limit on list size so
-                                                     // that memory doesn't get
-                                                     // too large
-      {
-        if (list_size != 0) {
-          // sort contig according to pos
-          current_contig.sort([](const contig_reads &a, const contig_reads &b) {
-            return a.pos < b.pos;
-          });
-          // make first pos zero and shift all pos values accordingly
-          auto current_contig_it = current_contig.begin();
-          int64_t first_pos = (*current_contig_it).pos;
-          for (; current_contig_it != current_contig.end(); ++current_contig_it)
-            (*current_contig_it).pos -= first_pos;
-
-          ref = buildcontig(current_contig, list_size);
-          if ((int64_t)ref.size() >= eg.max_readlen &&
-              (eg.numreads_s + eg.numreads_N > 0)) {
-            // try to align the singleton reads to ref
-            // first create bitsets from first readlen positions of ref
-            forward_bitset.reset();
-            reverse_bitset.reset();
-            stringtobitset(ref.substr(0, eg.max_readlen), eg.max_readlen,
-                           forward_bitset, egb.basemask);
-            stringtobitset(reverse_complement(ref.substr(0, eg.max_readlen),
-                                              eg.max_readlen),
-                           eg.max_readlen, reverse_bitset, egb.basemask);
-            for (long j = 0; j < (int64_t)ref.size() - eg.max_readlen + 1;
-                 j++) {
-              // search for singleton reads
-              for (int rev = 0; rev < 2; rev++) {
-                for (int l = 0; l < eg.numdict_s; l++) {
+    for_each_contig(eg, tid, contig, [&](contig_arena &contig) {
+      ref = buildcontig(contig);
+      if ((int64_t)ref.size() >= eg.max_readlen &&
+          (eg.numreads_s + eg.numreads_N > 0)) {
+        // try to align the singleton reads to ref
+        // first create bitsets from first readlen positions of ref
+        forward_bitset.reset();
+        reverse_bitset.reset();
+        stringtobitset<bitset_size>(ref.substr(0, eg.max_readlen),
+                                    eg.max_readlen, forward_bitset,
+                                    egb.basemask);
+        stringtobitset<bitset_size>(
+            reverse_complement(ref.substr(0, eg.max_readlen),
+                               eg.max_readlen),
+            eg.max_readlen, reverse_bitset, egb.basemask);
+        for (long j = 0; j < (int64_t)ref.size() - eg.max_readlen + 1;
+             j++) {
+          // search for singleton reads
+          for (int rev = 0; rev < 2; rev++) {
+            for (int l = 0; l < eg.numdict_s; l++) {
+              if (!rev)
+                b = forward_bitset & mask1[l];
+              else
+                b = reverse_bitset & mask1[l];
+              ull = (b >> 3 * dict[l].start).to_ullong();
+              startposidx = dict[l].lookup(ull);
+              if (startposidx >= dict[l].numkeys)  // not found
+                continue;
+              // check if any other thread is modifying same dictpos
+              if (!test_lock(dict_lock, startposidx)) continue;
+              dict[l].findpos(dictidx, startposidx);
+              if (dict[l].empty_bin[startposidx])  // bin is empty
+              {
+                unset_lock(dict_lock, startposidx);
+                continue;
+              }
+              uint64_t ull1 =
+                  ((read[dict[l].read_id[dictidx[0]]] & mask1[l]) >>
+                   3 * dict[l].start)
+                      .to_ullong();
+              if (ull ==
+                  ull1)  // checking if ull is actually the key for this bin
+              {
+                for (int64_t i = dictidx[1] - 1;
+                     i >= dictidx[0] && i >= dictidx[1] - maxsearch; i--) {
+                  auto rid = dict[l].read_id[i];
+                  int hamming;
                   if (!rev)
-                    b = forward_bitset & mask1[l];
+                    hamming =
+                        ((forward_bitset ^ read[rid]) &
+                         mask[eg.max_readlen - read_lengths_s[rid]])
+                            .count();
                   else
-                    b = reverse_bitset & mask1[l];
-                  ull = (b >> 3 * dict[l].start).to_ullong();
-                  startposidx = dict[l].bphf->lookup(ull);
-                  if (startposidx >= dict[l].numkeys)  // not found
-                    continue;
-                  // check if any other thread is modifying same dictpos
-                  if (!omp_test_lock(&dict_lock[startposidx])) continue;
-                  dict[l].findpos(dictidx, startposidx);
-                  if (dict[l].empty_bin[startposidx])  // bin is empty
-                  {
-                    omp_unset_lock(&dict_lock[startposidx]);
-                    continue;
+                    hamming =
+                        ((reverse_bitset ^ read[rid]) &
+                         mask[eg.max_readlen - read_lengths_s[rid]])
+                            .count();
+                  if (hamming <= thresh_s) {
+                    if(!test_lock(read_lock, rid)) continue;
+                    if (remainingreads[rid]) {
+                      remainingreads[rid] = 0;
+                      flag = 1;
+                    }
+                    unset_lock(read_lock, rid);
                   }
-                  uint64_t ull1 =
-                      ((read[dict[l].read_id[dictidx[0]]] & mask1[l]) >>
-                       3 * dict[l].start)
-                          .to_ullong();
-                  if (ull ==
-                      ull1)  // checking if ull is actually the key for this bin
+                  if (flag == 1)  // match found
                   {
-                    for (int64_t i = dictidx[1] - 1;
-                         i >= dictidx[0] && i >= dictidx[1] - maxsearch; i--) {
-                      auto rid = dict[l].read_id[i];
-                      int hamming;
-                      if (!rev)
-                        hamming =
-                            ((forward_bitset ^ read[rid]) &
-                             mask[0][eg.max_readlen - read_lengths_s[rid]])
-                                .count();
-                      else
-                        hamming =
-                            ((reverse_bitset ^ read[rid]) &
-                             mask[0][eg.max_readlen - read_lengths_s[rid]])
-                                .count();
-                      if (hamming <= thresh_s) {
-                        if(!omp_test_lock(&read_lock[rid])) continue;
-                        if (remainingreads[rid]) {
-                          remainingreads[rid] = 0;
-                          flag = 1;
-                        }
-                        omp_unset_lock(&read_lock[rid]);
-                      }
-                      if (flag == 1)  // match found
-                      {
-                        flag = 0;
-                        list_size++;
-                        char rc = rev ? 'r' : 'd';
-                        long pos =
-                            rev ? (j + eg.max_readlen - read_lengths_s[rid])
-                                : j;
-                        std::string read_string =
-                            rev ? reverse_complement(
-                                      bitsettostring<bitset_size>(
-                                          read[rid], read_lengths_s[rid], egb),
-                                      read_lengths_s[rid])
-                                : bitsettostring<bitset_size>(
-                                      read[rid], read_lengths_s[rid], egb);
-                        current_contig.push_back({read_string, pos, rc,
-                                                  order_s[rid],
-                                                  read_lengths_s[rid]});
-                        for (int l1 = 0; l1 < eg.numdict_s; l1++) {
-                          if (read_lengths_s[rid] > dict[l1].end)
-                            deleted_rids[l1].push_back(rid);
-                        }
-                      }
+                    flag = 0;
+                    char rc = rev ? 'r' : 'd';
+                    long pos =
+                        rev ? (j + eg.max_readlen - read_lengths_s[rid])
+                            : j;
+                    std::string read_string =
+                        rev ? reverse_complement(
+                                  bitsettostring<bitset_size>(
+                                      read[rid], read_lengths_s[rid], egb),
+                                  read_lengths_s[rid])
+                            : bitsettostring<bitset_size>(
+                                  read[rid], read_lengths_s[rid], egb);
+                    contig.push_back(read_string, pos, rc, order_s[rid],
+                                     read_lengths_s[rid]);
+                    for (int l1 = 0; l1 < eg.numdict_s; l1++) {
+                      if (read_lengths_s[rid] > dict[l1].end)
+                        deleted_rids[l1].push_back(rid);
                     }
                   }
-                  omp_unset_lock(&dict_lock[startposidx]);
-                  // delete from dictionaries
-                  for (int l1 = 0; l1 < eg.numdict_s; l1++)
-                    for (auto it = deleted_rids[l1].begin();
-                         it != deleted_rids[l1].end();) {
-                      b = read[*it] & mask1[l1];
-                      ull = (b >> 3 * dict[l1].start).to_ullong();
-                      startposidx = dict[l1].bphf->lookup(ull);
-                      if (!omp_test_lock(&dict_lock[startposidx])) {
-                        ++it;
-                        continue;
-                      }
-                      dict[l1].findpos(dictidx, startposidx);
-                      dict[l1].remove(dictidx, startposidx, *it);
-                      it = deleted_rids[l1].erase(it);
-                      omp_unset_lock(&dict_lock[startposidx]);
-                    }
                 }
               }
-              if (j !=
-                  (int64_t)ref.size() -
-                      eg.max_readlen)  // not at last position,shift bitsets
-              {
-                forward_bitset >>= 3;
-                forward_bitset = forward_bitset & mask[0][0];
-                forward_bitset |=
-                    egb.basemask[eg.max_readlen - 1]
-                                [(uint8_t)ref[j + eg.max_readlen]];
-                reverse_bitset <<= 3;
-                reverse_bitset = reverse_bitset & mask[0][0];
-                reverse_bitset |= egb.basemask[0][(
-                    uint8_t)chartorevchar[(uint8_t)ref[j + eg.max_readlen]]];
-              }
-
-            }  // end for
-          }    // end if
-          // sort contig according to pos
-          current_contig.sort([](const contig_reads &a, const contig_reads &b) {
-            return a.pos < b.pos;
-          });
-          writecontig(ref, current_contig, f_seq, f_pos, f_noise, f_noisepos,
-                      f_order, f_RC, f_readlength, eg, abs_pos);
-        }
-        if (!done) {
-          current_contig = {{current, p, rc, ord, rl}};
-          list_size = 1;
-        }
-      } else if (c == '1')  // read found during rightward search
-      {
-        current_contig.push_back({current, p, rc, ord, rl});
-        list_size++;
-      }
-    }
-    f.close();
-    fin_flag.close();
-    fin_pos.close();
-    in_order.close();
-    fin_RC.close();
-    fin_readlength.close();
+              unset_lock(dict_lock, startposidx);
+              // delete from dictionaries
+              for (int l1 = 0; l1 < eg.numdict_s; l1++)
+                for (auto it = deleted_rids[l1].begin();
+                     it != deleted_rids[l1].end();) {
+                  b = read[*it] & mask1[l1];
+                  ull = (b >> 3 * dict[l1].start).to_ullong();
+                  startposidx = dict[l1].lookup(ull);
+                  if (!test_lock(dict_lock, startposidx)) {
+                    ++it;
+                    continue;
+                  }
+                  dict[l1].findpos(dictidx, startposidx);
+                  dict[l1].remove(dictidx, startposidx, *it);
+                  it = deleted_rids[l1].erase(it);
+                  unset_lock(dict_lock, startposidx);
+                }
+            }
+          }
+          if (j !=
+              (int64_t)ref.size() -
+                  eg.max_readlen)  // not at last position,shift bitsets
+          {
+            forward_bitset >>= 3;
+            forward_bitset = forward_bitset & mask[0];
+            forward_bitset |=
+                egb.basemask[eg.max_readlen - 1]
+                            [(uint8_t)ref[j + eg.max_readlen]];
+            reverse_bitset <<= 3;
+            reverse_bitset = reverse_bitset & mask[0];
+            reverse_bitset |= egb.basemask[0][(
+                uint8_t)chartorevchar[(uint8_t)ref[j + eg.max_readlen]]];
+          }
+
+        }  // end for
+      }    // end if
+      // sort contig according to pos
+      contig.sort_by_pos();
+      writecontig(ref, contig, f_seq, f_pos, f_noise, f_noisepos,
+                  f_order, f_RC, f_readlength, eg, abs_pos);
+    });
     f_seq.close();
     f_pos.close();
     f_noise.close();
@@ -383,23 +450,161 @@ void encode(std::bitset<bitset_size> *read, bbhashdict *dict, uint32_t *order_s,
     f_readlength.close();
     f_RC.close();
     delete[] deleted_rids;
-  }  // end omp parallel
+  }  // parts end
+  free_lock_array(dict_lock, num_dict_locks);
+  free_lock_array(read_lock, eg.numreads_s + eg.numreads_N);
+  delete[] mask;
+  delete[] mask1;
+}
+
+// encode the contigs of each part, placing the remaining singleton reads (and
+// reads with N) with a minimizer index over the consensus of all contigs
+// (--singleton-index). The contigs are read twice: first to build their
+// consensus, then to write them with the singletons placed in them.
+template <size_t bitset_size>
+void encode_with_index(read_bits_array<bitset_size> read, uint32_t *order_s,
+                       uint16_t *read_lengths_s, bool *remainingreads,
+                       const encoder_global &eg,
+                       const encoder_global_b<bitset_size> &egb) {
+  consensus_index index;
+  // contigs of part tid are part_contigs[tid] to part_contigs[tid + 1] - 1
+  std::vector<uint64_t> part_contigs(eg.num_parts + 1, 0);
+  {
+    std::vector<std::string> part_seq(eg.num_parts);
+    std::vector<std::vector<uint64_t>> part_contig_len(eg.num_parts);
+#pragma omp parallel for schedule(dynamic)
+    for (int tid = 0; tid < eg.num_parts; tid++) {
+      contig_arena contig;
+      for_each_contig(eg, tid, contig, [&](contig_arena &contig) {
+        std::string ref = buildcontig(contig);
+        part_seq[tid] += ref;
+        part_contig_len[tid].push_back(ref.size());
+      });
+    }
+    uint64_t seq_len = 0;
+    for (int tid = 0; tid < eg.num_parts; tid++) {
+      for (uint64_t len : part_contig_len[tid]) {
+        seq_len += len;
+        index.contig_end.push_back(seq_len);
+      }
+      index.seq += part_seq[tid];
+      std::string().swap(part_seq[tid]);
+      part_contigs[tid + 1] = index.contig_end.size();
+    }
+  }
+  index.build(eg.num_thr);
+
+  // place the singletons, stored as 2 * (start in index.seq) + (1 if
+  // reverse complemented) in the list of the part holding the contig
+  const uint32_t numreads = eg.numreads_s + eg.numreads_N;
+  uint64_t *placed = alloc_array<uint64_t>(numreads);
+#pragma omp parallel num_threads(eg.num_thr)
+  {
+    consensus_index::scratch scratch;
+#pragma omp for schedule(dynamic, 1024)
+    for (int64_t rid = 0; rid < (int64_t)numreads; rid++) {
+      uint64_t pos;
+      bool rev;
+      if (index.place(bitsettostring<bitset_size>(read[rid],
+                                                  read_lengths_s[rid], egb),
+                      pos, rev, scratch)) {
+        placed[rid] = 2 * pos + rev;
+        remainingreads[rid] = 0;
+      } else {
+        placed[rid] = UINT64_MAX;
+      }
+    }
+  }
+  std::vector<std::vector<std::pair<uint64_t, uint32_t>>> part_placed(
+      eg.num_parts);
+  for (uint32_t rid = 0; rid < numreads; rid++) {
+    if (placed[rid] == UINT64_MAX) continue;
+    uint64_t contig_num = std::upper_bound(index.contig_end.begin(),
+                                           index.contig_end.end(),
+                                           placed[rid] / 2) -
+                          index.contig_end.begin();
+    int tid = std::upper_bound(part_contigs.begin(), part_contigs.end(),
+                               contig_num) -
+              part_contigs.begin() - 1;
+    part_placed[tid].push_back({placed[rid], rid});
+  }
+  free_array(placed, numreads);
+
+#pragma omp parallel for schedule(dynamic)
+  for (int tid = 0; tid < eg.num_parts; tid++) {
+    buffered_ofstream f_seq(eg.outfile_seq + '.' + std::to_string(tid));
+    buffered_ofstream f_pos(eg.outfile_pos + '.' + std::to_string(tid),
+                            std::ios::binary);
+    buffered_ofstream f_noise(eg.outfile_noise + '.' + std::to_string(tid));
+    buffered_ofstream f_noisepos(eg.outfile_noisepos + '.' + std::to_string(tid),
+                                 std::ios::binary);
+    buffered_ofstream f_order(eg.infile_order + '.' + std::to_string(tid) + ".tmp",
+                              std::ios::binary);
+    buffered_ofstream f_RC(eg.infile_RC + '.' + std::to_string(tid) + ".tmp");
+    buffered_ofstream f_readlength(
+        eg.infile_readlength + '.' + std::to_string(tid) + ".tmp",
+        std::ios::binary);
+    std::sort(part_placed[tid].begin(), part_placed[tid].end());
+    auto placed_it = part_placed[tid].begin();
+    uint64_t contig_num = part_contigs[tid];
+    uint64_t abs_pos = 0;
+    contig_arena contig;
+    for_each_contig(eg, tid, contig, [&](contig_arena &contig) {
+      uint64_t contig_start =
+          (contig_num == 0) ? 0 : index.contig_end[contig_num - 1];
+      uint64_t contig_end = index.contig_end[contig_num++];
+      std::string ref =
+          index.seq.substr(contig_start, contig_end - contig_start);
+      uint32_t contig_reads = contig.size();
+      for (; placed_it != part_placed[tid].end() &&
+             placed_it->first / 2 < contig_end;
+           ++placed_it) {
+        uint32_t rid = placed_it->second;
+        bool rev = placed_it->first % 2;
+        std::string read_string =
+            bitsettostring<bitset_size>(read[rid], read_lengths_s[rid], egb);
+        if (rev)
+          read_string = reverse_complement(read_string, read_lengths_s[rid]);
+        contig.push_back(read_string, placed_it->first / 2 - contig_start,
+                         rev ? 'r' : 'd', order_s[rid], read_lengths_s[rid]);
+      }
+      if (contig.size() != contig_reads) contig.sort_by_pos();
+      writecontig(ref, contig, f_seq, f_pos, f_noise, f_noisepos, f_order,
+                  f_RC, f_readlength, eg, abs_pos);
+    });
+  }  // parts end
+}
+
+template <size_t bitset_size>
+void encode(read_bits_array<bitset_size> read, bbhashdict *dict,
+            uint32_t *order_s, uint16_t *read_lengths_s,
+            const encoder_global &eg, const encoder_global_b<bitset_size> &egb,
+            const encoder_params &ep, bool deep) {
+  bool *remainingreads = alloc_array<bool>(eg.numreads_s + eg.numreads_N);
+  std::fill(remainingreads, remainingreads + eg.numreads_s + eg.numreads_N, 1);
+  std::cout << "Encoding reads\n";
+  if (ep.singleton_index)
+    encode_with_index<bitset_size>(read, order_s, read_lengths_s,
+                                   remainingreads, eg, egb);
+  else
+    encode_with_dict<bitset_size>(read, dict, order_s, read_lengths_s,
+                                  remainingreads, eg, egb);
 
   // Combine files produced by the threads
-  std::ofstream f_order(eg.infile_order, std::ios::binary);
-  std::ofstream f_readlength(eg.infile_readlength, std::ios::binary);
-  std::ofstream f_noisepos(eg.outfile_noisepos, std::ios::binary);
-  std::ofstream f_noise(eg.outfile_noise);
-  std::ofstream f_RC(eg.infile_RC);
-
-  for (int tid = 0; tid < eg.num_thr; tid++) {
-    std::ifstream in_order(eg.infile_order + '.' + std::to_string(tid) +
-                           ".tmp", std::ios::binary);
-    std::ifstream in_readlength(eg.infile_readlength + '.' +
-                                std::to_string(tid) + ".tmp", std::ios::binary);
-    std::ifstream in_RC(eg.infile_RC + '.' + std::to_string(tid) + ".tmp");
-    std::ifstream in_noisepos(eg.outfile_noisepos + '.' + std::to_string(tid), std::ios::binary);
-    std::ifstream in_noise(eg.outfile_noise + '.' + std::to_string(tid));
+  buffered_ofstream f_order(eg.infile_order, std::ios::binary);
+  buffered_ofstream f_readlength(eg.infile_readlength, std::ios::binary);
+  buffered_ofstream f_noisepos(eg.outfile_noisepos, std::ios::binary);
+  buffered_ofstream f_noise(eg.outfile_noise);
+  buffered_ofstream f_RC(eg.infile_RC);
+
+  for (int tid = 0; tid < eg.num_parts; tid++) {
+    buffered_ifstream in_order(eg.infile_order + '.' + std::to_string(tid) +
+                               ".tmp", std::ios::binary);
+    buffered_ifstream in_readlength(eg.infile_readlength + '.' +
+                                    std::to_string(tid) + ".tmp", std::ios::binary);
+    buffered_ifstream in_RC(eg.infile_RC + '.' + std::to_string(tid) + ".tmp");
+    buffered_ifstream in_noisepos(eg.outfile_noisepos + '.' + std::to_string(tid), std::ios::binary);
+    buffered_ifstream in_noise(eg.outfile_noise + '.' + std::to_string(tid));
     f_order << in_order.rdbuf();
     f_order.clear();  // clear error flag in case in_order is empty
     f_noisepos << in_noisepos.rdbuf();
@@ -426,7 +631,7 @@ void encode(std::bitset<bitset_size> *read, bbhashdict *dict, uint32_t *order_s,
   f_order.close();
   f_readlength.close();
   // write remaining singleton reads now
-  std::ofstream f_unaligned(eg.outfile_unaligned, std::ios::binary);
+  buffered_ofstream f_unaligned(eg.outfile_unaligned, std::ios::binary);
   f_order.open(eg.infile_order, std::ios::binary | std::ofstream::app);
   f_readlength.open(eg.infile_readlength,
                     std::ios::binary | std::ofstream::app);
@@ -436,7 +641,8 @@ void encode(std::bitset<bitset_size> *read, bbhashdict *dict, uint32_t *order_s,
     if (remainingreads[i] == 1) {
       matched_s--;
       f_order.write((char *)&order_s[i], sizeof(uint32_t));
-      f_readlength.write((char *)&read_lengths_s[i], sizeof(uint16_t));
+      if (!eg.fixed_readlen)
+        f_readlength.write((char *)&read_lengths_s[i], sizeof(uint16_t));
       std::string unaligned_read = bitsettostring<bitset_size>(read[i], read_lengths_s[i], egb);
       write_dnaN_in_bits(unaligned_read, f_unaligned);
       len_unaligned += read_lengths_s[i];
@@ -448,34 +654,30 @@ void encode(std::bitset<bitset_size> *read, bbhashdict *dict, uint32_t *order_s,
       std::string unaligned_read = bitsettostring<bitset_size>(read[i], read_lengths_s[i], egb);
       write_dnaN_in_bits(unaligned_read, f_unaligned);
       f_order.write((char *)&order_s[i], sizeof(uint32_t));
-      f_readlength.write((char *)&read_lengths_s[i], sizeof(uint16_t));
+      if (!eg.fixed_readlen)
+        f_readlength.write((char *)&read_lengths_s[i], sizeof(uint16_t));
       len_unaligned += read_lengths_s[i];
     }
   f_order.close();
   f_readlength.close();
   f_unaligned.close();
-  delete[] remainingreads;
-  delete[] dict_lock;
-  delete[] read_lock;
-  for (int i = 0; i < eg.max_readlen; i++) delete[] mask[i];
-  delete[] mask;
-  delete[] mask1;
+  free_array(remainingreads, eg.numreads_s + eg.numreads_N);
 
   // write length of unaligned array
-  std::ofstream f_unaligned_count(eg.outfile_unaligned+".count", std::ios::binary);
+  buffered_ofstream f_unaligned_count(eg.outfile_unaligned+".count", std::ios::binary);
   f_unaligned_count.write((char*)&len_unaligned, sizeof(uint64_t));
   f_unaligned_count.close();
 
   // pack read_Seq and convert read_pos into 8 byte non-diff (absolute)
   // positions
-  uint64_t *file_len_seq_thr = new uint64_t[eg.num_thr];
+  uint64_t *file_len_seq_thr = new uint64_t[eg.num_parts];
   uint64_t abs_pos = 0;
   uint64_t abs_pos_thr;
-  pack_compress_seq(eg, file_len_seq_thr, deep, gpu_id);
-  std::ofstream fout_pos(eg.outfile_pos, std::ios::binary);
-  for (int tid = 0; tid < eg.num_thr; tid++) {
-    std::ifstream fin_pos(eg.outfile_pos + '.' + std::to_string(tid),
-                          std::ios::binary);
+  pack_compress_seq(eg, file_len_seq_thr, ep, deep);
+  buffered_ofstream fout_pos(eg.outfile_pos, std::ios::binary);
+  for (int tid = 0; tid < eg.num_parts; tid++) {
+    buffered_ifstream fin_pos(eg.outfile_pos + '.' + std::to_string(tid),
+                              std::ios::binary);
     fin_pos.read((char *)&abs_pos_thr, sizeof(uint64_t));
     while (!fin_pos.eof()) {
       abs_pos_thr += abs_pos;
@@ -541,14 +743,14 @@ void setglobalarrays(encoder_global &eg, encoder_global_b<bitset_size> &egb) {
 }
 
 template <size_t bitset_size>
-void readsingletons(std::bitset<bitset_size> *read, uint32_t *order_s,
+void readsingletons(read_bits_array<bitset_size> read, uint32_t *order_s,
                     uint16_t *read_lengths_s, const encoder_global &eg,
                     const encoder_global_b<bitset_size> &egb) {
   // not parallelized right now since these are very small number of reads
-  std::ifstream f(eg.infile + ".singleton", std::ifstream::in|std::ios::binary);
+  buffered_ifstream f(eg.infile + ".singleton", std::ifstream::in|std::ios::binary);
   std::string s;
   for (uint32_t i = 0; i < eg.numreads_s; i++) {
-    read_dna_from_bits(s,f);
+    read_dna_from_bits(s, f, eg.fixed_readlen);
     read_lengths_s[i] = s.length();
     stringtobitset<bitset_size>(s, read_lengths_s[i], read[i], egb.basemask);
   }
@@ -560,19 +762,20 @@ void readsingletons(std::bitset<bitset_size> *read, uint32_t *order_s,
     read_lengths_s[i] = s.length();
     stringtobitset<bitset_size>(s, read_lengths_s[i], read[i], egb.basemask);
   }
-  std::ifstream f_order_s(eg.infile_order + ".singleton", std::ios::binary);
+  buffered_ifstream f_order_s(eg.infile_order + ".singleton", std::ios::binary);
   for (uint32_t i = 0; i < eg.numreads_s; i++)
     f_order_s.read((char *)&order_s[i], sizeof(uint32_t));
   f_order_s.close();
   remove((eg.infile_order + ".singleton").c_str());
-  std::ifstream f_order_N(eg.infile_order_N, std::ios::binary);
+  buffered_ifstream f_order_N(eg.infile_order_N, std::ios::binary);
   for (uint32_t i = eg.numreads_s; i < eg.numreads_s + eg.numreads_N; i++)
     f_order_N.read((char *)&order_s[i], sizeof(uint32_t));
   f_order_N.close();
 }
 
 template <size_t bitset_size>
-void encoder_main(const std::string &temp_dir, const compression_params &cp, bool deep, int gpu_id) {
+void encoder_main(const std::string &temp_dir, const compression_params &cp,
+                  const int &num_parts, const encoder_params &ep, bool deep) {
   encoder_global_b<bitset_size> *egb_ptr =
       new encoder_global_b<bitset_size>(cp.max_readlen);
   encoder_global *eg_ptr = new encoder_global;
@@ -588,6 +791,7 @@ void encoder_main(const std::string &temp_dir, const compression_params &cp, boo
   eg.infile_RC = eg.basedir + "/read_rev.txt";
   eg.infile_readlength = eg.basedir + "/read_lengths.bin";
   eg.infile_N = eg.basedir + "/input_N.dna";
+  eg.infile_N_pos = eg.basedir + "/read_N_pos.bin";
   eg.outfile_seq = eg.basedir + "/read_seq.bin";
   eg.outfile_pos = eg.basedir + "/read_pos.bin";
   eg.outfile_noise = eg.basedir + "/read_noise.txt";
@@ -595,41 +799,83 @@ void encoder_main(const std::string &temp_dir, const compression_params &cp, boo
   eg.outfile_unaligned = eg.basedir + "/read_unaligned.txt";
 
   eg.max_readlen = cp.max_readlen;
+  eg.fixed_readlen = cp.fixed_readlen ? cp.max_readlen : 0;
   eg.num_thr = cp.num_thr;
+  eg.num_parts = num_parts;
+  eg.independent_parts = ep.deterministic;
 
   omp_set_num_threads(eg.num_thr);
   getDataParams(eg, cp);  // populate numreads
   setglobalarrays<bitset_size>(eg, egb);
-  std::bitset<bitset_size> *read =
-      new std::bitset<bitset_size>[eg.numreads_s + eg.numreads_N];
-  uint32_t *order_s = new uint32_t[eg.numreads_s + eg.numreads_N];
-  uint16_t *read_lengths_s = new uint16_t[eg.numreads_s + eg.numreads_N];
+  read_bits_array<bitset_size> read =
+      read_bits_traits<bitset_size>::alloc(eg.numreads_s + eg.numreads_N);
+  uint32_t *order_s = alloc_array<uint32_t>(eg.numreads_s + eg.numreads_N);
+  uint16_t *read_lengths_s =
+      alloc_array<uint16_t>(eg.numreads_s + eg.numreads_N);
   readsingletons<bitset_size>(read, order_s, read_lengths_s, eg, egb);
   remove(eg.infile_N.c_str());
   correct_order(order_s, eg);
+  eg.subst_N.load(eg.infile_N_pos, cp.num_reads);
+  remove(eg.infile_N_pos.c_str());
+  // the singletons with substituted N get them back (the contigs' reads get
+  // them as they are read)
+  for (uint32_t i = 0; i < eg.numreads_s; i++) {
+    if (!eg.subst_N.has_N[order_s[i]]) continue;
+    std::string s =
+        bitsettostring<bitset_size>(read[i], read_lengths_s[i], egb);
+    eg.subst_N.restore(s, order_s[i], 'd', read_lengths_s[i]);
+    read[i].reset();
+    stringtobitset<bitset_size>(s, read_lengths_s[i], read[i], egb.basemask);
+  }
 
-  bbhashdict *dict = new bbhashdict[eg.numdict_s];
-  if (eg.max_readlen > 50) {
-    dict[0].start = 0;
-    dict[0].end = 20;
-    dict[1].start = 21;
-    dict[1].end = 41;
-  } else {
-    dict[0].start = 0;
-    dict[0].end = 20 * eg.max_readlen / 50;
-    dict[1].start = 20 * eg.max_readlen / 50 + 1;
-    dict[1].end = 41 * eg.max_readlen / 50;
+  // one set of dictionaries, or one per part for independent parts
+  const int num_dict_sets = eg.independent_parts ? eg.num_parts : 1;
+  bbhashdict *dict = new bbhashdict[num_dict_sets * eg.numdict_s];
+  for (int i = 0; i < num_dict_sets; i++) {
+    bbhashdict *set = dict + i * eg.numdict_s;
+    if (eg.max_readlen > 50) {
+      set[0].start = 0;
+      set[0].end = 20;
+      set[1].start = 21;
+      set[1].end = 41;
+    } else {
+      set[0].start = 0;
+      set[0].end = 20 * eg.max_readlen / 50;
+      set[1].start = 20 * eg.max_readlen / 50 + 1;
+      set[1].end = 41 * eg.max_readlen / 50;
+    }
+  }
+  if (is_mapped(read) && !ep.singleton_index) {
+    // out-of-core mode: singletons and reads with N in key order (each group
+    // stays in its range)
+    uint32_t n = eg.numreads_s + eg.numreads_N;
+    uint32_t *perm = alloc_array<uint32_t>(n);
+    key_order<bitset_size>(read, read_lengths_s, dict[0], 3, 0, eg.numreads_s,
+                           perm);
+    key_order<bitset_size>(read, read_lengths_s, dict[0], 3, eg.numreads_s, n,
+                           perm);
+    read = permute_array(read, perm, n);
+    read_lengths_s = permute_array(read_lengths_s, perm, n);
+    order_s = permute_array(order_s, perm, n);
+    free_array(perm, n);
+  }
+  if (eg.numreads_s + eg.numreads_N > 0 && !ep.singleton_index) {
+    for (int i = 0; i < num_dict_sets; i++) {
+      uint32_t begin = eg.independent_parts ? eg.part_begin_s(i) : 0;
+      uint32_t end = eg.independent_parts ? eg.part_begin_s(i + 1)
+                                          : eg.numreads_s + eg.numreads_N;
+      if (begin == end) continue;
+      constructdictionary<bitset_size>(read, dict + i * eg.numdict_s,
+                                       read_lengths_s, eg.numdict_s, end, 3,
+                                       eg.basedir, eg.num_thr, NULL, begin);
+    }
   }
-  if (eg.numreads_s + eg.numreads_N > 0)
-    constructdictionary<bitset_size>(read, dict, read_lengths_s, eg.numdict_s,
-                                     eg.numreads_s + eg.numreads_N, 3,
-                                     eg.basedir, eg.num_thr);
-  encode<bitset_size>(read, dict, order_s, read_lengths_s, eg, egb, deep, gpu_id);
+  encode<bitset_size>(read, dict, order_s, read_lengths_s, eg, egb, ep, deep);
 
-  delete[] read;
+  free_array(read, eg.numreads_s + eg.numreads_N);
   delete[] dict;
-  delete[] order_s;
-  delete[] read_lengths_s;
+  free_array(order_s, eg.numreads_s + eg.numreads_N);
+  free_array(read_lengths_s, eg.numreads_s + eg.numreads_N);
   delete eg_ptr;
   delete egb_ptr;
 }
@@ -60,6 +60,7 @@ preprocessor macro LIBBSC_SORT_TRANSFORM_SUPPORT at compile time.
 #include "libbsc/libbsc/filters.h"
 #include "libbsc/libbsc/libbsc.h"
 #include "libbsc/libbsc/platform/platform.h"
+#include "memory_util.h"
 #include "params.h"
 
 namespace spring {
@@ -91,7 +92,7 @@ class bsc_str_array_class {
   int paramEnableParallelProcessing = 0;
   int paramEnableMultiThreading = 1;
   int paramEnableFastMode = 1;
-  int paramEnableLargePages = 0;
+  int paramEnableLargePages = (get_huge_pages() != HUGE_PAGES_NONE);
   int paramEnableCUDA = 0;
   int paramEnableSegmentation = 0;
   int paramEnableReordering = 0;
@@ -41,6 +41,19 @@ See also the bsc and libbsc web site:
 #if defined(_WIN32)
   #include <windows.h>
   SIZE_T g_LargePageSize = 0;
+#elif defined(__linux__)
+  #include <sys/mman.h>
+  size_t g_LargePageSize = 0;
+
+/* Huge page aligned malloc backed by transparent huge pages. The block is
+   still released with free(). */
+static void * bsc_linux_large_malloc(size_t size)
+{
+    void * address = NULL;
+    if (posix_memalign(&address, g_LargePageSize, size) != 0) return NULL;
+    madvise(address, (size + g_LargePageSize - 1) & (~(g_LargePageSize - 1)), MADV_HUGEPAGE);
+    return address;
+}
 #endif
 
 static void * bsc_default_malloc(size_t size)
@@ -52,6 +65,13 @@ static void * bsc_default_malloc(size_t size)
         if (address != NULL) return address;
     }
     return VirtualAlloc(0, size, MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+    if ((g_LargePageSize != 0) && (size >= g_LargePageSize))
+    {
+        void * address = bsc_linux_large_malloc(size);
+        if (address != NULL) return address;
+    }
+    return malloc(size);
 #else
     return malloc(size);
 #endif
@@ -66,6 +86,17 @@ static void * bsc_default_zero_malloc(size_t size)
         if (address != NULL) return address;
     }
     return VirtualAlloc(0, size, MEM_COMMIT, PAGE_READWRITE);
+#elif defined(__linux__)
+    if ((g_LargePageSize != 0) && (size >= g_LargePageSize))
+    {
+        void * address = bsc_linux_large_malloc(size);
+        if (address != NULL)
+        {
+            memset(address, 0, size);
+            return address;
+        }
+    }
+    return calloc(1, size);
 #else
     return calloc(1, size);
 #endif
@@ -174,6 +205,10 @@ int bsc_platform_init(int features, void* (* malloc)(size_t size), void* (* zero
         }
     }
 
+#elif defined(__linux__)
+
+    g_LargePageSize = (features & LIBBSC_FEATURE_LARGEPAGES) ? 2 * 1024 * 1024 : 0;
+
 #endif
 
     return LIBBSC_NO_ERROR;
@@ -22,6 +22,8 @@ This code is a modified version of SPRING, originally developed by the Universit
 #include <iostream>
 #include <string>
 #include <vector>
+#include "buffered_io.h"
+#include "nucleotide_cm.h"
 #include "spring.h"
 
 std::string temp_dir_global;  // for interrupt handling
@@ -43,17 +45,33 @@ int main(int argc, char** argv) {
   namespace po = boost::program_options;
   bool help_flag = false, compress_flag = false, decompress_flag = false,
        pairing_only_flag = false, no_quality_flag = false, no_ids_flag = false,
-       long_flag = false, gzip_flag = false, fasta_flag = false, deep_flag = false;
+       long_flag = false, gzip_flag = false, fasta_flag = false, deep_flag = false,
+       out_of_core_flag = false, direct_io_flag = false;
   std::vector<std::string> infile_vec, outfile_vec, quality_opts;
   std::vector<uint64_t> decompress_range_vec;
-  std::string working_dir;
+  std::string working_dir, numa_policy, huge_pages, dict_backend,
+      temp_compression, seq_codec, deep_weights;
   int num_thr, gzip_level, gpu_id;
+  double max_memory_gb;
+  uint64_t max_reads_segment;
+  spring::reorder_params rp;
+  spring::encoder_params ep;
   po::options_description desc("Allowed options");
   desc.add_options()("help,h", po::bool_switch(&help_flag),
                      "produce help message")(
       "compress,c", po::bool_switch(&compress_flag), "compress")(
       "decompress,d", po::bool_switch(&decompress_flag), "decompress")(
-      "deep", po::bool_switch(&deep_flag), "enable deep compression mode")(
+      "deep", po::bool_switch(&deep_flag),
+      "enable deep compression mode: the contig consensus is coded with a "
+      "neural network trained online, on the CPU (decompression detects it)")(
+      "deep-weights", po::value<std::string>(&deep_weights)->default_value(""),
+      "initial weights of the deep model, written by --deep-save-weights "
+      "(needed again for decompression) (default: built-in seeded weights)")(
+      "deep-save-weights",
+      po::value<std::string>(&ep.deep_save_weights)->default_value(""),
+      "with --deep, write the deep model weights trained on the first chunk "
+      "of the consensus to this file, to start later compressions of similar "
+      "data from")(
       "decompress-range",
       po::value<std::vector<uint64_t> >(&decompress_range_vec)->multitoken(),
       "--decompress-range start end\n(optional) decompress only reads (or read "
@@ -98,7 +116,82 @@ int main(int argc, char** argv) {
       "fasta-input", po::bool_switch(&fasta_flag),
       "enable if compression input is fasta file (i.e., no qualities)")(
       "gpu-id", po::value<int>(&gpu_id)->default_value(0),
-      "ID of the GPU to use (default: 0)"
+      "ID of the GPU used to decompress archives of the former Python deep "
+      "mode (default: 0)")(
+      "numa", po::value<std::string>(&numa_policy)->default_value("none"),
+      "NUMA placement of the reordering and encoding arrays: none, interleave "
+      "or first-touch (default: none)")(
+      "huge-pages", po::value<std::string>(&huge_pages)->default_value("none"),
+      "back the large working arrays with huge pages: none, thp (transparent "
+      "huge pages) or hugetlb (preallocated hugetlbfs pages, falls back to "
+      "thp) (default: none)")(
+      "max-memory", po::value<double>(&max_memory_gb)->default_value(0),
+      "soft limit on memory use in GB during compression, stages size their "
+      "blocks and buffers to stay within it and fall back to temporary files "
+      "when needed, the peak is reported at the end (default: 0, no limit)")(
+      "temp-compression",
+      po::value<std::string>(&temp_compression)->default_value("none"),
+      "compression of the temporary files passed from reordering to "
+      "encoding: none or gzip (smaller temporary directory, slower) "
+      "(default: none)")(
+      "direct-io", po::bool_switch(&direct_io_flag),
+      "read and write the temporary files of reordering and encoding with "
+      "O_DIRECT, bypassing the page cache (where the file system allows it)")(
+      "out-of-core", po::bool_switch(&out_of_core_flag),
+      "keep the reads of the reordering and encoding stages and the per-read "
+      "arrays of the stream compression in memory-mapped temporary files that "
+      "can be paged out (done automatically for arrays that would exceed "
+      "--max-memory)")(
+      "segment-reads",
+      po::value<uint64_t>(&max_reads_segment)->default_value(0),
+      "maximum number of reads (counting both reads of a pair) in a segment, "
+      "larger inputs are split into segments compressed independently "
+      "(default: 0, i.e., 4294967290, the most a segment can hold)")(
+      "deterministic", po::bool_switch(&rp.deterministic),
+      "produce the same archive for the same input and options whatever the "
+      "number of threads. Reordering and encoding of the reads then work on "
+      "parts of about 16M reads each (at most 64 parts), with dictionaries "
+      "of their own: inputs of up to 16M reads use a single thread for these "
+      "stages, and reads are only matched within their part, which costs "
+      "some compression on larger inputs")(
+      "singleton-index", po::bool_switch(&ep.singleton_index),
+      "place the singleton reads in the contigs with a minimizer index over "
+      "the contig consensus, mapped in parallel, instead of looking up every "
+      "consensus position in the singleton dictionaries")(
+      "seq-codec", po::value<std::string>(&seq_codec)->default_value("zpaq"),
+      "codec of the contig consensus sequence: zpaq (zpaq -method 5 on the "
+      "2-bit packed bases) or cm (built-in nucleotide context mixing, "
+      "several times faster, coded in parallel chunks) (default: zpaq, "
+      "ignored with --deep)")(
+      "dict-backend", po::value<std::string>(&dict_backend)->default_value("bbhash"),
+      "hash function indexing the reordering and encoding dictionaries: "
+      "bbhash (BBHash minimal perfect hash) or pilot (PTHash style perfect "
+      "hash, smaller with faster lookups) (default: bbhash)")(
+      "reorder-autotune", po::bool_switch(&rp.autotune),
+      "try a few dictionary layouts and search limits for reordering on a "
+      "sample of the reads and use the best one (options below that are "
+      "specified are kept fixed)")(
+      "reorder-num-dict", po::value<int>(&rp.num_dict)->default_value(0),
+      "number of reordering dictionaries (default: 2)")(
+      "reorder-dict-len", po::value<int>(&rp.dict_len)->default_value(0),
+      "bases per reordering dictionary key, at most 32 (default: 32, less for "
+      "reads shorter than 100)")(
+      "reorder-dict",
+      po::value<std::string>(&rp.dict_positions)->default_value(""),
+      "explicit reordering dictionary ranges as start-end,start-end,... "
+      "(0-based, inclusive), overrides --reorder-num-dict and "
+      "--reorder-dict-len")(
+      "reorder-max-search", po::value<int>(&rp.max_search)->default_value(0),
+      "maximum number of reads checked in a dictionary bin (default: 1000)")(
+      "reorder-thresh", po::value<int>(&rp.thresh)->default_value(-1),
+      "maximum Hamming distance for a reordering match (default: 4)")(
+      "reorder-max-shift", po::value<int>(&rp.max_shift)->default_value(0),
+      "maximum shift tried between consecutive reads (default: half the "
+      "maximum read length)")(
+      "reorder-stop-criteria",
+      po::value<double>(&rp.stop_criteria)->default_value(-1.0),
+      "fraction of unmatched reads in the last 1M after which a thread stops "
+      "searching (default: 0.5)"
       );
   po::variables_map vm;
   po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -143,14 +236,21 @@ int main(int argc, char** argv) {
       pairing_only_flag = false;
     }
   }
+  spring::set_direct_io(direct_io_flag);
   try {
+    spring::set_temp_gzip(spring::parse_temp_compression(temp_compression));
+    ep.seq_cm = spring::parse_seq_codec(seq_codec);
+    ep.deterministic = rp.deterministic;
+    if (!deep_weights.empty()) spring::set_deep_weights(deep_weights);
     if (compress_flag)
       spring::compress(temp_dir, infile_vec, outfile_vec, num_thr,
                        pairing_only_flag, no_quality_flag, no_ids_flag,
-                       quality_opts, long_flag, gzip_flag, fasta_flag, deep_flag, gpu_id);
+                       quality_opts, long_flag, gzip_flag, fasta_flag, deep_flag,
+                       numa_policy, huge_pages, max_memory_gb, dict_backend,
+                       out_of_core_flag, max_reads_segment, rp, ep);
     else
       spring::decompress(temp_dir, infile_vec, outfile_vec, num_thr,
-                         decompress_range_vec, gzip_flag, gzip_level, deep_flag, gpu_id);
+                         decompress_range_vec, gzip_flag, gzip_level, gpu_id);
 
   }
   // Error handling
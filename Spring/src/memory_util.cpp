@@ -0,0 +1,300 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#include "memory_util.h"
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace spring {
+
+// from linux/mempolicy.h (not using libnuma to avoid the extra dependency)
+const int SPRING_MPOL_INTERLEAVE = 3;
+const int MAX_NUMA_NODES = 1024;
+
+static int numa_policy_global = NUMA_POLICY_NONE;
+static int huge_pages_global = HUGE_PAGES_NONE;
+static size_t huge_page_size_global = 2 * 1024 * 1024;
+static uint64_t max_memory_global = 0;
+static std::string out_of_core_dir_global;
+static bool out_of_core_force_global = false;
+// file backed mappings and their sizes, guarded by omp critical(mapped_pages)
+static std::map<const void *, size_t> mapped_pages_global;
+
+int parse_numa_policy(const std::string &policy) {
+  if (policy == "none") return NUMA_POLICY_NONE;
+  if (policy == "interleave") return NUMA_POLICY_INTERLEAVE;
+  if (policy == "first-touch") return NUMA_POLICY_FIRST_TOUCH;
+  throw std::runtime_error("Invalid NUMA policy: " + policy);
+}
+
+int parse_huge_pages(const std::string &mode) {
+  if (mode == "none") return HUGE_PAGES_NONE;
+  if (mode == "thp") return HUGE_PAGES_THP;
+  if (mode == "hugetlb") return HUGE_PAGES_HUGETLB;
+  throw std::runtime_error("Invalid huge pages mode: " + mode);
+}
+
+void init_memory_policy(const int numa_policy, const int huge_pages,
+                        const uint64_t max_memory) {
+  numa_policy_global = numa_policy;
+  huge_pages_global = huge_pages;
+  max_memory_global = max_memory;
+  if (huge_pages == HUGE_PAGES_HUGETLB) {
+    // default hugetlbfs page size ("Hugepagesize:    2048 kB")
+    std::ifstream fin("/proc/meminfo");
+    std::string key;
+    size_t size_kb;
+    while (fin >> key) {
+      if (key == "Hugepagesize:" && fin >> size_kb) {
+        huge_page_size_global = size_kb * 1024;
+        break;
+      }
+    }
+  }
+}
+
+int get_numa_policy() { return numa_policy_global; }
+
+int get_huge_pages() { return huge_pages_global; }
+
+uint64_t get_memory_limit() { return max_memory_global; }
+
+uint64_t current_rss() {
+  // second field of /proc/self/statm is the resident set size in pages
+  std::ifstream fin("/proc/self/statm");
+  uint64_t size_pages = 0, rss_pages = 0;
+  fin >> size_pages >> rss_pages;
+  return rss_pages * sysconf(_SC_PAGESIZE);
+}
+
+bool fits_in_memory(const uint64_t bytes) {
+  if (max_memory_global == 0) return true;
+  return current_rss() + bytes <= max_memory_global;
+}
+
+uint64_t items_within_budget(const uint64_t bytes_per_item,
+                             const uint64_t min_items,
+                             const uint64_t max_items) {
+  if (max_memory_global == 0) return max_items;
+  uint64_t rss = current_rss();
+  uint64_t available = (rss < max_memory_global) ? max_memory_global - rss : 0;
+  uint64_t items = available / std::max<uint64_t>(1, bytes_per_item);
+  return std::max(min_items, std::min(items, max_items));
+}
+
+uint64_t peak_rss() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return (uint64_t)usage.ru_maxrss * 1024;  // ru_maxrss is in KB
+}
+
+// size of the mapping actually created for a request of the given size, so
+// that alloc_pages and free_pages agree on it
+static size_t mapping_size(const size_t bytes) {
+  if (huge_pages_global != HUGE_PAGES_HUGETLB || bytes < HUGE_PAGES_MIN_BYTES)
+    return bytes;
+  return (bytes + huge_page_size_global - 1) / huge_page_size_global *
+         huge_page_size_global;
+}
+
+// parse /sys/devices/system/node/online (e.g. "0-1,3") into a list of nodes
+static std::vector<int> online_numa_nodes() {
+  std::vector<int> nodes;
+  std::ifstream fin("/sys/devices/system/node/online");
+  std::string s;
+  if (!std::getline(fin, s)) return nodes;
+  size_t i = 0;
+  while (i < s.size()) {
+    size_t j = s.find(',', i);
+    if (j == std::string::npos) j = s.size();
+    std::string range = s.substr(i, j - i);
+    size_t dash = range.find('-');
+    int lo = std::stoi(range.substr(0, dash));
+    int hi = (dash == std::string::npos) ? lo : std::stoi(range.substr(dash + 1));
+    for (int n = lo; n <= hi && n < MAX_NUMA_NODES; n++) nodes.push_back(n);
+    i = j + 1;
+  }
+  return nodes;
+}
+
+void *alloc_pages(const size_t bytes) {
+  if (bytes == 0) return NULL;
+  const size_t map_bytes = mapping_size(bytes);
+  void *ptr = MAP_FAILED;
+  if (huge_pages_global == HUGE_PAGES_HUGETLB && bytes >= HUGE_PAGES_MIN_BYTES)
+    ptr = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr == MAP_FAILED) {
+    ptr = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) throw std::bad_alloc();
+    if (huge_pages_global != HUGE_PAGES_NONE && bytes >= HUGE_PAGES_MIN_BYTES)
+      madvise(ptr, map_bytes, MADV_HUGEPAGE);  // only a hint
+  }
+  if (numa_policy_global == NUMA_POLICY_INTERLEAVE) {
+    std::vector<int> nodes = online_numa_nodes();
+    if (nodes.size() > 1) {
+      unsigned long nodemask[MAX_NUMA_NODES / (8 * sizeof(unsigned long))] = {};
+      for (int n : nodes)
+        nodemask[n / (8 * sizeof(unsigned long))] |=
+            1UL << (n % (8 * sizeof(unsigned long)));
+      // failure is not fatal, we just fall back to the default placement
+      syscall(SYS_mbind, ptr, map_bytes, SPRING_MPOL_INTERLEAVE, nodemask,
+              (unsigned long)MAX_NUMA_NODES, 0);
+    }
+  }
+  return ptr;
+}
+
+void free_pages(void *ptr, const size_t bytes) {
+  if (ptr == NULL) return;
+  bool mapped;
+#pragma omp critical(mapped_pages)
+  mapped = mapped_pages_global.erase(ptr) != 0;
+  munmap(ptr, mapped ? bytes : mapping_size(bytes));
+}
+
+void init_out_of_core(const std::string &dir, const bool force) {
+  out_of_core_dir_global = dir;
+  out_of_core_force_global = force;
+}
+
+bool use_out_of_core(const uint64_t bytes) {
+  if (out_of_core_dir_global.empty()) return false;
+  return out_of_core_force_global || !fits_in_memory(bytes);
+}
+
+void *alloc_mapped_pages(const size_t bytes) {
+  if (bytes == 0) return NULL;
+  std::string path = out_of_core_dir_global + "/mapped.XXXXXX";
+  std::vector<char> path_buf(path.begin(), path.end());
+  path_buf.push_back('\0');
+  int fd = mkstemp(path_buf.data());
+  if (fd == -1)
+    throw std::runtime_error("Cannot create out-of-core file in " +
+                             out_of_core_dir_global);
+  // the mapping keeps the file alive, the name is not needed
+  unlink(path_buf.data());
+  if (ftruncate(fd, bytes) != 0) {
+    close(fd);
+    throw std::runtime_error("Cannot resize out-of-core file");
+  }
+  void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) throw std::bad_alloc();
+#pragma omp critical(mapped_pages)
+  mapped_pages_global[ptr] = bytes;
+  return ptr;
+}
+
+bool is_mapped(const void *ptr) {
+  bool mapped;
+#pragma omp critical(mapped_pages)
+  mapped = mapped_pages_global.count(ptr) != 0;
+  return mapped;
+}
+
+void trim_mapped_pages() {
+  if (max_memory_global == 0 || current_rss() <= max_memory_global) return;
+#pragma omp critical(mapped_pages)
+  {
+    // dirty pages of a shared mapping are kept in the page cache (and written
+    // back from there), so this only unmaps them from the process
+    for (auto &m : mapped_pages_global)
+      madvise(const_cast<void *>(m.first), m.second, MADV_DONTNEED);
+  }
+}
+
+void numa_report(const std::string &label, const void *ptr,
+                 const size_t bytes) {
+  std::vector<int> nodes = online_numa_nodes();
+  if (nodes.size() <= 1 || ptr == NULL || bytes == 0) return;
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t max_samples = 65536;
+  uint64_t num_pages = (bytes + page_size - 1) / page_size;
+  uint64_t stride = std::max<uint64_t>(1, num_pages / max_samples);
+  std::vector<void *> pages;
+  for (uint64_t i = 0; i < num_pages; i += stride)
+    pages.push_back((char *)ptr + i * page_size);
+  std::vector<int> status(pages.size(), -1);
+  if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), NULL,
+              status.data(), 0) != 0)
+    return;
+  std::vector<uint64_t> pages_on_node(MAX_NUMA_NODES, 0);
+  uint64_t num_present = 0;
+  for (int st : status)
+    if (st >= 0 && st < MAX_NUMA_NODES) {
+      pages_on_node[st]++;
+      num_present++;
+    }
+  if (num_present == 0) return;
+
+  // node of each thread in the current team
+  int num_thr = omp_get_max_threads();
+  std::vector<unsigned> thread_node(num_thr, 0);
+#pragma omp parallel
+  {
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0)
+      thread_node[omp_get_thread_num()] = node;
+  }
+  // accesses are close to uniformly random over the array (hash probes), so
+  // the remote fraction for a thread is the fraction of pages off its node
+  double remote_ratio = 0.0;
+  for (int tid = 0; tid < num_thr; tid++)
+    remote_ratio +=
+        1.0 - (double)pages_on_node[thread_node[tid]] / num_present;
+  remote_ratio /= num_thr;
+
+  std::cout << "NUMA placement of " << label << ":";
+  for (int n : nodes)
+    std::cout << " node" << n << " " << std::fixed << std::setprecision(1)
+              << 100.0 * pages_on_node[n] / num_present << "%";
+  std::cout << ", estimated remote access ratio " << std::setprecision(3)
+            << remote_ratio << "\n";
+  std::cout.unsetf(std::ios::fixed);
+}
+
+omp_lock_t *alloc_lock_array(const size_t n) {
+  if (n == 0) return NULL;
+  omp_lock_t *locks =
+      static_cast<omp_lock_t *>(alloc_pages(n * sizeof(omp_lock_t)));
+  if (numa_policy_global == NUMA_POLICY_FIRST_TOUCH) {
+    first_touch_for(n, [&](const int64_t j) { omp_init_lock(&locks[j]); });
+  } else {
+    for (size_t j = 0; j < n; j++) omp_init_lock(&locks[j]);
+  }
+  return locks;
+}
+
+void free_lock_array(omp_lock_t *locks, const size_t n) {
+  if (locks == NULL) return;
+  for (size_t j = 0; j < n; j++) omp_destroy_lock(&locks[j]);
+  free_pages(locks, n * sizeof(omp_lock_t));
+}
+
+}  // namespace spring
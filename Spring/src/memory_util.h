@@ -0,0 +1,184 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#ifndef SPRING_MEMORY_UTIL_H_
+#define SPRING_MEMORY_UTIL_H_
+
+#include <omp.h>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <type_traits>
+
+namespace spring {
+
+// NUMA placement policies for the large working arrays of reorder and encoder
+// none: default kernel policy (pages land on the node of the first toucher)
+// interleave: pages spread round-robin over all nodes
+// first-touch: arrays initialized in parallel so that each thread touches
+// (and hence places) the chunk it processes in the static partitions
+const int NUMA_POLICY_NONE = 0;
+const int NUMA_POLICY_INTERLEAVE = 1;
+const int NUMA_POLICY_FIRST_TOUCH = 2;
+
+// large page backing for the arrays allocated with alloc_pages
+// none: regular 4 KB pages
+// thp: transparent huge pages requested with madvise(MADV_HUGEPAGE)
+// hugetlb: explicit huge pages (MAP_HUGETLB) from the hugetlbfs pool,
+// falling back to thp when the pool is exhausted
+const int HUGE_PAGES_NONE = 0;
+const int HUGE_PAGES_THP = 1;
+const int HUGE_PAGES_HUGETLB = 2;
+// smaller allocations always use regular pages
+const size_t HUGE_PAGES_MIN_BYTES = 2 * 1024 * 1024;
+
+int parse_numa_policy(const std::string &policy);
+
+int parse_huge_pages(const std::string &mode);
+
+// max_memory: soft limit in bytes on the resident memory (0 for no limit)
+void init_memory_policy(const int numa_policy, const int huge_pages,
+                        const uint64_t max_memory);
+
+int get_numa_policy();
+
+int get_huge_pages();
+
+uint64_t get_memory_limit();
+
+// current resident set size of the process in bytes
+uint64_t current_rss();
+
+// true if allocating bytes more keeps the process within the memory limit
+bool fits_in_memory(const uint64_t bytes);
+
+// number of items of bytes_per_item bytes each, clamped to
+// [min_items, max_items], that fit in what is left of the memory limit
+// (max_items when there is no limit). Stages size their blocks, bins and
+// buffers with it.
+uint64_t items_within_budget(const uint64_t bytes_per_item,
+                             const uint64_t min_items,
+                             const uint64_t max_items);
+
+// peak resident set size of the process in bytes
+uint64_t peak_rss();
+
+// allocate page aligned, untouched memory with the NUMA and huge page policy
+// applied. Must be freed with free_pages with the same size.
+void *alloc_pages(const size_t bytes);
+
+void free_pages(void *ptr, const size_t bytes);
+
+// print the distribution of pages of [ptr, ptr+bytes) over NUMA nodes along
+// with the estimated fraction of uniformly random accesses from the
+// current team of threads that go to a remote node
+void numa_report(const std::string &label, const void *ptr,
+                 const size_t bytes);
+
+// calls f(i) for all i in [0, n) the way the first-touch policy places
+// pages: on a static partition over a new team, or as tasks of the enclosing
+// team when called inside a parallel region (a nested team would only have
+// the calling thread, e.g. in the stream tasks of compress_segment())
+template <class F>
+void first_touch_for(const size_t n, const F &f) {
+  if (omp_in_parallel()) {
+#pragma omp taskloop default(shared)
+    for (int64_t i = 0; i < (int64_t)n; i++) f(i);
+  } else {
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < (int64_t)n; i++) f(i);
+  }
+}
+
+// allocate array of n value-initialized elements. With the first-touch
+// policy, the initialization is done by the threads (see first_touch_for).
+// Otherwise the zero pages of alloc_pages are left untouched for trivial
+// types, for which they already are the value-initialized state.
+template <typename T>
+T *alloc_array(const size_t n) {
+  if (n == 0) return NULL;
+  T *arr = static_cast<T *>(alloc_pages(n * sizeof(T)));
+  if (get_numa_policy() == NUMA_POLICY_FIRST_TOUCH) {
+    first_touch_for(n, [&](const int64_t i) { new (arr + i) T(); });
+  } else if (!std::is_trivially_default_constructible<T>::value) {
+    for (size_t i = 0; i < n; i++) new (arr + i) T();
+  }
+  return arr;
+}
+
+template <typename T>
+void free_array(T *arr, const size_t n) {
+  if (arr == NULL) return;
+  for (size_t i = 0; i < n; i++) arr[i].~T();
+  free_pages(arr, n * sizeof(T));
+}
+
+// Out-of-core storage for the packed reads of reorder and encoder: arrays
+// allocated with alloc_mapped_array are backed by (already unlinked) files in
+// dir instead of anonymous memory, so their pages can be written back and
+// evicted under memory pressure rather than running out of memory. This is
+// done for every such array when force is set, otherwise only for arrays that
+// do not fit under the memory limit. An empty dir disables it.
+void init_out_of_core(const std::string &dir, const bool force);
+
+// true if an array of the given size would be file backed
+bool use_out_of_core(const uint64_t bytes);
+
+// zero-filled, file backed pages, freed with free_pages like alloc_pages
+void *alloc_mapped_pages(const size_t bytes);
+
+// true if ptr was returned by alloc_mapped_pages (and not freed yet)
+bool is_mapped(const void *ptr);
+
+// when the resident set is over the memory limit, drop the resident pages of
+// all file backed arrays (their contents stay in the files and are paged in
+// again on access). Cheap enough to call every few million operations.
+void trim_mapped_pages();
+
+// like alloc_array, but file backed when use_out_of_core says so. Only for
+// types for which all zero bytes is the value-initialized state.
+template <typename T>
+T *alloc_mapped_array(const size_t n) {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "mapped arrays hold plain data");
+  if (n == 0 || !use_out_of_core(n * sizeof(T))) return alloc_array<T>(n);
+  return static_cast<T *>(alloc_mapped_pages(n * sizeof(T)));
+}
+
+// arrays of omp locks (omp_init_lock touches every lock)
+omp_lock_t *alloc_lock_array(const size_t n);
+
+void free_lock_array(omp_lock_t *locks, const size_t n);
+
+// omp_test_lock, omp_set_lock and omp_unset_lock on locks[i]. No lock array
+// (NULL) is used for data that only one thread accesses, the test then
+// always succeeds.
+inline bool test_lock(omp_lock_t *locks, const uint64_t i) {
+  return locks == NULL || omp_test_lock(&locks[i]);
+}
+
+inline void set_lock(omp_lock_t *locks, const uint64_t i) {
+  if (locks != NULL) omp_set_lock(&locks[i]);
+}
+
+inline void unset_lock(omp_lock_t *locks, const uint64_t i) {
+  if (locks != NULL) omp_unset_lock(&locks[i]);
+}
+
+}  // namespace spring
+
+#endif  // SPRING_MEMORY_UTIL_H_
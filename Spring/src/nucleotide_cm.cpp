@@ -0,0 +1,776 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#include "nucleotide_cm.h"
+#include <omp.h>
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include "params.h"
+
+namespace spring {
+
+bool parse_seq_codec(const std::string &codec) {
+  if (codec == "zpaq") return false;
+  if (codec == "cm") return true;
+  throw std::runtime_error("Invalid sequence codec: " + codec);
+}
+
+// orders of the context models, up to CM_MAX_DIRECT_ORDER the context indexes
+// the table directly, above it is hashed into 2^CM_HASH_BITS slots (in
+// buckets of the 4 contexts that differ only in the last base)
+static const int cm_orders[] = {1, 2, 3, 4, 6, 8, 11, 12, 16, 24};
+const int CM_NUM_MODELS = sizeof(cm_orders) / sizeof(cm_orders[0]);
+const int CM_MAX_DIRECT_ORDER = 8;
+// adaptation rate (shift) of the model counters, fast for the sparse high
+// orders and slow for the dense low ones
+static const int cm_rates[] = {7, 7, 6, 6, 5, 5, 4, 4, 3, 3};
+const int CM_MATCH_MIN = 24;  // bases hashed to look up a match
+// a match is dropped after more misses among its last 16 predictions
+const int CM_MATCH_MAX_MISSES = 8;
+// inputs of the mixer: models, forward and reverse complement match, bias
+const int CM_NUM_INPUTS = CM_NUM_MODELS + 3;
+const int CM_MIXER_RATE = 6;
+
+// logistic function and its inverse on 12 bit probabilities, the stretched
+// domain is scaled by 256 and clipped to +-2047
+static int squash(int d) {
+  static const int t[33] = {1,    2,    3,    6,    10,   16,   27,
+                            45,   73,   120,  194,  310,  488,  747,
+                            1101, 1546, 2047, 2549, 2994, 3348, 3607,
+                            3785, 3901, 3975, 4024, 4050, 4068, 4079,
+                            4085, 4089, 4092, 4093, 4094};
+  if (d > 2047) return 4095;
+  if (d < -2047) return 1;
+  int w = d & 127;
+  d = (d >> 7) + 16;
+  return (t[d] * (128 - w) + t[d + 1] * w + 64) >> 7;
+}
+
+static int stretch(int p) {
+  static const std::vector<int16_t> t = [] {
+    std::vector<int16_t> table(4096);
+    int pi = 0;
+    for (int x = -2047; x <= 2047; x++) {
+      int v = squash(x);
+      for (int i = pi; i <= v; i++) table[i] = x;
+      pi = v + 1;
+    }
+    for (int i = pi; i < 4096; i++) table[i] = 2047;
+    return table;
+  }();
+  return t[p];
+}
+
+namespace {
+
+// adaptive probability map: refines a probability in a small context by
+// interpolating between 24 buckets over its stretched value
+class apm {
+ public:
+  explicit apm(const int n) : t(n * 24) {
+    for (int i = 0; i < n; i++)
+      for (int j = 0; j < 24; j++)
+        t[i * 24 + j] = squash((j * 4096) / 23 - 2048) * 16;
+  }
+  void reset() { *this = apm(t.size() / 24); }
+  int p(const int pr, const int cx) {
+    int s = (stretch(pr) + 2048) * 23;
+    int wt = s & 0xfff;
+    int base = cx * 24 + (s >> 12);
+    index = base + (wt >> 11);
+    return (t[base] * (4096 - wt) + t[base + 1] * wt) >> 16;
+  }
+  void update(const int bit) {
+    int g = (bit << 16) + (bit << 7) - bit - bit;
+    t[index] += (g - t[index]) >> 7;
+  }
+
+ private:
+  std::vector<int> t;
+  int index = 0;
+};
+
+// binary arithmetic coder on 12 bit probabilities of a 1
+class arithmetic_coder {
+ public:
+  void start_encode(std::vector<uint8_t> *out) {
+    x1 = 0;
+    x2 = 0xffffffff;
+    enc_out = out;
+  }
+  void encode(const int bit, const int p) {
+    uint32_t xmid = x1 + ((x2 - x1) >> 12) * p;
+    bit ? (x2 = xmid) : (x1 = xmid + 1);
+    while (((x1 ^ x2) & 0xff000000) == 0) {
+      enc_out->push_back(x2 >> 24);
+      x1 <<= 8;
+      x2 = (x2 << 8) | 255;
+    }
+  }
+  void flush() {
+    for (int i = 0; i < 4; i++) {
+      enc_out->push_back(x1 >> 24);
+      x1 <<= 8;
+    }
+  }
+  void start_decode(const uint8_t *in, const size_t len) {
+    x1 = 0;
+    x2 = 0xffffffff;
+    dec_in = in;
+    dec_end = in + len;
+    x = 0;
+    for (int i = 0; i < 4; i++) x = (x << 8) | next_byte();
+  }
+  int decode(const int p) {
+    uint32_t xmid = x1 + ((x2 - x1) >> 12) * p;
+    int bit = x <= xmid;
+    bit ? (x2 = xmid) : (x1 = xmid + 1);
+    while (((x1 ^ x2) & 0xff000000) == 0) {
+      x1 <<= 8;
+      x2 = (x2 << 8) | 255;
+      x = (x << 8) | next_byte();
+    }
+    return bit;
+  }
+
+ private:
+  int next_byte() { return dec_in < dec_end ? *dec_in++ : 0; }
+  uint32_t x1 = 0, x2 = 0xffffffff, x = 0;
+  std::vector<uint8_t> *enc_out = NULL;
+  const uint8_t *dec_in = NULL, *dec_end = NULL;
+};
+
+// earlier occurrence of the last CM_MATCH_MIN bases, followed forward, or
+// backward on the reverse complement strand, across isolated mismatches
+struct match_state {
+  bool active = false;
+  bool rc = false;
+  uint32_t ptr = 0;     // position of the base giving the prediction
+  uint32_t len = 0;     // bases predicted right since the match or last miss
+  uint32_t misses = 0;  // 1 bit per recent prediction, 1 for a miss
+  int predicted(const uint8_t *bases) const {
+    return rc ? 3 - bases[ptr] : bases[ptr];
+  }
+};
+
+// model of a chunk of bases (coded 0-3 for A, C, G, T). A base is coded as
+// its high bit (node 0) and then its low bit (node 1 + high bit).
+class cm_model {
+ public:
+  cm_model() : sse(16 * 3) {
+    for (int m = 0; m < CM_NUM_MODELS; m++) {
+      // direct: per slot the counters of the 3 nodes (and one unused),
+      // hashed: per bucket the counters of 4 slots, a check and padding
+      if (cm_orders[m] <= CM_MAX_DIRECT_ORDER)
+        tables[m].resize(4ULL << (2 * cm_orders[m]));
+      else
+        tables[m].resize(4ULL << CM_HASH_BITS);
+    }
+    match_table.resize(1ULL << CM_MATCH_BITS);
+    match[1].rc = true;
+  }
+
+  void encode(const uint8_t *bases, const uint32_t len,
+              std::vector<uint8_t> &out) {
+    reset();
+    coder.start_encode(&out);
+    for (uint32_t i = 0; i < len; i++) {
+      set_contexts();
+      int high = bases[i] >> 1, low = bases[i] & 1;
+      coder.encode(high, predict(0, bases));
+      update(0, high);
+      coder.encode(low, predict(1 + high, bases));
+      update(1 + high, low);
+      next_base(bases, i);
+    }
+    coder.flush();
+  }
+
+  void decode(const uint8_t *in, const size_t in_len, const uint32_t len,
+              uint8_t *bases) {
+    reset();
+    coder.start_decode(in, in_len);
+    for (uint32_t i = 0; i < len; i++) {
+      set_contexts();
+      int high = coder.decode(predict(0, bases));
+      update(0, high);
+      int low = coder.decode(predict(1 + high, bases));
+      update(1 + high, low);
+      bases[i] = 2 * high + low;
+      next_base(bases, i);
+    }
+  }
+
+ private:
+  void reset() {
+    for (int m = 0; m < CM_NUM_MODELS; m++)
+      std::fill(tables[m].begin(), tables[m].end(), 32768);
+    std::fill(match_table.begin(), match_table.end(), 0);
+    for (int j = 0; j < 2; j++) {
+      std::fill(match_counter[j], match_counter[j] + 128, 1 << 15);
+      match[j].active = false;
+    }
+    std::fill(weights, weights + 12 * CM_NUM_INPUTS, 1 << 14);
+    sse.reset();
+    history = rc_history = 0;
+    hash_buckets(bucket, bucket_check);
+    hash_buckets(next_bucket, next_check);
+  }
+
+  // bucket of every hashed model for the base after the next one: its key is
+  // the context without the last base, which is known a base ahead, so the
+  // bucket is prefetched while the next base is coded
+  void hash_buckets(uint16_t **b, uint16_t *check) {
+    for (int m = 0; m < CM_NUM_MODELS; m++) {
+      int k = cm_orders[m];
+      if (k <= CM_MAX_DIRECT_ORDER) continue;
+      uint64_t ctx = history & ((1ULL << (2 * (k - 1))) - 1);
+      uint64_t h = (ctx + k) * 0x9E3779B97F4A7C15ULL;
+      check[m] = (h >> 16) & 0xffff;
+      b[m] = &tables[m][16 * (h >> (64 - CM_HASH_BITS + 2))];
+      __builtin_prefetch(b[m]);
+    }
+  }
+
+  // slot of the current context in every model
+  void set_contexts() {
+    for (int m = 0; m < CM_NUM_MODELS; m++) {
+      int k = cm_orders[m];
+      if (k <= CM_MAX_DIRECT_ORDER) {
+        slot[m] = &tables[m][4 * (history & ((1ULL << (2 * k)) - 1))];
+      } else {
+        uint16_t *b = bucket[m];
+        if (b[12] != bucket_check[m]) {
+          std::fill(b, b + 12, 32768);
+          b[12] = bucket_check[m];
+        }
+        slot[m] = b + 3 * (history & 3);
+      }
+    }
+  }
+
+  int predict(const int node, const uint8_t *bases) {
+    for (int m = 0; m < CM_NUM_MODELS; m++)
+      inputs[m] = stretch(slot[m][node] >> 4);
+    // a match predicts the base of the earlier occurrence, for the low bit
+    // only if the high bit agreed
+    uint32_t longest = 0;
+    for (int j = 0; j < 2; j++) {
+      match_bit[j] = -1;
+      inputs[CM_NUM_MODELS + j] = 0;
+      if (!match[j].active) continue;
+      int predicted = match[j].predicted(bases);
+      if (node != 0 && node - 1 != (predicted >> 1)) continue;
+      match_bit[j] = node == 0 ? predicted >> 1 : predicted & 1;
+      match_index[j] = 8 * std::min(match[j].len, 15U) +
+                       2 * std::min(__builtin_popcount(match[j].misses), 3) +
+                       (node != 0);
+      int st = stretch(match_counter[j][match_index[j]] >> 4);
+      inputs[CM_NUM_MODELS + j] = match_bit[j] ? st : -st;
+      longest = std::max(longest, match[j].len + 1);
+    }
+    inputs[CM_NUM_MODELS + 2] = 256;
+    int match_bucket = longest == 0 ? 0 : (longest < 16 ? 1 : (longest < 32 ? 2 : 3));
+    w = &weights[(node * 4 + match_bucket) * CM_NUM_INPUTS];
+    int64_t dot = 0;
+    for (int i = 0; i < CM_NUM_INPUTS; i++) dot += (int64_t)inputs[i] * w[i];
+    pr_mix = squash(std::max<int64_t>(-2047, std::min<int64_t>(2047, dot >> 16)));
+    int pr = (pr_mix + 3 * sse.p(pr_mix, (history & 15) * 3 + node)) >> 2;
+    return std::max(1, std::min(4095, pr));
+  }
+
+  void update(const int node, const int bit) {
+    int err = ((bit << 12) - pr_mix) * CM_MIXER_RATE;
+    for (int i = 0; i < CM_NUM_INPUTS; i++) w[i] += (inputs[i] * err) >> 14;
+    for (int m = 0; m < CM_NUM_MODELS; m++) {
+      uint16_t &p = slot[m][node];
+      if (bit)
+        p += (65535 - p) >> cm_rates[m];
+      else
+        p -= p >> cm_rates[m];
+    }
+    for (int j = 0; j < 2; j++) {
+      if (match_bit[j] < 0) continue;
+      uint16_t &p = match_counter[j][match_index[j]];
+      if (bit == match_bit[j])
+        p += (65535 - p) >> 5;
+      else
+        p -= p >> 5;
+    }
+    sse.update(bit);
+  }
+
+  // after base i: extend the histories and the matches, and look up new
+  // matches by the hash of the last CM_MATCH_MIN bases (and of their reverse
+  // complement) while there is none or the current one just missed. The
+  // lookup is a base late so that the table entries are prefetched.
+  void next_base(const uint8_t *bases, const uint32_t i) {
+    history = (history << 2) | bases[i];
+    rc_history = (rc_history >> 2) |
+                 ((uint64_t)(3 - bases[i]) << (2 * (CM_MATCH_MIN - 1)));
+    std::copy(next_bucket, next_bucket + CM_NUM_MODELS, bucket);
+    std::copy(next_check, next_check + CM_NUM_MODELS, bucket_check);
+    hash_buckets(next_bucket, next_check);
+    for (int j = 0; j < 2; j++) {
+      match_state &m = match[j];
+      if (!m.active) continue;
+      bool hit = m.predicted(bases) == bases[i];
+      m.len = hit ? m.len + 1 : 0;
+      m.misses = ((m.misses << 1) | !hit) & 0xffff;
+      if (__builtin_popcount(m.misses) > CM_MATCH_MAX_MISSES ||
+          (m.rc && m.ptr == 0))
+        m.active = false;
+      else
+        m.rc ? m.ptr-- : m.ptr++;
+    }
+    const uint32_t min = CM_MATCH_MIN;
+    // the table keeps no check, the hashed bases (ending at i - 1) are
+    // compared instead, and base i is compared with the one following them
+    if (i >= min) {
+      if (!match[1].active || match[1].len < min) {
+        // the bases are the reverse complement of the ones ending at
+        // entry - 1, base i pairs with the base before them
+        uint32_t entry = match_table[rc_hash];
+        if (entry > min + 1 && bases[i] == 3 - bases[entry - min - 1]) {
+          uint32_t len = 0;
+          while (len < min && bases[i - 1 - len] == 3 - bases[entry - min + len])
+            len++;
+          if (len == min) match[1] = {true, true, entry - min - 2, len, 0};
+        }
+      }
+      uint32_t &entry = match_table[fwd_hash];
+      if ((!match[0].active || match[0].len < min) && entry > 0 &&
+          bases[entry] == bases[i]) {
+        uint32_t len = 0;
+        while (len < min && bases[entry - 1 - len] == bases[i - 1 - len]) len++;
+        if (len == min) match[0] = {true, false, entry + 1, len, 0};
+      }
+      entry = i;
+    }
+    if (i + 1 >= min) {
+      const uint64_t mask = (1ULL << (2 * CM_MATCH_MIN)) - 1;
+      fwd_hash = ((history & mask) * 0x9E3779B97F4A7C15ULL) >> (64 - CM_MATCH_BITS);
+      rc_hash = ((rc_history & mask) * 0x9E3779B97F4A7C15ULL) >> (64 - CM_MATCH_BITS);
+      __builtin_prefetch(&match_table[fwd_hash]);
+      __builtin_prefetch(&match_table[rc_hash]);
+    }
+  }
+
+  std::vector<uint16_t> tables[CM_NUM_MODELS];
+  uint16_t *slot[CM_NUM_MODELS];
+  // buckets of the hashed models for this and the next base
+  uint16_t *bucket[CM_NUM_MODELS], *next_bucket[CM_NUM_MODELS];
+  uint16_t bucket_check[CM_NUM_MODELS], next_check[CM_NUM_MODELS];
+  // position following the last occurrence of each hashed CM_MATCH_MIN-mer
+  std::vector<uint32_t> match_table;
+  match_state match[2];  // forward and reverse complement
+  uint64_t fwd_hash = 0, rc_hash = 0;  // of the bases ending at the last one
+  // probability that the match is right by its length and recent misses
+  uint16_t match_counter[2][128];
+  int match_bit[2], match_index[2];
+  // mixer weights (scaled by 2^16), a set per node and match length bucket
+  int weights[12 * CM_NUM_INPUTS];
+  int *w = weights;
+  int inputs[CM_NUM_INPUTS];
+  int pr_mix = 2048;
+  apm sse;
+  uint64_t history = 0, rc_history = 0;
+  arithmetic_coder coder;
+};
+
+// deep mode (--deep): weights of deep_model in Q16 fixed point
+struct deep_weights {
+  // a row of DEEP_HIDDEN per context position and base
+  std::vector<int32_t> embedding;
+  std::vector<int32_t> bias;    // DEEP_HIDDEN
+  std::vector<int32_t> output;  // a row of DEEP_HIDDEN per node
+  uint64_t hash() const {
+    uint64_t h = 0;
+    for (const std::vector<int32_t> *v : {&embedding, &bias, &output})
+      for (int32_t x : *v) h = (h + (uint32_t)x) * 0x9E3779B97F4A7C15ULL;
+    return h;
+  }
+};
+
+const char DEEP_WEIGHTS_MAGIC[8] = {'S', 'T', 'A', 'Q', 'D', 'E', 'E', 'P'};
+
+// weights every chunk starts from: seeded random embeddings (std::mt19937 is
+// the same everywhere) or the ones loaded by set_deep_weights
+deep_weights &initial_deep_weights() {
+  static deep_weights w = [] {
+    deep_weights init;
+    std::mt19937 gen(0);
+    init.embedding.resize(DEEP_CONTEXT * 4 * DEEP_HIDDEN);
+    for (int32_t &x : init.embedding) x = (int32_t)(gen() % 4097) - 2048;
+    init.bias.assign(DEEP_HIDDEN, 1 << 15);
+    init.output.assign(3 * DEEP_HIDDEN, 0);
+    return init;
+  }();
+  return w;
+}
+
+void write_deep_weights(const std::string &file, const deep_weights &w) {
+  std::ofstream fout(file, std::ios::binary);
+  const int32_t dims[2] = {DEEP_CONTEXT, DEEP_HIDDEN};
+  fout.write(DEEP_WEIGHTS_MAGIC, sizeof(DEEP_WEIGHTS_MAGIC));
+  fout.write((char *)dims, sizeof(dims));
+  for (const std::vector<int32_t> *v : {&w.embedding, &w.bias, &w.output})
+    fout.write((char *)v->data(), v->size() * sizeof(int32_t));
+  if (!fout) throw std::runtime_error("Error writing deep model weights: " + file);
+}
+
+// a network over the last DEEP_CONTEXT bases: an embedding of every position
+// and base, summed into DEEP_HIDDEN units clipped to [0, 1], and a logistic
+// output per node, refined by SSE as in cm_model. It is trained online by
+// backpropagation. The chunk is split into DEEP_NUM_STREAMS streams coded in
+// lockstep: a step runs the network on the next base of every stream as one
+// batch, codes the bases and then applies the summed updates. All arithmetic
+// is on integers so that the decoder follows on any CPU.
+class deep_model {
+ public:
+  deep_model() : sse(16 * 3) {}
+
+  void encode(const uint8_t *bases, const uint32_t len,
+              std::vector<uint8_t> &out) {
+    run(bases, NULL, len, &out, NULL, 0);
+  }
+
+  void decode(const uint8_t *in, const size_t in_len, const uint32_t len,
+              uint8_t *bases) {
+    run(bases, bases, len, NULL, in, in_len);
+  }
+
+  const deep_weights &weights() const { return w; }
+
+ private:
+  // coded chunk: hash of the initial weights (checked by
+  // deep_decompress_bases), coded size of every stream and the coded streams.
+  // Decoding writes the bases to decoded (== bases).
+  void run(const uint8_t *bases, uint8_t *decoded, const uint32_t len,
+           std::vector<uint8_t> *out, const uint8_t *in, const size_t in_len) {
+    const int S = DEEP_NUM_STREAMS, H = DEEP_HIDDEN;
+    w = initial_deep_weights();
+    sse.reset();
+    uint64_t start[S + 1], history[S], context[S];
+    for (int s = 0; s <= S; s++) start[s] = (uint64_t)len * s / S;
+    std::fill(history, history + S, 0);
+    const size_t header = sizeof(uint64_t) + S * sizeof(uint32_t);
+    if (decoded) {
+      // (runs in a parallel region, a corrupted chunk decodes to garbage
+      // rather than throwing)
+      uint32_t num_bytes[S] = {};
+      if (in_len >= header)
+        std::memcpy(num_bytes, in + sizeof(uint64_t), sizeof(num_bytes));
+      size_t offset = std::min(header, in_len);
+      for (int s = 0; s < S; s++) {
+        size_t n = std::min<size_t>(num_bytes[s], in_len - offset);
+        coder[s].start_decode(in + offset, n);
+        offset += n;
+      }
+    } else {
+      for (int s = 0; s < S; s++) {
+        coded[s].clear();
+        coder[s].start_encode(&coded[s]);
+      }
+    }
+    const uint32_t steps = (len + S - 1) / S;
+    for (uint32_t t = 0; t < steps; t++) {
+      int num_active = 0;
+      int active[S];
+      for (int s = 0; s < S; s++)
+        if (start[s] + t < start[s + 1]) active[num_active++] = s;
+      // forward pass of the batch
+      for (int k = 0; k < num_active; k++) {
+        int s = active[k];
+        context[s] = history[s];
+        int32_t *x = &hidden[k * H];
+        std::copy(w.bias.begin(), w.bias.end(), x);
+        for (int pos = 0; pos < DEEP_CONTEXT; pos++) {
+          const int32_t *row = embedding_row(pos, context[s]);
+          for (int j = 0; j < H; j++) x[j] += row[j];
+        }
+        int32_t *a = &activation[k * H];
+        for (int j = 0; j < H; j++) a[j] = std::max(0, std::min(255, x[j] >> 8));
+      }
+      // outputs and coding, the stream order keeps SSE deterministic
+      std::fill(output_grad, output_grad + 3 * H, 0);
+      for (int k = 0; k < num_active; k++) {
+        int s = active[k];
+        const int32_t *a = &activation[k * H];
+        int64_t *grad = &hidden_grad[k * H];
+        std::fill(grad, grad + H, 0);
+        int base = decoded ? 0 : bases[start[s] + t];
+        int high = 0, low = 0;
+        for (int d = 0; d < 2; d++) {
+          int node = d == 0 ? 0 : 1 + high;
+          const int32_t *row = &w.output[node * H];
+          int64_t dot = 0;
+          for (int j = 0; j < H; j++) dot += (int64_t)row[j] * a[j];
+          int pr_mix = squash((int)std::max<int64_t>(
+              -2047, std::min<int64_t>(2047, dot >> 16)));
+          int pr = (pr_mix + 3 * sse.p(pr_mix, (history[s] & 15) * 3 + node)) >> 2;
+          pr = std::max(1, std::min(4095, pr));
+          int bit;
+          if (decoded) {
+            bit = coder[s].decode(pr);
+          } else {
+            bit = d == 0 ? base >> 1 : base & 1;
+            coder[s].encode(bit, pr);
+          }
+          sse.update(bit);
+          int err = (bit << 12) - pr_mix;
+          for (int j = 0; j < H; j++) output_grad[node * H + j] += err * a[j];
+          for (int j = 0; j < H; j++) grad[j] += (int64_t)err * row[j];
+          (d == 0 ? high : low) = bit;
+        }
+        base = 2 * high + low;
+        if (decoded) decoded[start[s] + t] = base;
+        history[s] = (history[s] << 2) | base;
+      }
+      // summed updates of the batch
+      for (int j = 0; j < 3 * H; j++)
+        w.output[j] += output_grad[j] >> DEEP_OUTPUT_SHIFT;
+      for (int k = 0; k < num_active; k++) {
+        int s = active[k];
+        const int32_t *x = &hidden[k * H];
+        int32_t *delta = &hidden[k * H];
+        const int64_t *grad = &hidden_grad[k * H];
+        // the clipped units pass no gradient
+        for (int j = 0; j < H; j++)
+          delta[j] = (x[j] > 0 && x[j] < (255 << 8))
+                         ? (int32_t)(grad[j] >> DEEP_HIDDEN_SHIFT)
+                         : 0;
+        for (int j = 0; j < H; j++) w.bias[j] = clip(w.bias[j] + delta[j]);
+        for (int pos = 0; pos < DEEP_CONTEXT; pos++) {
+          int32_t *row = embedding_row(pos, context[s]);
+          for (int j = 0; j < H; j++) row[j] = clip(row[j] + delta[j]);
+        }
+      }
+    }
+    if (out) {
+      uint64_t hash = initial_deep_weights().hash();
+      out->insert(out->end(), (uint8_t *)&hash, (uint8_t *)(&hash + 1));
+      for (int s = 0; s < S; s++) {
+        coder[s].flush();
+        uint32_t num_bytes = coded[s].size();
+        out->insert(out->end(), (uint8_t *)&num_bytes,
+                    (uint8_t *)(&num_bytes + 1));
+      }
+      for (int s = 0; s < S; s++)
+        out->insert(out->end(), coded[s].begin(), coded[s].end());
+    }
+  }
+
+  int32_t *embedding_row(const int pos, const uint64_t context) {
+    return &w.embedding[(4 * pos + ((context >> (2 * pos)) & 3)) * DEEP_HIDDEN];
+  }
+
+  // bounds the weights so that the sums of a unit cannot overflow
+  static int32_t clip(const int32_t x) {
+    return std::max(-(1 << 24), std::min(1 << 24, x));
+  }
+
+  deep_weights w;
+  apm sse;
+  arithmetic_coder coder[DEEP_NUM_STREAMS];
+  std::vector<uint8_t> coded[DEEP_NUM_STREAMS];
+  // per stream of the batch: the hidden units before clipping (then their
+  // updates), after clipping and the gradient of the outputs wrt the units
+  int32_t hidden[DEEP_NUM_STREAMS * DEEP_HIDDEN];
+  int32_t activation[DEEP_NUM_STREAMS * DEEP_HIDDEN];
+  int64_t hidden_grad[DEEP_NUM_STREAMS * DEEP_HIDDEN];
+  int32_t output_grad[3 * DEEP_HIDDEN];
+};
+
+struct cm_chunk {
+  int file;
+  uint64_t offset;  // of the bases (compression) or coded bytes (decompression)
+  uint32_t num_bases;
+  uint32_t num_bytes;  // decompression only
+};
+
+// each file is a sequence of chunks of at most chunk_size bases: number of
+// bases, number of coded bytes and the coded bytes. A batch of num_thr chunks
+// is coded in parallel (a model per thread) and then appended to the files in
+// order. first_chunk (if set) is called with the model that coded the first
+// chunk.
+template <class model_t>
+std::vector<uint64_t> compress_chunks(
+    const std::vector<std::string> &infiles,
+    const std::vector<std::string> &outfiles, const int num_thr,
+    const uint32_t chunk_size,
+    const std::function<void(const model_t &)> &first_chunk) {
+  std::vector<uint64_t> num_bases(infiles.size());
+  std::vector<cm_chunk> chunks;
+  for (size_t f = 0; f < infiles.size(); f++) {
+    num_bases[f] = std::filesystem::file_size(infiles[f]);
+    for (uint64_t offset = 0; offset < num_bases[f]; offset += chunk_size)
+      chunks.push_back(
+          {(int)f, offset,
+           (uint32_t)std::min<uint64_t>(chunk_size, num_bases[f] - offset), 0});
+    std::ofstream fout(outfiles[f], std::ios::binary);  // empty without bases
+  }
+  std::vector<std::vector<uint8_t>> coded(num_thr);
+#pragma omp parallel num_threads(num_thr)
+  {
+    model_t model;
+    std::vector<uint8_t> bases(chunk_size);
+    for (size_t batch = 0; batch < chunks.size(); batch += num_thr) {
+      size_t batch_end = std::min(chunks.size(), batch + num_thr);
+#pragma omp for schedule(dynamic)
+      for (size_t c = batch; c < batch_end; c++) {
+        std::ifstream fin(infiles[chunks[c].file], std::ios::binary);
+        fin.seekg(chunks[c].offset);
+        fin.read((char *)bases.data(), chunks[c].num_bases);
+        // A, C, G, T -> 0, 1, 2, 3 (as in pack_bases)
+        for (uint32_t i = 0; i < chunks[c].num_bases; i++)
+          bases[i] = ((bases[i] >> 1) ^ (bases[i] >> 2)) & 3;
+        coded[c - batch].clear();
+        model.encode(bases.data(), chunks[c].num_bases, coded[c - batch]);
+        if (c == 0 && first_chunk) first_chunk(model);
+      }
+#pragma omp single
+      for (size_t c = batch; c < batch_end; c++) {
+        std::ofstream fout(outfiles[chunks[c].file],
+                           std::ios::binary | std::ios::app);
+        uint32_t num_bytes = coded[c - batch].size();
+        fout.write((char *)&chunks[c].num_bases, sizeof(uint32_t));
+        fout.write((char *)&num_bytes, sizeof(uint32_t));
+        fout.write((char *)coded[c - batch].data(), num_bytes);
+      }
+    }
+  }
+  return num_bases;
+}
+
+template <class model_t>
+void decompress_chunks(const std::vector<std::string> &infiles,
+                       const std::vector<std::string> &outfiles,
+                       const int num_thr) {
+  std::vector<cm_chunk> chunks;
+  for (size_t f = 0; f < infiles.size(); f++) {
+    uint64_t file_size = std::filesystem::file_size(infiles[f]);
+    std::ifstream fin(infiles[f], std::ios::binary);
+    cm_chunk chunk = {(int)f, 0, 0, 0};
+    while (chunk.offset < file_size) {
+      fin.read((char *)&chunk.num_bases, sizeof(uint32_t));
+      fin.read((char *)&chunk.num_bytes, sizeof(uint32_t));
+      if (!fin) throw std::runtime_error("Corrupted sequence stream.");
+      chunk.offset += 2 * sizeof(uint32_t);
+      chunks.push_back(chunk);
+      chunk.offset += chunk.num_bytes;
+      fin.seekg(chunk.offset);
+    }
+    std::ofstream fout(outfiles[f], std::ios::binary);
+  }
+  std::vector<std::vector<char>> decoded(num_thr);
+#pragma omp parallel num_threads(num_thr)
+  {
+    model_t model;
+    std::vector<uint8_t> coded;
+    const char inttobase[4] = {'A', 'C', 'G', 'T'};
+    for (size_t batch = 0; batch < chunks.size(); batch += num_thr) {
+      size_t batch_end = std::min(chunks.size(), batch + num_thr);
+#pragma omp for schedule(dynamic)
+      for (size_t c = batch; c < batch_end; c++) {
+        std::ifstream fin(infiles[chunks[c].file], std::ios::binary);
+        fin.seekg(chunks[c].offset);
+        coded.resize(chunks[c].num_bytes);
+        fin.read((char *)coded.data(), chunks[c].num_bytes);
+        std::vector<char> &bases = decoded[c - batch];
+        bases.resize(chunks[c].num_bases);
+        model.decode(coded.data(), coded.size(), chunks[c].num_bases,
+                     (uint8_t *)bases.data());
+        for (char &b : bases) b = inttobase[(int)b];
+      }
+#pragma omp single
+      for (size_t c = batch; c < batch_end; c++) {
+        std::ofstream fout(outfiles[chunks[c].file],
+                           std::ios::binary | std::ios::app);
+        fout.write(decoded[c - batch].data(), chunks[c].num_bases);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+std::vector<uint64_t> cm_compress_bases(const std::vector<std::string> &infiles,
+                                        const std::vector<std::string> &outfiles,
+                                        const int num_thr) {
+  return compress_chunks<cm_model>(infiles, outfiles, num_thr, CM_CHUNK_SIZE,
+                                   nullptr);
+}
+
+void cm_decompress_bases(const std::vector<std::string> &infiles,
+                         const std::vector<std::string> &outfiles,
+                         const int num_thr) {
+  decompress_chunks<cm_model>(infiles, outfiles, num_thr);
+}
+
+void set_deep_weights(const std::string &file) {
+  std::ifstream fin(file, std::ios::binary);
+  char magic[sizeof(DEEP_WEIGHTS_MAGIC)];
+  int32_t dims[2];
+  fin.read(magic, sizeof(magic));
+  fin.read((char *)dims, sizeof(dims));
+  if (!fin || !std::equal(magic, magic + sizeof(magic), DEEP_WEIGHTS_MAGIC) ||
+      dims[0] != DEEP_CONTEXT || dims[1] != DEEP_HIDDEN)
+    throw std::runtime_error("Invalid deep model weights file: " + file);
+  deep_weights &w = initial_deep_weights();
+  for (std::vector<int32_t> *v : {&w.embedding, &w.bias, &w.output})
+    fin.read((char *)v->data(), v->size() * sizeof(int32_t));
+  if (!fin) throw std::runtime_error("Invalid deep model weights file: " + file);
+}
+
+std::vector<uint64_t> deep_compress_bases(
+    const std::vector<std::string> &infiles,
+    const std::vector<std::string> &outfiles, const int num_thr,
+    const std::string &save_weights) {
+  deep_weights trained;
+  std::vector<uint64_t> num_bases = compress_chunks<deep_model>(
+      infiles, outfiles, num_thr, DEEP_CHUNK_SIZE,
+      [&](const deep_model &model) { trained = model.weights(); });
+  if (!save_weights.empty()) {
+    if (trained.embedding.empty()) trained = initial_deep_weights();
+    write_deep_weights(save_weights, trained);
+  }
+  return num_bases;
+}
+
+void deep_decompress_bases(const std::vector<std::string> &infiles,
+                           const std::vector<std::string> &outfiles,
+                           const int num_thr) {
+  // every chunk starts with the hash of the initial weights
+  for (const std::string &infile : infiles) {
+    std::ifstream fin(infile, std::ios::binary);
+    uint64_t hash;
+    fin.seekg(2 * sizeof(uint32_t));
+    if (fin.read((char *)&hash, sizeof(uint64_t)) &&
+        hash != initial_deep_weights().hash())
+      throw std::runtime_error(
+          "The deep model weights differ from the ones used for compression "
+          "(see --deep-weights).");
+  }
+  decompress_chunks<deep_model>(infiles, outfiles, num_thr);
+}
+
+}  // namespace spring
@@ -0,0 +1,73 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#ifndef SPRING_NUCLEOTIDE_CM_H_
+#define SPRING_NUCLEOTIDE_CM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace spring {
+
+// Context mixing codec for the contig consensus (read_seq.bin), an
+// alternative to zpaq (--seq-codec cm). Every base is coded as two binary
+// decisions predicted by direct and hashed order-k models over the previous
+// bases (k = 1..24) and a match model for long repeats, mixed by a gated
+// logistic mixer, refined by an SSE stage and arithmetic coded.
+// The bases are coded in chunks of CM_CHUNK_SIZE with a fresh model each, so
+// that the chunks of all files are coded in parallel (and the output does not
+// depend on the number of threads).
+
+// --seq-codec: "zpaq" (default) or "cm", returns true for cm and throws for
+// other values
+bool parse_seq_codec(const std::string &codec);
+
+// code the base files infiles[i] (A, C, G, T only) to outfiles[i], returns
+// the number of bases of each file
+std::vector<uint64_t> cm_compress_bases(const std::vector<std::string> &infiles,
+                                        const std::vector<std::string> &outfiles,
+                                        const int num_thr);
+
+// inverse of cm_compress_bases
+void cm_decompress_bases(const std::vector<std::string> &infiles,
+                         const std::vector<std::string> &outfiles,
+                         const int num_thr);
+
+// Deep mode (--deep): the same chunked layout coded with a neural network
+// trained online on the bases (see deep_model), on the CPU with integer
+// arithmetic. Every chunk starts from the same initial weights, seeded ones
+// unless set_deep_weights loaded others (the decoder checks that they match).
+
+// load initial weights written with --deep-save-weights, throws if the file
+// does not fit the network
+void set_deep_weights(const std::string &file);
+
+// as cm_compress_bases, and if save_weights is not empty writes there the
+// weights trained on the first chunk
+std::vector<uint64_t> deep_compress_bases(
+    const std::vector<std::string> &infiles,
+    const std::vector<std::string> &outfiles, const int num_thr,
+    const std::string &save_weights);
+
+// inverse of deep_compress_bases
+void deep_decompress_bases(const std::vector<std::string> &infiles,
+                           const std::vector<std::string> &outfiles,
+                           const int num_thr);
+
+}  // namespace spring
+
+#endif  // SPRING_NUCLEOTIDE_CM_H_
@@ -15,11 +15,16 @@ limitations under the License.
 #ifndef SPRING_PARAMS_H_
 #define SPRING_PARAMS_H_
 
+#include <cstdint>
 #include <string>
 
 namespace spring {
 
-const uint16_t MAX_READ_LEN = 511;
+// version of the archive format, stored in cp.bin: 0 is the format of before
+// it was stored (read_seq.bin parts with a separate tail file), 1 packs the
+// tail into the read_seq.bin parts. Decompression rejects higher versions.
+const uint8_t ARCHIVE_FORMAT_VERSION = 1;
+const uint16_t MAX_READ_LEN = 1023;
 const uint32_t MAX_READ_LEN_LONG = 4294967290;
 const uint32_t MAX_NUM_READS = 4294967290;
 const int NUM_DICT_REORDER = 2;
@@ -29,12 +34,65 @@ const int NUM_LOCKS_REORDER =
     0x1000000;  // limits on number of locks (power of 2 for fast mod)
 const float STOP_CRITERIA_REORDER = 0.5;
 // fraction of unmatched reads in last 1M for thread to give up on searching
+const int MAX_DICT_LEN_REORDER = 32;  // bases in a dictionary key (64 bit key)
+// number of reads used for each reorder autotuning trial
+const uint32_t AUTOTUNE_SAMPLE_REORDER = 200000;
+// configs with match rate within this of the best one compete on throughput
+const double AUTOTUNE_MATCH_TOL_REORDER = 0.005;
+// number of shifts whose dictionary lookups are issued (and prefetched)
+// together during the reorder search
+const int SEARCH_BATCH_REORDER = 4;
+// candidates ahead that are prefetched while scanning a dictionary bin
+const int PREFETCH_DIST_REORDER = 4;
 const int NUM_DICT_ENCODER = 2;
 const int MAX_SEARCH_ENCODER = 1000;
 const int THRESH_ENCODER = 24;
+// --deterministic: reads per part of reorder and the encoder and most parts
+// (each part then has dictionaries of its own)
+const uint32_t DETERMINISTIC_PART_READS = 1 << 24;
+const int DETERMINISTIC_MAX_PARTS = 64;
+// minimizers of the consensus used to place singletons (--singleton-index)
+const int K_SINGLETON_INDEX = 15;  // k-mer length
+const int W_SINGLETON_INDEX = 10;  // consecutive k-mers per window
+// occurrences of a minimizer looked at when placing a read
+const int MAX_HITS_SINGLETON_INDEX = 32;
+// mismatching bases allowed for a placed read
+const int THRESH_SINGLETON_INDEX = 12;
 const int NUM_READS_PER_BLOCK = 256000;
 const int NUM_READS_PER_BLOCK_LONG = 10000;
+// estimated memory for the read, quality and id strings of a read during
+// preprocessing, used to fit the number of blocks per step in --max-memory
+const int PREPROCESS_BYTES_PER_READ = 1024;
+const int PREPROCESS_BYTES_PER_READ_LONG = 65536;
+// reads with at most this many N go through reorder with the N substituted by
+// N_SUBSTITUTE_BASE, and get them back in the encoder
+const uint32_t MAX_N_REORDER = 4;
+const char N_SUBSTITUTE_BASE = 'A';
 const int BSC_BLOCK_SIZE = 64;  // 64 MB
+const int PACK_BLOCK_SIZE = 1 << 22;  // bases per block, 2-bit packing of seq
+// nucleotide_cm.h (--seq-codec cm)
+const int CM_CHUNK_SIZE = 1 << 22;  // bases coded independently
+const int CM_HASH_BITS = 20;  // log2 of the slots of a hashed order-k model
+const int CM_MATCH_BITS = 20;  // log2 of the slots of the match model
+// nucleotide_cm.h (--deep)
+const int DEEP_CHUNK_SIZE = 1 << 24;  // bases coded independently
+const int DEEP_NUM_STREAMS = 16;  // streams of a chunk coded in lockstep
+const int DEEP_CONTEXT = 32;  // bases seen by the network, at most 32
+const int DEEP_HIDDEN = 128;  // hidden units of the network
+const int DEEP_OUTPUT_SHIFT = 11;  // learning rate (shift), output layer
+const int DEEP_HIDDEN_SHIFT = 18;  // learning rate (shift), embeddings
+const int IO_BUFFER_SIZE = 1 << 18;  // 256 KB, buffered_io.h streams
+// permute.h
+const uint64_t PERMUTE_BLOCK_SIZE = 1 << 16;  // entries per task
+// orders up to this many entries are inverted by direct scattered writes
+const uint32_t PERMUTE_DIRECT_MAX = 1 << 22;
+const int PERMUTE_BUCKET_BITS = 16;  // log2 of the entries of a bucket
+const uint64_t PERMUTE_MAX_PARTS = 256;  // parts of the source in a bucketing
+const uint64_t PERMUTE_MAX_COUNTS = 1 << 22;  // parts x buckets counts
+// reorder_compress_quality_id.h: text read per batch and lines per task
+// when placing the ids/qualities of a bin
+const int QUALITY_ID_BATCH_BYTES = 1 << 24;
+const uint64_t QUALITY_ID_LINES_PER_TASK = 1 << 14;
 }  // namespace spring
 
 #endif  // SPRING_PARAMS_H_
@@ -0,0 +1,171 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#include "permute.h"
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "buffered_io.h"
+#include "memory_util.h"
+
+namespace spring {
+
+void read_uint32_file(const std::string &file, uint32_t *arr,
+                      const uint64_t n) {
+  buffered_ifstream fin(file, std::ios::binary);
+  fin.read((char *)arr, n * sizeof(uint32_t));
+  if ((uint64_t)fin.gcount() != n * sizeof(uint32_t))
+    throw std::runtime_error("Order file shorter than expected: " + file);
+}
+
+void write_uint32_file(const std::string &file, const uint32_t *arr,
+                       const uint64_t n) {
+  buffered_ofstream fout(file, std::ios::binary);
+  fout.write((const char *)arr, n * sizeof(uint32_t));
+}
+
+namespace {
+
+// number of entries below limit before every block (and in total, last)
+std::vector<uint64_t> block_offsets(const uint32_t *arr, const uint64_t n,
+                                    const uint32_t limit, const int num_thr) {
+  std::vector<uint64_t> offsets(
+      (n + PERMUTE_BLOCK_SIZE - 1) / PERMUTE_BLOCK_SIZE + 1, 0);
+  parallel_blocks(n, num_thr, [&](const uint64_t start, const uint64_t end) {
+    uint64_t count = 0;
+    for (uint64_t i = start; i < end; i++) count += arr[i] < limit;
+    offsets[start / PERMUTE_BLOCK_SIZE + 1] = count;
+  });
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  return offsets;
+}
+
+}  // namespace
+
+void rank_below(const uint32_t *arr, const uint64_t n, const uint32_t limit,
+                uint32_t *rank, const int num_thr) {
+  std::vector<uint64_t> offsets = block_offsets(arr, n, limit, num_thr);
+  parallel_blocks(n, num_thr, [&](const uint64_t start, const uint64_t end) {
+    uint32_t r = offsets[start / PERMUTE_BLOCK_SIZE];
+    for (uint64_t i = start; i < end; i++)
+      if (arr[i] < limit) rank[i] = r++;
+  });
+}
+
+void invert_order(const uint32_t *arr, const uint64_t n, const uint32_t limit,
+                  uint32_t *out, const int num_thr) {
+  // the writes to out are scattered: while out fits in the cache (or the
+  // pairs below do not fit in memory) they are done directly
+  if (limit <= PERMUTE_DIRECT_MAX ||
+      !fits_in_memory(n * sizeof(uint64_t))) {
+    std::vector<uint64_t> offsets = block_offsets(arr, n, limit, num_thr);
+    parallel_blocks(n, num_thr, [&](const uint64_t start, const uint64_t end) {
+      uint32_t r = offsets[start / PERMUTE_BLOCK_SIZE];
+      for (uint64_t i = start; i < end; i++)
+        if (arr[i] < limit) out[arr[i]] = r++;
+    });
+    return;
+  }
+  // otherwise the (destination, value) pairs are first partitioned by
+  // destination into buckets of 2^PERMUTE_BUCKET_BITS entries of out, and
+  // each bucket is then written on its own within the cache. The source is
+  // split into parts, each with its counts per bucket.
+  const uint64_t num_buckets = ((limit - 1) >> PERMUTE_BUCKET_BITS) + 1;
+  const uint64_t num_parts =
+      std::max<uint64_t>(1, std::min<uint64_t>(PERMUTE_MAX_PARTS,
+                                               PERMUTE_MAX_COUNTS / num_buckets));
+  const uint64_t part_size = (n + num_parts - 1) / num_parts;
+  // counts[p * num_buckets + b], then the position of the next pair of part
+  // p in bucket b
+  std::vector<uint64_t> counts(num_parts * num_buckets, 0);
+  std::vector<uint64_t> part_rank(num_parts + 1, 0);
+  parallel_blocks(
+      n, num_thr,
+      [&](const uint64_t start, const uint64_t end) {
+        uint64_t *c = &counts[start / part_size * num_buckets];
+        for (uint64_t i = start; i < end; i++)
+          if (arr[i] < limit) c[arr[i] >> PERMUTE_BUCKET_BITS]++;
+        part_rank[start / part_size + 1] =
+            std::accumulate(c, c + num_buckets, (uint64_t)0);
+      },
+      part_size);
+  std::partial_sum(part_rank.begin(), part_rank.end(), part_rank.begin());
+  const uint64_t num_pairs = part_rank[num_parts];
+  std::vector<uint64_t> bucket_start(num_buckets + 1);
+  uint64_t pos = 0;
+  for (uint64_t b = 0; b < num_buckets; b++) {
+    bucket_start[b] = pos;
+    for (uint64_t p = 0; p < num_parts; p++) {
+      uint64_t count = counts[p * num_buckets + b];
+      counts[p * num_buckets + b] = pos;
+      pos += count;
+    }
+  }
+  bucket_start[num_buckets] = pos;
+  uint64_t *pairs =
+      static_cast<uint64_t *>(alloc_pages(num_pairs * sizeof(uint64_t)));
+  parallel_blocks(
+      n, num_thr,
+      [&](const uint64_t start, const uint64_t end) {
+        uint64_t *next = &counts[start / part_size * num_buckets];
+        uint32_t r = part_rank[start / part_size];
+        for (uint64_t i = start; i < end; i++)
+          if (arr[i] < limit)
+            pairs[next[arr[i] >> PERMUTE_BUCKET_BITS]++] =
+                ((uint64_t)arr[i] << 32) | r++;
+      },
+      part_size);
+  parallel_blocks(
+      num_buckets, num_thr,
+      [&](const uint64_t start, const uint64_t end) {
+        for (uint64_t k = bucket_start[start]; k < bucket_start[end]; k++)
+          out[pairs[k] >> 32] = (uint32_t)pairs[k];
+      },
+      1);
+  free_pages(pairs, num_pairs * sizeof(uint64_t));
+}
+
+void remap(uint32_t *arr, const uint64_t n, const uint32_t *map,
+           const int num_thr) {
+  parallel_blocks(n, num_thr, [&](const uint64_t start, const uint64_t end) {
+    for (uint64_t i = start; i < end; i++) arr[i] = map[arr[i]];
+  });
+}
+
+void remaining_indices(const uint32_t *removed, const uint64_t n,
+                       const uint64_t total, uint32_t *out, const int num_thr) {
+  std::vector<uint8_t> flag(total, 0);
+  parallel_blocks(n, num_thr, [&](const uint64_t start, const uint64_t end) {
+    for (uint64_t i = start; i < end; i++) flag[removed[i]] = 1;
+  });
+  std::vector<uint64_t> offsets(
+      (total + PERMUTE_BLOCK_SIZE - 1) / PERMUTE_BLOCK_SIZE + 1, 0);
+  parallel_blocks(total, num_thr,
+                  [&](const uint64_t start, const uint64_t end) {
+                    uint64_t count = 0;
+                    for (uint64_t i = start; i < end; i++) count += !flag[i];
+                    offsets[start / PERMUTE_BLOCK_SIZE + 1] = count;
+                  });
+  std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+  parallel_blocks(total, num_thr,
+                  [&](const uint64_t start, const uint64_t end) {
+                    uint64_t pos = offsets[start / PERMUTE_BLOCK_SIZE];
+                    for (uint64_t i = start; i < end; i++)
+                      if (!flag[i]) out[pos++] = i;
+                  });
+}
+
+}  // namespace spring
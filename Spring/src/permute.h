@@ -0,0 +1,83 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#ifndef SPRING_PERMUTE_H_
+#define SPRING_PERMUTE_H_
+
+#include <omp.h>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include "params.h"
+
+namespace spring {
+
+// Parallel remapping of the read orders (uint32 index arrays) held in memory.
+// The loops run as tasks over blocks of PERMUTE_BLOCK_SIZE entries: on the
+// threads of the enclosing parallel region if there is one (the stream
+// compression stages run as tasks of one team), otherwise on a team of
+// num_thr threads of their own.
+
+// calls f(start, end) for the blocks of block_size entries of [0, n)
+template <class F>
+void parallel_blocks(const uint64_t n, const int num_thr, const F &f,
+                     const uint64_t block_size = PERMUTE_BLOCK_SIZE) {
+  const uint64_t num_blocks = (n + block_size - 1) / block_size;
+  auto run = [&] {
+#pragma omp taskloop default(shared)
+    for (uint64_t b = 0; b < num_blocks; b++)
+      f(b * block_size, std::min(n, (b + 1) * block_size));
+  };
+  if (omp_in_parallel()) {
+    run();
+  } else {
+#pragma omp parallel num_threads(num_thr)
+#pragma omp single
+    run();
+  }
+}
+
+// the n uint32 values of a file, throws if it is shorter
+void read_uint32_file(const std::string &file, uint32_t *arr,
+                      const uint64_t n);
+
+void write_uint32_file(const std::string &file, const uint32_t *arr,
+                       const uint64_t n);
+
+// rank[i] = number of j < i with arr[j] < limit, for the i with arr[i] <
+// limit (the other entries are left as they are)
+void rank_below(const uint32_t *arr, const uint64_t n, const uint32_t limit,
+                uint32_t *rank, const int num_thr);
+
+// inverse of the order arr restricted to the values below limit:
+// out[arr[i]] = rank of i as in rank_below, for the i with arr[i] < limit.
+// With limit above all values, out[arr[i]] = i.
+void invert_order(const uint32_t *arr, const uint64_t n, const uint32_t limit,
+                  uint32_t *out, const int num_thr);
+
+// arr[i] = map[arr[i]]
+void remap(uint32_t *arr, const uint64_t n, const uint32_t *map,
+           const int num_thr);
+
+// the indices in [0, total) that are not among the n distinct values of
+// removed, in increasing order (total - n of them), i.e., the map from
+// positions among the remaining indices back to all indices
+void remaining_indices(const uint32_t *removed, const uint64_t n,
+                       const uint64_t total, uint32_t *out, const int num_thr);
+
+}  // namespace spring
+
+#endif  // SPRING_PERMUTE_H_
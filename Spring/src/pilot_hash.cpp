@@ -0,0 +1,137 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#include "pilot_hash.h"
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace spring {
+
+const int PILOT_HASH_MAX_SEEDS = 16;
+
+void pilot_hash::build(const uint64_t *keys, const uint64_t n,
+                       const int num_thr) {
+  num_parts = std::max<uint64_t>(1, (n + PILOT_HASH_PART_KEYS - 1) /
+                                        PILOT_HASH_PART_KEYS);
+  double avg_part_keys = std::max(2.0, (double)n / num_parts);
+  buckets_per_part = std::max<uint64_t>(
+      2, (uint64_t)std::ceil(PILOT_HASH_C * avg_part_keys /
+                             std::log2(avg_part_keys)));
+  pilots.assign(num_parts * buckets_per_part, 0);
+
+  std::vector<uint64_t> h(n);
+  std::vector<uint64_t> part_keys(num_parts + 1);
+  std::vector<uint64_t> g(n);
+  for (int attempt = 0; attempt < PILOT_HASH_MAX_SEEDS; attempt++) {
+    seed = mix(attempt + 0x243F6A8885A308D3ULL);
+    // partition the key hashes with a counting sort
+#pragma omp parallel for schedule(static) num_threads(num_thr)
+    for (int64_t i = 0; i < (int64_t)n; i++) h[i] = mix(keys[i] ^ seed);
+    std::fill(part_keys.begin(), part_keys.end(), 0);
+    for (uint64_t i = 0; i < n; i++) part_keys[fastrange(h[i], num_parts) + 1]++;
+    for (uint64_t p = 0; p < num_parts; p++) part_keys[p + 1] += part_keys[p];
+    std::vector<uint64_t> fill_pos(part_keys.begin(), part_keys.end() - 1);
+    for (uint64_t i = 0; i < n; i++)
+      g[fill_pos[fastrange(h[i], num_parts)]++] =
+          mix(h[i] ^ 0x9E3779B97F4A7C15ULL);
+
+    // table size of each partition rounded to whole words of the bit vector,
+    // so that partitions can be built concurrently (at least one word, so
+    // that lookups of an empty partition stay in bounds)
+    part_offset.assign(num_parts + 1, 0);
+    for (uint64_t p = 0; p < num_parts; p++) {
+      uint64_t size = (uint64_t)std::ceil(
+          (part_keys[p + 1] - part_keys[p]) / PILOT_HASH_LOAD);
+      part_offset[p + 1] =
+          part_offset[p] + std::max<uint64_t>(1, (size + 63) / 64) * 64;
+    }
+    table_size = part_offset[num_parts];
+    occupied.assign(table_size / 64, 0);
+
+    bool success = true;
+#pragma omp parallel for schedule(dynamic) num_threads(num_thr)
+    for (int64_t p = 0; p < (int64_t)num_parts; p++) {
+      if (!build_part(g.data() + part_keys[p], part_keys[p + 1] - part_keys[p],
+                      p)) {
+#pragma omp atomic write
+        success = false;
+      }
+    }
+    if (success) return;
+  }
+  throw std::runtime_error("Failed to build pilot hash (duplicate keys?)");
+}
+
+bool pilot_hash::build_part(const uint64_t *g, const uint64_t n,
+                            const uint64_t part) {
+  // group the hashes by bucket
+  std::vector<uint32_t> bucket_start(buckets_per_part + 1, 0);
+  for (uint64_t i = 0; i < n; i++) bucket_start[bucket(g[i]) + 1]++;
+  uint32_t max_bucket_size = 0;
+  for (uint64_t b = 0; b < buckets_per_part; b++) {
+    max_bucket_size = std::max(max_bucket_size, bucket_start[b + 1]);
+    bucket_start[b + 1] += bucket_start[b];
+  }
+  std::vector<uint64_t> bucket_g(n);
+  {
+    std::vector<uint32_t> fill_pos(bucket_start.begin(), bucket_start.end() - 1);
+    for (uint64_t i = 0; i < n; i++) bucket_g[fill_pos[bucket(g[i])]++] = g[i];
+  }
+  // buckets in decreasing order of size (counting sort on the size)
+  std::vector<uint32_t> size_start(max_bucket_size + 2, 0);
+  for (uint64_t b = 0; b < buckets_per_part; b++)
+    size_start[max_bucket_size - (bucket_start[b + 1] - bucket_start[b]) + 1]++;
+  for (uint32_t s = 0; s <= max_bucket_size; s++)
+    size_start[s + 1] += size_start[s];
+  std::vector<uint32_t> order(buckets_per_part);
+  for (uint64_t b = 0; b < buckets_per_part; b++)
+    order[size_start[max_bucket_size - (bucket_start[b + 1] - bucket_start[b])]++] =
+        b;
+
+  uint64_t *taken = occupied.data() + part_offset[part] / 64;
+  uint64_t part_size = part_offset[part + 1] - part_offset[part];
+  uint16_t *part_pilots = pilots.data() + part * buckets_per_part;
+  std::vector<uint64_t> pos(max_bucket_size);
+  for (uint64_t b : order) {
+    uint32_t begin = bucket_start[b], size = bucket_start[b + 1] - begin;
+    if (size == 0) break;  // remaining buckets are empty
+    uint32_t pilot = 0;
+    for (; pilot <= UINT16_MAX; pilot++) {
+      uint32_t k = 0;
+      for (; k < size; k++) {
+        pos[k] = position(bucket_g[begin + k], pilot, part_size);
+        if ((taken[pos[k] >> 6] >> (pos[k] & 63)) & 1) break;
+        // mark right away to catch collisions within the bucket
+        taken[pos[k] >> 6] |= 1ULL << (pos[k] & 63);
+      }
+      if (k == size) break;
+      for (uint32_t k1 = 0; k1 < k; k1++)
+        taken[pos[k1] >> 6] &= ~(1ULL << (pos[k1] & 63));
+    }
+    if (pilot > UINT16_MAX) return false;
+    part_pilots[b] = pilot;
+  }
+  return true;
+}
+
+uint64_t pilot_hash::num_bytes() const {
+  return sizeof(pilot_hash) + part_offset.size() * sizeof(uint64_t) +
+         pilots.size() * sizeof(uint16_t) + occupied.size() * sizeof(uint64_t);
+}
+
+}  // namespace spring
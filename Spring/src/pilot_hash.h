@@ -0,0 +1,106 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#ifndef SPRING_PILOT_HASH_H_
+#define SPRING_PILOT_HASH_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace spring {
+
+// Perfect hash function in the style of PTHash (hash and displace). Keys are
+// split into partitions of about PILOT_HASH_PART_KEYS keys that are built in
+// parallel. Within a partition, keys are grouped into buckets and each bucket
+// stores a 16-bit pilot chosen so that the positions of all its keys are
+// free. A lookup is a couple of multiplications, one access to the pilot
+// array and one to the occupancy bit vector.
+//
+// The table has a load factor of PILOT_HASH_LOAD, so positions lie in
+// [0, size()) with size() slightly larger than the number of keys. Unlike
+// BBHash, lookup returns size() for a key that lands on a free position, but
+// a key not in the set can still map to the position of another key.
+const uint64_t PILOT_HASH_PART_KEYS = 1 << 20;
+const double PILOT_HASH_LOAD = 0.97;
+// buckets per partition: PILOT_HASH_C * n / log2(n)
+const double PILOT_HASH_C = 6.0;
+
+class pilot_hash {
+ public:
+  pilot_hash() : seed(0), num_parts(0), buckets_per_part(0), table_size(0) {}
+
+  // build for n distinct keys
+  void build(const uint64_t *keys, const uint64_t n, const int num_thr);
+
+  uint64_t lookup(const uint64_t key) const {
+    uint64_t h = mix(key ^ seed);
+    uint64_t part = fastrange(h, num_parts);
+    uint64_t g = mix(h ^ 0x9E3779B97F4A7C15ULL);
+    uint16_t pilot = pilots[part * buckets_per_part + bucket(g)];
+    uint64_t begin = part_offset[part];
+    uint64_t pos =
+        begin + position(g, pilot, part_offset[part + 1] - begin);
+    if (!((occupied[pos >> 6] >> (pos & 63)) & 1)) return table_size;
+    return pos;
+  }
+
+  uint64_t size() const { return table_size; }
+
+  // bytes used by the structure
+  uint64_t num_bytes() const;
+
+ private:
+  uint64_t seed;
+  uint64_t num_parts;
+  uint64_t buckets_per_part;
+  uint64_t table_size;
+  std::vector<uint64_t> part_offset;  // num_parts+1 starts (multiples of 64)
+  std::vector<uint16_t> pilots;
+  std::vector<uint64_t> occupied;  // bit vector over the table
+
+  static uint64_t mix(uint64_t x) {
+    // splitmix64 finalizer
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+  }
+
+  static uint64_t fastrange(const uint64_t x, const uint64_t n) {
+    return (uint64_t)(((unsigned __int128)x * n) >> 64);
+  }
+
+  // skewed bucket assignment: 60% of the keys go to the first 30% of the
+  // buckets, so the large buckets are placed first while the table is empty
+  uint64_t bucket(const uint64_t g) const {
+    uint64_t dense = (buckets_per_part * 3 + 9) / 10;
+    uint64_t hi = g >> 32;
+    if ((g & 0xFFFFFFFFULL) < 0x99999999ULL)  // 0.6 * 2^32
+      return (hi * dense) >> 32;
+    return dense + ((hi * (buckets_per_part - dense)) >> 32);
+  }
+
+  static uint64_t position(const uint64_t g, const uint16_t pilot,
+                           const uint64_t part_size) {
+    return fastrange(mix(g ^ ((pilot + 1) * 0xC2B2AE3D27D4EB4FULL)),
+                     part_size);
+  }
+
+  bool build_part(const uint64_t *g, const uint64_t n, const uint64_t part);
+};
+
+}  // namespace spring
+
+#endif  // SPRING_PILOT_HASH_H_
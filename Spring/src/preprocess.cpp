@@ -24,20 +24,61 @@ limitations under the License.
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include "libbsc/bsc.h"
+#include "memory_util.h"
 #include "params.h"
 #include "util.h"
 
 namespace spring {
 
-void preprocess(const std::string &infile_1, const std::string &infile_2,
-                const std::string &temp_dir, compression_params &cp,
-                const bool &gzip_flag, const bool &fasta_flag) {
+preprocess_input::preprocess_input(const std::string &infile_1,
+                                   const std::string &infile_2,
+                                   const bool &paired_end,
+                                   const bool &gzip_flag)
+    : paired_end(paired_end), gzip_flag(gzip_flag) {
   std::string infile[2] = {infile_1, infile_2};
+  for (int j = 0; j < 2; j++) {
+    fin[j] = &fin_f[j];
+    inbuf[j] = NULL;
+    if (j == 1 && !paired_end) continue;
+    if (gzip_flag) {
+      fin_f[j].open(infile[j], std::ios_base::binary);
+      inbuf[j] =
+          new boost::iostreams::filtering_streambuf<boost::iostreams::input>;
+      inbuf[j]->push(boost::iostreams::gzip_decompressor());
+      inbuf[j]->push(fin_f[j]);
+      fin[j] = new std::istream(inbuf[j]);
+    } else {
+      fin_f[j].open(infile[j]);
+    }
+  }
+}
+
+preprocess_input::~preprocess_input() {
+  for (int j = 0; j < 2; j++) {
+    if (inbuf[j] != NULL) {
+      delete fin[j];
+      delete inbuf[j];
+    }
+    fin_f[j].close();
+  }
+}
+
+bool preprocess_input::eof() {
+  // skip trailing newlines
+  *fin[0] >> std::ws;
+  return fin[0]->peek() == EOF;
+}
+
+bool preprocess(preprocess_input &input, const std::string &temp_dir,
+                compression_params &cp, const bool &fasta_flag,
+                const uint64_t &max_reads) {
   std::string outfileclean[2];
   std::string outfileN[2];
   std::string outfileorderN[2];
+  std::string outfileNpos[2];
   std::string outfileid[2];
   std::string outfilequality[2];
   std::string outfileread[2];
@@ -49,6 +90,8 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
   outfileN[1] = basedir + "/input_N.dna.2";
   outfileorderN[0] = basedir + "/read_order_N.bin";
   outfileorderN[1] = basedir + "/read_order_N.bin.2";
+  outfileNpos[0] = basedir + "/read_N_pos.bin";
+  outfileNpos[1] = basedir + "/read_N_pos.bin.2";
   outfileid[0] = basedir + "/id_1";
   outfileid[1] = basedir + "/id_2";
   outfilequality[0] = basedir + "/quality_1";
@@ -58,31 +101,21 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
   outfilereadlength[0] = basedir + "/readlength_1";
   outfilereadlength[1] = basedir + "/readlength_2";
 
-  std::ifstream fin_f[2];
   std::ofstream fout_clean[2];
   std::ofstream fout_N[2];
   std::ofstream fout_order_N[2];
+  std::ofstream fout_N_pos[2];
   std::ofstream fout_id[2];
   std::ofstream fout_quality[2];
-  std::istream *fin[2] = {&fin_f[0], &fin_f[1]};
-  boost::iostreams::filtering_streambuf<boost::iostreams::input> *inbuf[2];
+  std::istream **fin = input.fin;
 
   for (int j = 0; j < 2; j++) {
     if (j == 1 && !cp.paired_end) continue;
-    if (gzip_flag) {
-      fin_f[j].open(infile[j], std::ios_base::binary);
-      inbuf[j] =
-          new boost::iostreams::filtering_streambuf<boost::iostreams::input>;
-      inbuf[j]->push(boost::iostreams::gzip_decompressor());
-      inbuf[j]->push(fin_f[j]);
-      fin[j] = new std::istream(inbuf[j]);
-    } else {
-      fin_f[j].open(infile[j]);
-    }
     if (!cp.long_flag) {
       fout_clean[j].open(outfileclean[j],std::ios::binary);
       fout_N[j].open(outfileN[j],std::ios::binary);
       fout_order_N[j].open(outfileorderN[j], std::ios::binary);
+      fout_N_pos[j].open(outfileNpos[j], std::ios::binary);
       if (!cp.preserve_order) {
         if (cp.preserve_id) fout_id[j].open(outfileid[j]);
         if (cp.preserve_quality) fout_quality[j].open(outfilequality[j]);
@@ -91,8 +124,10 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
   }
 
   uint32_t max_readlen = 0;
+  uint32_t min_readlen = UINT32_MAX;
   uint64_t num_reads[2] = {0, 0};
   uint64_t num_reads_clean[2] = {0, 0};
+  uint64_t num_reads_N_substituted = 0;
   uint32_t num_reads_per_block;
   if (!cp.long_flag)
     num_reads_per_block = cp.num_reads_per_block;
@@ -107,43 +142,29 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
     generate_binary_binning_table(quality_binning_table, cp.bin_thr_thr,
                                   cp.bin_thr_high, cp.bin_thr_low);
 
-  // Check that we were able to open the input files and also look for
-  // paired end matching ids if relevant
-  if (!fin_f[0].is_open()) throw std::runtime_error("Error opening input file");
-  if (cp.paired_end) {
-    if (!fin_f[1].is_open())
-      throw std::runtime_error("Error opening input file");
-    if (cp.preserve_id) {
-      std::string id_1, id_2;
-      std::getline(*fin[0], id_1);
-      std::getline(*fin[1], id_2);
-      paired_id_code = find_id_pattern(id_1, id_2);
-      if (paired_id_code != 0) paired_id_match = true;
-      // bring back to start
-      if (gzip_flag) {
-        for (int j = 0; j < 2; j++) {
-          fin_f[j].close();
-          delete fin[j];
-          delete inbuf[j];
-          fin_f[j].open(infile[j], std::ios_base::binary);
-          inbuf[j] = new boost::iostreams::filtering_streambuf<
-              boost::iostreams::input>;
-          inbuf[j]->push(boost::iostreams::gzip_decompressor());
-          inbuf[j]->push(fin_f[j]);
-          fin[j] = new std::istream(inbuf[j]);
-        }
-      } else {
-        fin_f[0].seekg(0);
-        fin_f[1].seekg(0);
-      }
-    }
-  }
-  uint64_t num_reads_per_step = (uint64_t)cp.num_thr * num_reads_per_block;
+  // Check that we were able to open the input files
+  if (!input.fin_f[0].is_open())
+    throw std::runtime_error("Error opening input file");
+  if (cp.paired_end && !input.fin_f[1].is_open())
+    throw std::runtime_error("Error opening input file");
+  // reads per file in this segment
+  uint64_t max_reads_file = cp.paired_end ? max_reads / 2 : max_reads;
+  bool segment_full = false;
+  // blocks read per step: one per thread, or fewer if their strings would
+  // exceed the memory limit
+  uint64_t num_blocks_per_step = items_within_budget(
+      (uint64_t)num_reads_per_block * (cp.long_flag ? PREPROCESS_BYTES_PER_READ_LONG
+                                                    : PREPROCESS_BYTES_PER_READ),
+      1, cp.num_thr);
+  if (num_blocks_per_step < (uint64_t)cp.num_thr)
+    std::cout << "Memory limit: preprocessing " << num_blocks_per_step
+              << " blocks at a time\n";
+  uint64_t num_reads_per_step = num_blocks_per_step * num_reads_per_block;
   std::string *read_array = new std::string[num_reads_per_step];
   std::string *id_array_1 = new std::string[num_reads_per_step];
   std::string *id_array_2 = new std::string[num_reads_per_step];
   std::string *quality_array = new std::string[num_reads_per_step];
-  bool *read_contains_N_array = new bool[num_reads_per_step];
+  uint32_t *num_N_array = new uint32_t[num_reads_per_step];
   uint32_t *read_lengths_array = new uint32_t[num_reads_per_step];
   bool *paired_id_match_array = new bool[cp.num_thr];
 
@@ -157,13 +178,21 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
       if (j == 1 && !cp.paired_end) continue;
       done[j] = false;
       std::string *id_array = (j == 0) ? id_array_1 : id_array_2;
+      uint32_t num_reads_to_read =
+          std::min(num_reads_per_step, max_reads_file - num_reads[j]);
       uint32_t num_reads_read = read_fastq_block(
-          fin[j], id_array, read_array, quality_array, num_reads_per_step, fasta_flag);
-      if (num_reads_read < num_reads_per_step) done[j] = true;
+          fin[j], id_array, read_array, quality_array, num_reads_to_read, fasta_flag);
+      if (num_reads_read < num_reads_to_read) done[j] = true;
+      if (num_reads[j] + num_reads_read == max_reads_file) {
+        // rest of the input goes to the next segment
+        done[j] = true;
+        segment_full = true;
+      }
       if (num_reads_read == 0) continue;
-      if (num_reads[0] + num_reads[1] + num_reads_read > MAX_NUM_READS) {
-        std::cerr << "Max number of reads allowed is " << MAX_NUM_READS << "\n";
-        throw std::runtime_error("Too many reads.");
+      if (j == 1 && cp.preserve_id && num_reads[1] == 0) {
+        // look for paired end matching ids in the first pair
+        paired_id_code = find_id_pattern(id_array_1[0], id_array_2[0]);
+        paired_id_match = (paired_id_code != 0);
       }
 #pragma omp parallel
       {
@@ -202,10 +231,10 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
                   "Read length does not match quality length.");
             read_lengths_array[i] = (uint32_t)len;
 
-            // mark reads with N
+            // count the N of each read
             if (!cp.long_flag)
-              read_contains_N_array[i] =
-                  (read_array[i].find('N') != std::string::npos);
+              num_N_array[i] =
+                  std::count(read_array[i].begin(), read_array[i].end(), 'N');
 
             // Write read length to a file (for long mode)
             if (cp.long_flag)
@@ -265,9 +294,7 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
                                       std::to_string(num_blocks_done + tid) +
                                       ".zpaq";
 
-            // zpaq compression command
-            std::string zpaq_command = "zpaq add " + outfile_name + " " + infile_name + " -m5";
-            system(zpaq_command.c_str());
+            zpaq_compress(infile_name, outfile_name);
 
             // Remove the original input file after compression
             remove(infile_name.c_str());
@@ -306,9 +333,24 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
         if (!paired_id_match) paired_id_code = 0;
       }
       if (!cp.long_flag) {
-        // write reads and read_order_N to respective files
+        // write reads and read_order_N to respective files. Reads with at
+        // most MAX_N_REORDER N are written with the N substituted, so that
+        // they take part in reorder, and their N positions are written to
+        // read_N_pos.bin for the encoder to put them back.
         for (uint32_t i = 0; i < num_reads_read; i++) {
-          if (!read_contains_N_array[i]) {
+          if (num_N_array[i] <= MAX_N_REORDER) {
+            if (num_N_array[i] != 0) {
+              uint32_t read_num = num_reads[j] + i;
+              uint16_t num_N = num_N_array[i];
+              fout_N_pos[j].write((char *)&read_num, sizeof(uint32_t));
+              fout_N_pos[j].write((char *)&num_N, sizeof(uint16_t));
+              for (uint16_t k = 0; k < read_array[i].size(); k++)
+                if (read_array[i][k] == 'N') {
+                  fout_N_pos[j].write((char *)&k, sizeof(uint16_t));
+                  read_array[i][k] = N_SUBSTITUTE_BASE;
+                }
+              num_reads_N_substituted++;
+            }
             write_dna_in_bits(read_array[i],fout_clean[j]);
             num_reads_clean[j]++;
           } else {
@@ -327,45 +369,35 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
         }
       }
       num_reads[j] += num_reads_read;
-      max_readlen =
-          std::max(max_readlen,
-                   *(std::max_element(read_lengths_array,
-                                      read_lengths_array + num_reads_read)));
+      auto minmax_readlen = std::minmax_element(
+          read_lengths_array, read_lengths_array + num_reads_read);
+      min_readlen = std::min(min_readlen, *minmax_readlen.first);
+      max_readlen = std::max(max_readlen, *minmax_readlen.second);
     }
     if (cp.paired_end)
       if (num_reads[0] != num_reads[1])
         throw std::runtime_error(
             "Number of reads in paired files do not match.");
     if (done[0] && done[1]) break;
-    num_blocks_done += cp.num_thr;
+    num_blocks_done += num_blocks_per_step;
   }
 
   delete[] read_array;
   delete[] id_array_1;
   delete[] id_array_2;
   delete[] quality_array;
-  delete[] read_contains_N_array;
+  delete[] num_N_array;
   delete[] read_lengths_array;
   delete[] quality_binning_table;
   delete[] paired_id_match_array;
-  if (gzip_flag) {
-    for (int j = 0; j < 2; j++) {
-      if (j == 1 && !cp.paired_end) continue;
-      delete fin[j];
-      delete inbuf[j];
-    }
-  }
   // close files
-  if (cp.long_flag) {
-    fin_f[0].close();
-    if (cp.paired_end) fin_f[1].close();
-  } else {
+  if (!cp.long_flag) {
     for (int j = 0; j < 2; j++) {
       if (j == 1 && !cp.paired_end) continue;
-      fin_f[j].close();
       fout_clean[j].close();
       fout_N[j].close();
       fout_order_N[j].close();
+      fout_N_pos[j].close();
       if (!cp.preserve_order) {
         if (cp.preserve_id) fout_id[j].close();
         if (cp.preserve_quality) fout_quality[j].close();
@@ -395,6 +427,25 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
     fin_order_N.close();
     fout_order_N.close();
     remove(outfileorderN[1].c_str());
+    // same for read_N_pos, with the read numbers of file 2 following those
+    // of file 1
+    std::ofstream fout_N_pos(outfileNpos[0], std::ios::app | std::ios::binary);
+    std::ifstream fin_N_pos(outfileNpos[1], std::ios::binary);
+    uint32_t read_num;
+    uint16_t num_N;
+    std::vector<uint16_t> pos_N;
+    while (fin_N_pos.read((char *)&read_num, sizeof(uint32_t))) {
+      fin_N_pos.read((char *)&num_N, sizeof(uint16_t));
+      pos_N.resize(num_N);
+      fin_N_pos.read((char *)pos_N.data(), num_N * sizeof(uint16_t));
+      read_num += num_reads[0];
+      fout_N_pos.write((char *)&read_num, sizeof(uint32_t));
+      fout_N_pos.write((char *)&num_N, sizeof(uint16_t));
+      fout_N_pos.write((char *)pos_N.data(), num_N * sizeof(uint16_t));
+    }
+    fin_N_pos.close();
+    fout_N_pos.close();
+    remove(outfileNpos[1].c_str());
   }
 
   if (cp.paired_end && paired_id_match) {
@@ -416,15 +467,21 @@ void preprocess(const std::string &infile_1, const std::string &infile_2,
   cp.num_reads_clean[0] = num_reads_clean[0];
   cp.num_reads_clean[1] = num_reads_clean[1];
   cp.max_readlen = max_readlen;
+  cp.fixed_readlen = !cp.long_flag && min_readlen == max_readlen;
 
   std::cout << "Max Read length: " << cp.max_readlen << "\n";
+  if (cp.fixed_readlen) std::cout << "All reads have the same length\n";
   std::cout << "Total number of reads: " << cp.num_reads << "\n";
 
-  if (!cp.long_flag)
-    std::cout << "Total number of reads without N: "
+  if (!cp.long_flag) {
+    std::cout << "Total number of reads without N (or with N substituted): "
               << cp.num_reads_clean[0] + cp.num_reads_clean[1] << "\n";
+    std::cout << "Reads with N substituted: " << num_reads_N_substituted
+              << "\n";
+  }
   if (cp.preserve_id && cp.paired_end)
     std::cout << "Paired id match code: " << (int)cp.paired_id_code << "\n";
+  return segment_full && !input.eof();
 }
 
 }  // namespace spring
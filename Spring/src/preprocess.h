@@ -15,14 +15,34 @@ limitations under the License.
 #ifndef SPRING_PREPROCESS_H_
 #define SPRING_PREPROCESS_H_
 
+#include <boost/iostreams/filtering_streambuf.hpp>
+#include <fstream>
 #include <string>
 #include "util.h"
 
 namespace spring {
 
-void preprocess(const std::string &infile_1, const std::string &infile_2,
-                const std::string &temp_dir, compression_params &cp,
-                const bool &gzip_flag, const bool &fasta_flag);
+// input files of a run, kept open across its segments
+struct preprocess_input {
+  bool paired_end;
+  bool gzip_flag;
+  std::ifstream fin_f[2];
+  std::istream *fin[2];
+  boost::iostreams::filtering_streambuf<boost::iostreams::input> *inbuf[2];
+
+  preprocess_input(const std::string &infile_1, const std::string &infile_2,
+                   const bool &paired_end, const bool &gzip_flag);
+  ~preprocess_input();
+  // true if no reads are left
+  bool eof();
+};
+
+// preprocess the next segment of the input, at most max_reads reads (a pair
+// counts as two), into temp_dir. Returns true if reads are left for another
+// segment.
+bool preprocess(preprocess_input &input, const std::string &temp_dir,
+                compression_params &cp, const bool &fasta_flag,
+                const uint64_t &max_reads);
 
 }  // namespace spring
 
@@ -0,0 +1,326 @@
+/*
+* Copyright 2018 University of Illinois Board of Trustees and Stanford
+University. All Rights Reserved.
+* Licensed under the “Non-exclusive Research Use License for SPRING Software”
+license (the "License");
+* You may not use this file except in compliance with the License.
+* The License is included in the distribution as license.pdf file.
+
+* Software distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+limitations under the License.
+
+This code is a modified version of SPRING, originally developed by the University of Illinois at Urbana-Champaign and Stanford University.
+*/
+
+#ifndef SPRING_READ_BITS_H_
+#define SPRING_READ_BITS_H_
+
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include "memory_util.h"
+#include "params.h"
+
+namespace spring {
+
+// Packed reads of reorder and encoder. The reorder and encoder code is
+// templated on bitset_size: a nonzero bitset_size is a compile-time width and
+// the reads are std::bitset<bitset_size>, bitset_size 0 is the run time width
+// kernel in which the reads are runtime_bitset of runtime_bitset::num_words
+// words. The kernels only use the types and functions of read_bits_traits
+// and the operators common to both.
+
+const int RUNTIME_BITSET_MAX_WORDS = (3 * MAX_READ_LEN + 63) / 64;
+
+class runtime_bitset;
+
+// operations on the words() of runtime_bitset (a value) and
+// runtime_bitset_ref (an element of a runtime_bitset_array) with the
+// semantics of std::bitset<64 * runtime_bitset::num_words>
+template <class D>
+class runtime_bitset_base {
+ public:
+  size_t count() const {
+    const uint64_t *w = self().words();
+    size_t c = 0;
+    for (int i = 0; i < word_count(); i++) c += __builtin_popcountll(w[i]);
+    return c;
+  }
+  // only called on bitsets with no bits set past the first 64
+  unsigned long long to_ullong() const { return self().words()[0]; }
+  bool operator[](const size_t pos) const {
+    return (self().words()[pos / 64] >> (pos % 64)) & 1;
+  }
+  template <class E>
+  bool operator==(const runtime_bitset_base<E> &b) const {
+    return std::memcmp(self().words(), b.self().words(),
+                       word_count() * sizeof(uint64_t)) == 0;
+  }
+  runtime_bitset operator>>(const size_t n) const;
+  runtime_bitset operator<<(const size_t n) const;
+
+  const D &self() const { return *static_cast<const D *>(this); }
+  static int word_count();
+};
+
+class runtime_bitset : public runtime_bitset_base<runtime_bitset> {
+ public:
+  // set before any runtime_bitset is made (see call_template_functions.cpp)
+  static inline int num_words = 0;
+
+  class reference {
+   public:
+    reference(uint64_t *word, const int bit) : word(word), bit(bit) {}
+    reference &operator=(const bool x) {
+      *word = (*word & ~(1ULL << bit)) | ((uint64_t)x << bit);
+      return *this;
+    }
+    operator bool() const { return (*word >> bit) & 1; }
+
+   private:
+    uint64_t *word;
+    int bit;
+  };
+
+  // words left unset, for results that are written right away
+  enum uninitialized_t { uninitialized };
+
+  runtime_bitset() { reset(); }
+  explicit runtime_bitset(uninitialized_t) {}
+  runtime_bitset(const runtime_bitset &b) { assign(b.w); }
+  template <class D>
+  runtime_bitset(const runtime_bitset_base<D> &b) {
+    assign(b.self().words());
+  }
+  runtime_bitset &operator=(const runtime_bitset &b) {
+    assign(b.w);
+    return *this;
+  }
+  template <class D>
+  runtime_bitset &operator=(const runtime_bitset_base<D> &b) {
+    assign(b.self().words());
+    return *this;
+  }
+
+  uint64_t *words() { return w; }
+  const uint64_t *words() const { return w; }
+  using runtime_bitset_base<runtime_bitset>::operator[];
+  reference operator[](const size_t pos) {
+    return reference(&w[pos / 64], pos % 64);
+  }
+  runtime_bitset &reset() {
+    std::fill(w, w + num_words, 0);
+    return *this;
+  }
+  runtime_bitset &set() {
+    std::fill(w, w + num_words, ~0ULL);
+    return *this;
+  }
+  template <class D>
+  runtime_bitset &operator&=(const runtime_bitset_base<D> &b) {
+    const uint64_t *v = b.self().words();
+    for (int i = 0; i < num_words; i++) w[i] &= v[i];
+    return *this;
+  }
+  template <class D>
+  runtime_bitset &operator|=(const runtime_bitset_base<D> &b) {
+    const uint64_t *v = b.self().words();
+    for (int i = 0; i < num_words; i++) w[i] |= v[i];
+    return *this;
+  }
+  template <class D>
+  runtime_bitset &operator^=(const runtime_bitset_base<D> &b) {
+    const uint64_t *v = b.self().words();
+    for (int i = 0; i < num_words; i++) w[i] ^= v[i];
+    return *this;
+  }
+  runtime_bitset &operator>>=(const size_t n) {
+    shift_right(w, w, n);
+    return *this;
+  }
+  runtime_bitset &operator<<=(const size_t n) {
+    shift_left(w, w, n);
+    return *this;
+  }
+
+  // out = in >> n and out = in << n (out can be in)
+  static void shift_right(uint64_t *out, const uint64_t *in, const size_t n) {
+    const size_t shift_words = n / 64, shift_bits = n % 64;
+    for (size_t i = 0; i < (size_t)num_words; i++) {
+      const size_t j = i + shift_words;
+      uint64_t x = (j < (size_t)num_words) ? in[j] >> shift_bits : 0;
+      if (shift_bits != 0 && j + 1 < (size_t)num_words)
+        x |= in[j + 1] << (64 - shift_bits);
+      out[i] = x;
+    }
+  }
+  static void shift_left(uint64_t *out, const uint64_t *in, const size_t n) {
+    const size_t shift_words = n / 64, shift_bits = n % 64;
+    for (size_t i = num_words; i-- > 0;) {
+      uint64_t x = (i >= shift_words) ? in[i - shift_words] << shift_bits : 0;
+      if (shift_bits != 0 && i >= shift_words + 1)
+        x |= in[i - shift_words - 1] >> (64 - shift_bits);
+      out[i] = x;
+    }
+  }
+
+ private:
+  void assign(const uint64_t *v) { std::copy(v, v + num_words, w); }
+  uint64_t w[RUNTIME_BITSET_MAX_WORDS];
+};
+
+template <class D>
+int runtime_bitset_base<D>::word_count() {
+  return runtime_bitset::num_words;
+}
+
+template <class D>
+runtime_bitset runtime_bitset_base<D>::operator>>(const size_t n) const {
+  runtime_bitset b(runtime_bitset::uninitialized);
+  runtime_bitset::shift_right(b.words(), self().words(), n);
+  return b;
+}
+
+template <class D>
+runtime_bitset runtime_bitset_base<D>::operator<<(const size_t n) const {
+  runtime_bitset b(runtime_bitset::uninitialized);
+  runtime_bitset::shift_left(b.words(), self().words(), n);
+  return b;
+}
+
+template <class A, class B>
+runtime_bitset operator&(const runtime_bitset_base<A> &a,
+                         const runtime_bitset_base<B> &b) {
+  runtime_bitset c(runtime_bitset::uninitialized);
+  const uint64_t *u = a.self().words(), *v = b.self().words();
+  uint64_t *w = c.words();
+  for (int i = 0; i < runtime_bitset::num_words; i++) w[i] = u[i] & v[i];
+  return c;
+}
+
+template <class A, class B>
+runtime_bitset operator|(const runtime_bitset_base<A> &a,
+                         const runtime_bitset_base<B> &b) {
+  runtime_bitset c(runtime_bitset::uninitialized);
+  const uint64_t *u = a.self().words(), *v = b.self().words();
+  uint64_t *w = c.words();
+  for (int i = 0; i < runtime_bitset::num_words; i++) w[i] = u[i] | v[i];
+  return c;
+}
+
+template <class A, class B>
+runtime_bitset operator^(const runtime_bitset_base<A> &a,
+                         const runtime_bitset_base<B> &b) {
+  runtime_bitset c(runtime_bitset::uninitialized);
+  const uint64_t *u = a.self().words(), *v = b.self().words();
+  uint64_t *w = c.words();
+  for (int i = 0; i < runtime_bitset::num_words; i++) w[i] = u[i] ^ v[i];
+  return c;
+}
+
+// a read in a runtime_bitset_array, or a runtime_bitset passed where a read
+// is expected. Assignment copies the words.
+class runtime_bitset_ref : public runtime_bitset_base<runtime_bitset_ref> {
+ public:
+  explicit runtime_bitset_ref(uint64_t *w) : w(w) {}
+  runtime_bitset_ref(const runtime_bitset &b)
+      : w(const_cast<uint64_t *>(b.words())) {}
+  runtime_bitset_ref(const runtime_bitset_ref &b) = default;
+  runtime_bitset_ref &operator=(const runtime_bitset_ref &b) {
+    std::copy(b.w, b.w + word_count(), w);
+    return *this;
+  }
+  template <class D>
+  runtime_bitset_ref &operator=(const runtime_bitset_base<D> &b) {
+    const uint64_t *v = b.self().words();
+    std::copy(v, v + word_count(), w);
+    return *this;
+  }
+
+  uint64_t *words() const { return w; }
+  void reset() { std::fill(w, w + word_count(), 0); }
+  template <class D>
+  runtime_bitset_ref &operator|=(const runtime_bitset_base<D> &b) {
+    const uint64_t *v = b.self().words();
+    for (int i = 0; i < word_count(); i++) w[i] |= v[i];
+    return *this;
+  }
+
+ private:
+  uint64_t *w;
+};
+
+// reads of runtime_bitset::num_words words each, back to back
+struct runtime_bitset_array {
+  uint64_t *w;
+  runtime_bitset_ref operator[](const uint64_t i) const {
+    return runtime_bitset_ref(w + i * runtime_bitset::num_words);
+  }
+};
+
+inline bool is_mapped(const runtime_bitset_array &arr) {
+  return is_mapped(arr.w);
+}
+
+inline void free_array(const runtime_bitset_array &arr, const size_t n) {
+  free_array(arr.w, n * runtime_bitset::num_words);
+}
+
+template <size_t bitset_size>
+struct read_bits_traits {
+  typedef std::bitset<bitset_size> value;
+  typedef std::bitset<bitset_size> &ref;
+  typedef const std::bitset<bitset_size> &cref;
+  typedef std::bitset<bitset_size> *array;
+  static int num_words() { return bitset_size / 64; }
+  static array alloc(const size_t n) { return alloc_mapped_array<value>(n); }
+};
+
+template <>
+struct read_bits_traits<0> {
+  typedef runtime_bitset value;
+  typedef runtime_bitset_ref ref;
+  typedef runtime_bitset_ref cref;
+  typedef runtime_bitset_array array;
+  static int num_words() { return runtime_bitset::num_words; }
+  static array alloc(const size_t n) {
+    return {alloc_mapped_array<uint64_t>(n * runtime_bitset::num_words)};
+  }
+};
+
+// a read or mask, a read in (or written to) an array, and an array of reads
+// (allocated with read_bits_traits::alloc and freed with free_array)
+template <size_t bitset_size>
+using read_bits = typename read_bits_traits<bitset_size>::value;
+template <size_t bitset_size>
+using read_bits_ref = typename read_bits_traits<bitset_size>::ref;
+template <size_t bitset_size>
+using read_bits_cref = typename read_bits_traits<bitset_size>::cref;
+template <size_t bitset_size>
+using read_bits_array = typename read_bits_traits<bitset_size>::array;
+
+// the packed 2 or 3 bit codes of b, lowest bits first
+template <size_t bitset_size>
+inline uint64_t *bits_words(std::bitset<bitset_size> &b) {
+  return reinterpret_cast<uint64_t *>(&b);
+}
+
+template <size_t bitset_size>
+inline const uint64_t *bits_words(const std::bitset<bitset_size> &b) {
+  return reinterpret_cast<const uint64_t *>(&b);
+}
+
+inline uint64_t *bits_words(const runtime_bitset_ref &b) { return b.words(); }
+
+inline uint64_t *bits_words(runtime_bitset &b) { return b.words(); }
+
+inline const uint64_t *bits_words(const runtime_bitset &b) {
+  return b.words();
+}
+
+}  // namespace spring
+
+#endif  // SPRING_READ_BITS_H_
@@ -18,9 +18,11 @@ limitations under the License.
 #include <omp.h>
 #include <algorithm>
 #include <bitset>
+#include <boost/filesystem.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/device/file.hpp>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -30,7 +32,10 @@ limitations under the License.
 #include <string>
 #include <list>
 #include <utility>
+#include <vector>
 #include "bitset_util.h"
+#include "buffered_io.h"
+#include "memory_util.h"
 #include "params.h"
 #include "util.h"
 
@@ -42,7 +47,25 @@ struct reorder_global {
   uint32_t numreads_array[2];
 
   int maxshift, num_thr, max_readlen;
-  const int numdict = NUM_DICT_REORDER;
+  // number of parts the reads are reordered in (one search and one set of
+  // output files per part). Without --deterministic there are num_thr parts,
+  // searched concurrently over all reads with shared dictionaries. With it
+  // (independent_parts), part p only searches the reads part_begin(p), ...,
+  // part_begin(p + 1) - 1 with dictionaries of its own, so that the parts
+  // can run on any number of threads with the same output.
+  int num_parts;
+  bool independent_parts = false;
+  uint32_t part_begin(const int part) const {
+    return (uint64_t)numreads * part / num_parts;
+  }
+  // sets of numdict dictionaries, one per part if independent_parts
+  int num_dict_sets() const { return independent_parts ? num_parts : 1; }
+  // dictionary layout and search limits (set in set_reorder_config())
+  int numdict;
+  std::vector<int> dict_start, dict_end;
+  int max_search;
+  unsigned int thresh;
+  double stop_criteria;
 
   std::string basedir;
   std::string infile[2];
@@ -54,27 +77,28 @@ struct reorder_global {
   std::string outfilereadlength;
 
   bool paired_end;
-  // Some global arrays (some initialized in setglobalarrays())
-
-  std::bitset<bitset_size> **basemask;
-  // bitset for A,G,C,T at each position
-  // used in stringtobitset, chartobitset and bitsettostring (alloc in
-  // construtctor)
-  std::bitset<bitset_size> mask64;  // bitset with 64 bits set to 1 (used in
-                                    // bitsettostring for conversion to ullong)
-  reorder_global(int max_readlen_param) {
-    basemask = new std::bitset<bitset_size> *[max_readlen_param];
-    for (int i = 0; i < max_readlen_param; i++)
-      basemask[i] = new std::bitset<bitset_size>[128];
-  }
-  ~reorder_global() {
-    for (int i = 0; i < max_readlen; i++) delete[] basemask[i];
-    delete[] basemask;
-  }
+  // all reads have length max_readlen: the reads written for the encoder have
+  // no length header and no read length file is written
+  bool fixed_readlen = false;
+
+  // exact duplicates (set in find_duplicates(), NULL if not searched):
+  // dup_flag[i] is 0 for a read that is not a duplicate, 1 if the read is
+  // identical to an earlier read and 2 if it is the reverse complement of one.
+  // dup_next links each read to the next duplicate of it (MAX_NUM_READS at the
+  // end of the list), duplicates are only listed under the first read.
+  uint8_t *dup_flag = NULL;
+  uint32_t *dup_next = NULL;
+  // out-of-core mode: reads are renumbered in key order (see key_order()) and
+  // orig_id[i] is the original id of read i (NULL otherwise)
+  uint32_t *orig_id = NULL;
+  // Some global arrays (initialized in setglobalarrays())
+
+  read_bits<bitset_size> mask64;  // bitset with 64 bits set to 1 (used in
+                                  // bitsettostring for conversion to ullong)
 };
 
 template <size_t bitset_size>
-void bitsettostring(std::bitset<bitset_size> b, char *s, const uint16_t readlen,
+void bitsettostring(read_bits<bitset_size> b, char *s, const uint16_t readlen,
                     const reorder_global<bitset_size> &rg) {
   // destroys bitset b
   static const char revinttochar[4] = {'A', 'G', 'C', 'T'};
@@ -94,148 +118,273 @@ void bitsettostring(std::bitset<bitset_size> b, char *s, const uint16_t readlen,
 template <size_t bitset_size>
 void setglobalarrays(reorder_global<bitset_size> &rg) {
   for (int i = 0; i < 64; i++) rg.mask64[i] = 1;
-  for (int i = 0; i < rg.max_readlen; i++) {
-    rg.basemask[i][(uint8_t)'A'][2 * i] = 0;
-    rg.basemask[i][(uint8_t)'A'][2 * i + 1] = 0;
-    rg.basemask[i][(uint8_t)'C'][2 * i] = 0;
-    rg.basemask[i][(uint8_t)'C'][2 * i + 1] = 1;
-    rg.basemask[i][(uint8_t)'G'][2 * i] = 1;
-    rg.basemask[i][(uint8_t)'G'][2 * i + 1] = 0;
-    rg.basemask[i][(uint8_t)'T'][2 * i] = 1;
-    rg.basemask[i][(uint8_t)'T'][2 * i + 1] = 1;
-  }
   return;
 }
 
 template <size_t bitset_size>
-void updaterefcount(std::bitset<bitset_size> &cur,
-                    std::bitset<bitset_size> &ref,
-                    std::bitset<bitset_size> &revref, int **count,
+void reverse_complement_bits(read_bits_cref<bitset_size> b,
+                             const uint16_t readlen,
+                             read_bits_ref<bitset_size> rc) {
+  // 2-bit codes A=0, G=1, C=2, T=3, complement is code^3
+  const uint64_t *words = bits_words(b);
+  uint64_t *rc_words = bits_words(rc);
+  rc.reset();
+  for (int i = 0; i < readlen; i++) {
+    int j = readlen - 1 - i;
+    rc_words[j / 32] |= (((words[i / 32] >> (2 * (i % 32))) & 3) ^ 3)
+                        << (2 * (j % 32));
+  }
+}
+
+template <size_t bitset_size>
+uint64_t hash_read_bits(read_bits_cref<bitset_size> b,
+                        const uint16_t readlen) {
+  const uint64_t *words = bits_words(b);
+  uint64_t h = readlen;
+  for (int i = 0; i < (2 * readlen + 63) / 64; i++) {
+    h = (h ^ words[i]) * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 29;
+  }
+  return h;
+}
+
+template <size_t bitset_size>
+uint32_t find_duplicates(read_bits_array<bitset_size> read,
+                         uint16_t *read_lengths,
+                         reorder_global<bitset_size> &rg) {
+  // group reads by a hash of the smaller of their forward and reverse
+  // complement hashes, then compare each read in a group with the first one.
+  // Sets rg.dup_flag and rg.dup_next and returns the number of duplicates.
+  const uint32_t n = rg.numreads;
+  rg.dup_flag = alloc_array<uint8_t>(n);
+  rg.dup_next = alloc_array<uint32_t>(n);
+  uint64_t *hash = new uint64_t[n];
+  uint32_t *ids = new uint32_t[n];
+#pragma omp parallel for schedule(static)
+  for (int64_t i = 0; i < (int64_t)n; i++) {
+    read_bits<bitset_size> rc;
+    reverse_complement_bits<bitset_size>(read[i], read_lengths[i], rc);
+    uint64_t h = hash_read_bits<bitset_size>(read[i], read_lengths[i]);
+    uint64_t h_rc = hash_read_bits<bitset_size>(rc, read_lengths[i]);
+    hash[i] = std::min(h, h_rc);
+    ids[i] = i;
+    rg.dup_next[i] = MAX_NUM_READS;
+  }
+  {
+    uint64_t *hash_tmp = new uint64_t[n];
+    uint32_t *ids_tmp = new uint32_t[n];
+    radix_sort_pairs(hash, ids, hash_tmp, ids_tmp, n, 64);
+    delete[] hash_tmp;
+    delete[] ids_tmp;
+  }
+  uint32_t num_dups = 0;
+#pragma omp parallel reduction(+ : num_dups)
+  {
+    int tid = omp_get_thread_num();
+    int nthr = omp_get_num_threads();
+    uint64_t i = uint64_t(n) * tid / nthr, stop = uint64_t(n) * (tid + 1) / nthr;
+    // each thread handles the groups starting in its range
+    while (i < stop && i > 0 && hash[i] == hash[i - 1]) i++;
+    while (i < stop) {
+      uint32_t first = ids[i], last = first;
+      read_bits<bitset_size> first_rc;
+      reverse_complement_bits<bitset_size>(read[first], read_lengths[first],
+                                           first_rc);
+      uint64_t j = i + 1;
+      for (; j < n && hash[j] == hash[i]; j++) {
+        uint32_t rid = ids[j];  // ids increase within a group (stable sort)
+        if (read_lengths[rid] != read_lengths[first]) continue;
+        if (read[rid] == read[first])
+          rg.dup_flag[rid] = 1;
+        else if (read[rid] == first_rc)
+          rg.dup_flag[rid] = 2;
+        else
+          continue;  // hash collision
+        rg.dup_next[last] = rid;
+        last = rid;
+        num_dups++;
+      }
+      i = j;
+    }
+  }  // parallel end
+  delete[] hash;
+  delete[] ids;
+  return num_dups;
+}
+
+// write the length of read rid (nothing for reads of fixed length)
+template <size_t bitset_size>
+inline void write_read_length(std::ostream &foutlength, const uint32_t rid,
+                              const uint16_t *read_lengths,
+                              const reorder_global<bitset_size> &rg) {
+  if (!rg.fixed_readlen)
+    foutlength.write((char *)&read_lengths[rid], sizeof(uint16_t));
+}
+
+template <size_t bitset_size>
+void write_duplicates(const uint32_t rid, const char rc, const int64_t pos,
+                      std::ostream &foutRC, std::ostream &foutorder,
+                      std::ostream &foutflag, std::ostream &foutpos,
+                      std::ostream &foutlength, const uint16_t *read_lengths,
+                      const reorder_global<bitset_size> &rg) {
+  // write the duplicates of read rid right after it, at the same position
+  if (rg.dup_next == NULL) return;
+  for (uint32_t d = rg.dup_next[rid]; d != MAX_NUM_READS; d = rg.dup_next[d]) {
+    if (rg.dup_flag[d] == 1)
+      foutRC << rc;
+    else
+      foutRC << (rc == 'd' ? 'r' : 'd');
+    foutorder.write((char *)&d, sizeof(uint32_t));
+    foutflag << 1;  // for matched
+    foutpos.write((char *)&pos, sizeof(int64_t));
+    write_read_length(foutlength, d, read_lengths, rg);
+  }
+}
+
+template <size_t bitset_size>
+bool start_contig_with_duplicates(const uint32_t rid, std::ostream &foutRC,
+                                  std::ostream &foutorder,
+                                  std::ostream &foutflag, std::ostream &foutpos,
+                                  std::ostream &foutlength,
+                                  const uint16_t *read_lengths,
+                                  const reorder_global<bitset_size> &rg) {
+  // a read with duplicates is never a singleton, so the contig it starts is
+  // written right away. Returns false (nothing written) for other reads.
+  if (rg.dup_next == NULL || rg.dup_next[rid] == MAX_NUM_READS) return false;
+  foutRC << 'd';
+  foutorder.write((char *)&rid, sizeof(uint32_t));
+  foutflag << 0;  // for unmatched
+  int64_t zero = 0;
+  foutpos.write((char *)&zero, sizeof(int64_t));
+  write_read_length(foutlength, rid, read_lengths, rg);
+  write_duplicates<bitset_size>(rid, 'd', 0, foutRC, foutorder, foutflag,
+                                foutpos, foutlength, read_lengths, rg);
+  return true;
+}
+
+template <size_t bitset_size>
+void updaterefcount(read_bits_cref<bitset_size> cur,
+                    read_bits_ref<bitset_size> ref,
+                    read_bits_ref<bitset_size> revref, int **count,
                     const bool resetcount, const bool rev, const int shift,
                     const uint16_t cur_readlen, int &ref_len,
                     const reorder_global<bitset_size> &rg)
 // for var length, shift represents shift of start positions, if read length is
 // small, may not need to shift actually
+// Works directly on the packed 2-bit codes of the bitsets (A=0, G=1, C=2, T=3,
+// complement is code^3). count[code][pos] holds the count planes.
 {
-  static const char inttochar[4] = {'A', 'C', 'T', 'G'};
-  auto chartoint = [](uint8_t a) {
-    return (a & 0x06) >> 1;
-  };  // inverse of above
-  char s[MAX_READ_LEN + 1], s1[MAX_READ_LEN + 1], *current;
-  bitsettostring<bitset_size>(cur, s, cur_readlen, rg);
-  if (rev == false)
-    current = s;
-  else {
-    reverse_complement(s, s1, cur_readlen);
-    current = s1;
+  const int num_words = read_bits_traits<bitset_size>::num_words();
+  uint8_t current[MAX_READ_LEN];
+  // unpack the read (reverse complemented if rev)
+  const uint64_t *cur_words = bits_words(cur);
+  if (rev == false) {
+    for (int i = 0; i < cur_readlen; i++)
+      current[i] = (cur_words[i / 32] >> (2 * (i % 32))) & 3;
+  } else {
+    for (int i = 0; i < cur_readlen; i++) {
+      int j = cur_readlen - 1 - i;
+      current[i] = ((cur_words[j / 32] >> (2 * (j % 32))) & 3) ^ 3;
+    }
   }
 
+  uint8_t refcode[MAX_READ_LEN];
   if (resetcount == true)  // resetcount - unmatched read so start over
   {
-    std::fill(count[0], count[0] + rg.max_readlen, 0);
-    std::fill(count[1], count[1] + rg.max_readlen, 0);
-    std::fill(count[2], count[2] + rg.max_readlen, 0);
-    std::fill(count[3], count[3] + rg.max_readlen, 0);
-    for (int i = 0; i < cur_readlen; i++) {
-      count[chartoint((uint8_t)current[i])][i] = 1;
+    for (int j = 0; j < 4; j++) {
+      std::fill(count[j], count[j] + rg.max_readlen, 0);
+      for (int i = 0; i < cur_readlen; i++) count[j][i] = (current[i] == j);
     }
     ref_len = cur_readlen;
+    std::copy(current, current + cur_readlen, refcode);
   } else {
+    // new count[i] = old count[i + src_shift] for i in [copy_start, copy_end),
+    // rest of [0, new_len) is zeroed and the read is then added at read_start
+    int new_len, copy_start, copy_end, src_shift, read_start;
     if (!rev) {
-      // shift count
-      for (int i = 0; i < ref_len - shift; i++) {
-        for (int j = 0; j < 4; j++) count[j][i] = count[j][i + shift];
-        if (i < cur_readlen) count[chartoint((uint8_t)current[i])][i] += 1;
-      }
-
-      // for the new positions set count to 1
-      for (int i = ref_len - shift; i < cur_readlen; i++) {
-        for (int j = 0; j < 4; j++) count[j][i] = 0;
-        count[chartoint((uint8_t)current[i])][i] = 1;
-      }
-      ref_len = std::max<int>(ref_len - shift, cur_readlen);
-    } else  // reverse case is quite complicated in the variable length case
-    {
-      if (cur_readlen - shift >= ref_len) {
-        for (int i = cur_readlen - shift - ref_len; i < cur_readlen - shift;
-             i++) {
-          for (int j = 0; j < 4; j++)
-            count[j][i] = count[j][i - (cur_readlen - shift - ref_len)];
-          count[chartoint((uint8_t)current[i])][i] += 1;
-        }
-        for (int i = 0; i < cur_readlen - shift - ref_len; i++) {
-          for (int j = 0; j < 4; j++) count[j][i] = 0;
-          count[chartoint((uint8_t)current[i])][i] = 1;
-        }
-        for (int i = cur_readlen - shift; i < cur_readlen; i++) {
-          for (int j = 0; j < 4; j++) count[j][i] = 0;
-          count[chartoint((uint8_t)current[i])][i] = 1;
-        }
-        ref_len = cur_readlen;
-      } else if (ref_len + shift <= rg.max_readlen) {
-        for (int i = ref_len - cur_readlen + shift; i < ref_len; i++)
-          count[chartoint(
-              (uint8_t)current[i - (ref_len - cur_readlen + shift)])][i] += 1;
-        for (int i = ref_len; i < ref_len + shift; i++) {
-          for (int j = 0; j < 4; j++) count[j][i] = 0;
-          count[chartoint(
-              (uint8_t)current[i - (ref_len - cur_readlen + shift)])][i] = 1;
-        }
-        ref_len = ref_len + shift;
-      } else {
-        for (int i = 0; i < rg.max_readlen - shift; i++) {
-          for (int j = 0; j < 4; j++)
-            count[j][i] = count[j][i + (ref_len + shift - rg.max_readlen)];
-        }
-        for (int i = rg.max_readlen - cur_readlen; i < rg.max_readlen - shift;
-             i++)
-          count[chartoint((uint8_t)current[i - (rg.max_readlen - cur_readlen)])]
-               [i] += 1;
-        for (int i = rg.max_readlen - shift; i < rg.max_readlen; i++) {
-          for (int j = 0; j < 4; j++) count[j][i] = 0;
-          count[chartoint((uint8_t)current[i - (rg.max_readlen - cur_readlen)])]
-               [i] = 1;
-        }
-        ref_len = rg.max_readlen;
-      }
+      new_len = std::max<int>(ref_len - shift, cur_readlen);
+      copy_start = 0;
+      copy_end = std::max<int>(ref_len - shift, 0);
+      src_shift = shift;
+      read_start = 0;
+    } else if (cur_readlen - shift >= ref_len) {
+      // reverse case is quite complicated in the variable length case
+      new_len = cur_readlen;
+      copy_start = cur_readlen - shift - ref_len;
+      copy_end = cur_readlen - shift;
+      src_shift = -copy_start;
+      read_start = 0;
+    } else if (ref_len + shift <= rg.max_readlen) {
+      new_len = ref_len + shift;
+      copy_start = 0;
+      copy_end = ref_len;
+      src_shift = 0;
+      read_start = ref_len - cur_readlen + shift;
+    } else {
+      new_len = rg.max_readlen;
+      copy_start = 0;
+      copy_end = rg.max_readlen - shift;
+      src_shift = ref_len + shift - rg.max_readlen;
+      read_start = rg.max_readlen - cur_readlen;
+    }
+    const int read_end = std::min<int>(read_start + cur_readlen, new_len);
+    for (int j = 0; j < 4; j++) {
+      int *c = count[j];
+      if (src_shift != 0 && copy_end > copy_start)
+        std::memmove(c + copy_start, c + copy_start + src_shift,
+                     (copy_end - copy_start) * sizeof(int));
+      std::fill(c, c + copy_start, 0);
+      std::fill(c + copy_end, c + new_len, 0);
+      for (int i = read_start; i < read_end; i++)
+        c[i] += (current[i - read_start] == j);
     }
-    // find max of each position to get ref
+    ref_len = new_len;
 
+    // find max of each position to get ref (ties resolved in the order
+    // A, C, T, G)
+    const int *c0 = count[0], *c1 = count[1], *c2 = count[2], *c3 = count[3];
     for (int i = 0; i < ref_len; i++) {
-      int max = 0, indmax = 0;
-      for (int j = 0; j < 4; j++)
-        if (count[j][i] > max) {
-          max = count[j][i];
-          indmax = j;
-        }
-      current[i] = inttochar[indmax];
+      int max = c0[i];
+      uint8_t indmax = 0;
+      indmax = c2[i] > max ? 2 : indmax;
+      max = std::max(max, c2[i]);
+      indmax = c3[i] > max ? 3 : indmax;
+      max = std::max(max, c3[i]);
+      indmax = c1[i] > max ? 1 : indmax;
+      refcode[i] = indmax;
     }
   }
-  chartobitset<bitset_size>(current, ref_len, ref, rg.basemask);
-  char revcurrent[MAX_READ_LEN + 1];
-  reverse_complement(current, revcurrent, ref_len);
-  chartobitset<bitset_size>(revcurrent, ref_len, revref, rg.basemask);
 
+  // pack ref and its reverse complement
+  uint64_t *ref_words = bits_words(ref);
+  uint64_t *revref_words = bits_words(revref);
+  std::fill(ref_words, ref_words + num_words, 0);
+  std::fill(revref_words, revref_words + num_words, 0);
+  for (int i = 0; i < ref_len; i++) {
+    ref_words[i / 32] |= (uint64_t)refcode[i] << (2 * (i % 32));
+    int j = ref_len - 1 - i;
+    revref_words[j / 32] |= (uint64_t)(refcode[i] ^ 3) << (2 * (j % 32));
+  }
   return;
 }
 
 template <size_t bitset_size>
-void readDnaFile(std::bitset<bitset_size> *read, uint16_t *read_lengths,
+void readDnaFile(read_bits_array<bitset_size> read, uint16_t *read_lengths,
                  const reorder_global<bitset_size> &rg) {
-  std::ifstream f(rg.infile[0], std::ifstream::in|std::ios::binary);
+  buffered_ifstream f(rg.infile[0], std::ifstream::in|std::ios::binary);
   for (uint32_t i = 0; i < rg.numreads_array[0]; i++) {
     f.read((char*)&read_lengths[i],sizeof(uint16_t));
     uint16_t num_bytes_to_read = ((uint32_t)read_lengths[i]+4-1)/4;
-    f.read((char*)&read[i],num_bytes_to_read);
+    f.read((char*)bits_words(read[i]),num_bytes_to_read);
   }
   f.close();
   remove(rg.infile[0].c_str());
   if (rg.paired_end) {
-    std::ifstream f(rg.infile[1], std::ifstream::in|std::ios::binary);
+    buffered_ifstream f(rg.infile[1], std::ifstream::in|std::ios::binary);
     for (uint32_t i = rg.numreads_array[0]; i < rg.numreads_array[0] + rg.numreads_array[1]; i++) {
       f.read((char*)&read_lengths[i],sizeof(uint16_t));
       uint16_t num_bytes_to_read = ((uint32_t)read_lengths[i]+4-1)/4;
-      f.read((char*)&read[i],num_bytes_to_read);
+      f.read((char*)bits_words(read[i]),num_bytes_to_read);
     }
     f.close();
     remove(rg.infile[1].c_str());
@@ -244,39 +393,90 @@ void readDnaFile(std::bitset<bitset_size> *read, uint16_t *read_lengths,
 }
 
 template <size_t bitset_size>
-bool search_match(const std::bitset<bitset_size> &ref,
-                  std::bitset<bitset_size> *mask1, omp_lock_t *dict_lock,
-                  omp_lock_t *read_lock, std::bitset<bitset_size> **mask,
+void lookup_batch(read_bits_cref<bitset_size> ref,
+                  read_bits_cref<bitset_size> revref, bbhashdict *dict,
+                  omp_lock_t *dict_lock, read_bits_array<bitset_size> read,
+                  const int shift_begin, const int num_shifts,
+                  const int &ref_len, uint64_t *keys, uint64_t *bins,
+                  const reorder_global<bitset_size> &rg) {
+  // keys and bins of all dictionaries for the shifts shift_begin, ...,
+  // shift_begin + num_shifts - 1 of ref (forward) and revref (reverse), which
+  // are already shifted by shift_begin. Stored in the order [shift][rev][l],
+  // with bin UINT64_MAX when the dictionary is out of bounds for the shift.
+  // The lookups are independent and the bin headers, bin ends and first reads
+  // are prefetched in separate passes so that their cache misses overlap.
+  const int num_probes = num_shifts * 2 * rg.numdict;
+  for (int s = 0; s < num_shifts; s++) {
+    const int shift = shift_begin + s;
+    for (int rev = 0; rev < 2; rev++) {
+      for (int l = 0; l < rg.numdict; l++) {
+        const int idx = (2 * s + rev) * rg.numdict + l;
+        bins[idx] = UINT64_MAX;
+        int pos;
+        if (!rev) {
+          if (dict[l].end + shift >= ref_len) continue;
+          pos = 2 * (dict[l].start + s);
+        } else {
+          if (dict[l].end >= ref_len + shift || dict[l].start <= shift)
+            continue;
+          pos = 2 * (dict[l].start - s);
+        }
+        keys[idx] = extract_bits<bitset_size>(
+            rev ? revref : ref, pos, 2 * (dict[l].end - dict[l].start + 1));
+        bins[idx] = dict[l].lookup(keys[idx]);
+        if (bins[idx] >= dict[l].numkeys) continue;
+        __builtin_prefetch(&dict[l].startpos[bins[idx]]);
+        __builtin_prefetch(&dict[l].empty_bin[bins[idx]]);
+        if (dict_lock != NULL)
+          __builtin_prefetch(&dict_lock[bins[idx] & 0xFFFFFF]);
+      }
+    }
+  }
+  for (int idx = 0; idx < num_probes; idx++) {
+    const int l = idx % rg.numdict;
+    if (bins[idx] >= dict[l].numkeys) continue;
+    __builtin_prefetch(&dict[l].read_id[dict[l].startpos[bins[idx]]]);
+    __builtin_prefetch(&dict[l].read_id[dict[l].startpos[bins[idx] + 1] - 1]);
+  }
+  for (int idx = 0; idx < num_probes; idx++) {
+    const int l = idx % rg.numdict;
+    if (bins[idx] >= dict[l].numkeys) continue;
+    uint32_t rid = dict[l].read_id[dict[l].startpos[bins[idx]]];
+    if (rid < rg.numreads) prefetch_bitset<bitset_size>(read[rid]);
+  }
+  return;
+}
+
+template <size_t bitset_size>
+bool search_match(read_bits_cref<bitset_size> ref, const uint64_t *keys,
+                  const uint64_t *bins,
+                  read_bits<bitset_size> *mask1, omp_lock_t *dict_lock,
+                  omp_lock_t *read_lock, read_bits<bitset_size> *mask,
+                  read_bits<bitset_size> *shiftmask,
                   uint16_t *read_lengths, bool *remainingreads,
-                  std::bitset<bitset_size> *read, bbhashdict *dict, uint32_t &k,
+                  read_bits_array<bitset_size> read, bbhashdict *dict,
+                  uint32_t &k,
                   const bool rev, const int shift, const int &ref_len,
                   const reorder_global<bitset_size> &rg) {
-  static const unsigned int thresh = THRESH_REORDER;
-  const int maxsearch = MAX_SEARCH_REORDER;
-  std::bitset<bitset_size> b;
+  // keys and bins: per dictionary, from lookup_batch
+  const unsigned int thresh = rg.thresh;
+  const int maxsearch = rg.max_search;
   uint64_t ull;
   int64_t dictidx[2];    // to store the start and end index (end not inclusive)
                          // in the dict read_id array
   uint64_t startposidx;  // index in startpos
   bool flag = 0;
   for (int l = 0; l < rg.numdict; l++) {
-    // check if dictionary index is within bound
-    if (!rev) {
-      if (dict[l].end + shift >= ref_len) continue;
-    } else {
-      if (dict[l].end >= ref_len + shift || dict[l].start <= shift) continue;
-    }
-    b = ref & mask1[l];
-    ull = (b >> 2 * dict[l].start).to_ullong();
-    startposidx = dict[l].bphf->lookup(ull);
-    if (startposidx >= dict[l].numkeys)  // not found
+    startposidx = bins[l];
+    if (startposidx >= dict[l].numkeys)  // out of bounds or not found
       continue;
+    ull = keys[l];
     // check if any other thread is modifying same dictpos
-    if (!omp_test_lock(&dict_lock[startposidx & 0xFFFFFF])) continue;
+    if (!test_lock(dict_lock, startposidx & 0xFFFFFF)) continue;
     dict[l].findpos(dictidx, startposidx);
     if (dict[l].empty_bin[startposidx])  // bin is empty
     {
-      omp_unset_lock(&dict_lock[startposidx & 0xFFFFFF]);
+      unset_lock(dict_lock, startposidx & 0xFFFFFF);
       continue;
     }
     uint64_t ull1 =
@@ -287,93 +487,116 @@ bool search_match(const std::bitset<bitset_size> &ref,
       for (int64_t i = dictidx[1] - 1;
            i >= dictidx[0] && i >= dictidx[1] - maxsearch; i--) {
         auto rid = dict[l].read_id[i];
+        if (i - PREFETCH_DIST_REORDER >= dictidx[0])
+          prefetch_bitset<bitset_size>(
+              read[dict[l].read_id[i - PREFETCH_DIST_REORDER]]);
         size_t hamming;
         if (!rev)
           hamming = ((ref ^ read[rid]) &
-                     mask[0][rg.max_readlen -
-                             std::min<int>(ref_len - shift, read_lengths[rid])])
+                     mask[rg.max_readlen -
+                          std::min<int>(ref_len - shift, read_lengths[rid])])
                         .count();
         else
           hamming =
-              ((ref ^ read[rid]) &
-               mask[shift][rg.max_readlen -
-                           std::min<int>(ref_len + shift, read_lengths[rid])])
+              ((ref ^ read[rid]) & shiftmask[shift] &
+               mask[rg.max_readlen -
+                    std::min<int>(ref_len + shift, read_lengths[rid])])
                   .count();
         if (hamming <= thresh) {
-          if(!omp_test_lock(&read_lock[rid & 0xFFFFFF])) continue;
+          if(!test_lock(read_lock, rid & 0xFFFFFF)) continue;
           if (remainingreads[rid]) {
             remainingreads[rid] = 0;
             k = rid;
             flag = 1;
           }
-          omp_unset_lock(&read_lock[rid & 0xFFFFFF]);
+          unset_lock(read_lock, rid & 0xFFFFFF);
           if (flag == 1) break;
         }
       }
     }
-    omp_unset_lock(&dict_lock[startposidx & 0xFFFFFF]);
+    unset_lock(dict_lock, startposidx & 0xFFFFFF);
     if (flag == 1) break;
   }
   return flag;
 }
 
 template <size_t bitset_size>
-void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
-             uint16_t *read_lengths, const reorder_global<bitset_size> &rg) {
+uint32_t reorder(read_bits_array<bitset_size> read, bbhashdict *dicts,
+                 uint16_t *read_lengths, const reorder_global<bitset_size> &rg) {
+  // returns number of unmatched reads. dicts holds rg.num_dict_sets() sets of
+  // rg.numdict dictionaries.
   const uint32_t num_locks =
       NUM_LOCKS_REORDER;  // limits on number of locks (power of 2 for fast mod)
-  omp_lock_t *dict_lock = new omp_lock_t[num_locks];
-  omp_lock_t *read_lock = new omp_lock_t[num_locks];
-  omp_lock_t *remaining_read_lock = new omp_lock_t[num_locks];
+  // independent parts have their reads and dictionaries to themselves and
+  // need no locks (which, tested across parts, would make the search depend
+  // on thread timing)
+  const bool shared = !rg.independent_parts;
+  omp_lock_t *dict_lock = shared ? alloc_lock_array(num_locks) : NULL;
+  omp_lock_t *read_lock = shared ? alloc_lock_array(num_locks) : NULL;
   // lock for preventing two threads trying to pick same read when search_match fails.
   // for this lock we only test_lock because the thread currently in the region will
   // either pick the read or the read is unavailable so it's safe to move on.
-  for (unsigned int j = 0; j < num_locks; j++) {
-    omp_init_lock(&dict_lock[j]);
-    omp_init_lock(&read_lock[j]);
-    omp_init_lock(&remaining_read_lock[j]);
-  }
-  std::bitset<bitset_size> **mask =
-      new std::bitset<bitset_size> *[rg.max_readlen];
-  for (int i = 0; i < rg.max_readlen; i++)
-    mask[i] = new std::bitset<bitset_size>[rg.max_readlen];
+  omp_lock_t *remaining_read_lock = shared ? alloc_lock_array(num_locks) : NULL;
+  read_bits<bitset_size> *mask = new read_bits<bitset_size>[rg.max_readlen];
   generatemasks<bitset_size>(mask, rg.max_readlen, 2);
-  std::bitset<bitset_size> *mask1 = new std::bitset<bitset_size>[rg.numdict];
-  generateindexmasks<bitset_size>(mask1, dict, rg.numdict, 2);
-  bool *remainingreads = new bool[rg.numreads];
+  read_bits<bitset_size> *shiftmask =
+      new read_bits<bitset_size>[rg.max_readlen];
+  generateshiftmasks<bitset_size>(shiftmask, rg.max_readlen, 2);
+  read_bits<bitset_size> *mask1 = new read_bits<bitset_size>[rg.numdict];
+  generateindexmasks<bitset_size>(mask1, dicts, rg.numdict, 2);
+  bool *remainingreads = alloc_array<bool>(rg.numreads);
   std::fill(remainingreads, remainingreads + rg.numreads, 1);
+  if (rg.dup_flag != NULL) {
+    // duplicates are written along with the read they duplicate
+#pragma omp parallel for schedule(static)
+    for (int64_t i = 0; i < (int64_t)rg.numreads; i++)
+      if (rg.dup_flag[i]) remainingreads[i] = 0;
+  }
 
   // we go through remainingreads array from behind as that speeds up deletion
   // from bin arrays
 
-  uint32_t firstread = 0;
-  uint32_t *unmatched = new uint32_t[rg.num_thr];
-#pragma omp parallel
-  {
-    int tid = omp_get_thread_num();
-    std::string tid_str = std::to_string(tid);
-    boost::iostreams::filtering_ostream foutRC;
-    foutRC.push(boost::iostreams::gzip_compressor());
-    foutRC.push(boost::iostreams::file_sink(rg.outfileRC + '.' + tid_str));
-    boost::iostreams::filtering_ostream foutflag;
-    foutflag.push(boost::iostreams::gzip_compressor());
-    foutflag.push(boost::iostreams::file_sink(rg.outfileflag + '.' + tid_str));
-    boost::iostreams::filtering_ostream foutpos;
-    foutpos.push(boost::iostreams::gzip_compressor());
-    foutpos.push(boost::iostreams::file_sink(rg.outfilepos + '.' + tid_str, std::ios::binary));
-    std::ofstream foutorder(rg.outfileorder + '.' + tid_str, std::ios::binary);
-    std::ofstream foutorder_s(rg.outfileorder + ".singleton." + tid_str, std::ios::binary);
-    boost::iostreams::filtering_ostream foutlength;
-    foutlength.push(boost::iostreams::gzip_compressor());
-    foutlength.push(boost::iostreams::file_sink(rg.outfilereadlength + '.' + tid_str, std::ios::binary));
-
-    unmatched[tid] = 0;
-    std::bitset<bitset_size> ref, revref, b;
+  // first read of each part (-1 if the read is already taken, the part then
+  // gives up). Shared parts start spread out equally over the reads,
+  // independent parts at their first remaining read.
+  uint32_t *unmatched = new uint32_t[rg.num_parts];
+  std::vector<int64_t> firstread(rg.num_parts, -1);
+  for (int part = 0; part < rg.num_parts; part++) {
+    unmatched[part] = 0;
+    int64_t current = shared ? (int64_t)part * (rg.numreads / rg.num_parts)
+                             : rg.part_begin(part);
+    if (!shared)
+      while (current < rg.part_begin(part + 1) && remainingreads[current] == 0)
+        current++;
+    if (current >= (shared ? rg.numreads : rg.part_begin(part + 1)) ||
+        remainingreads[current] == 0)
+      continue;
+    remainingreads[current] = 0;
+    unmatched[part]++;
+    firstread[part] = current;
+  }
+  // with shared dictionaries, the num_thr parts run concurrently (one per
+  // thread)
+#pragma omp parallel for schedule(static, 1)
+  for (int part = 0; part < rg.num_parts; part++) {
+    bbhashdict *dict = dicts + (shared ? 0 : part * rg.numdict);
+    std::string tid_str = std::to_string(part);
+    temp_ofstream foutRC(rg.outfileRC + '.' + tid_str);
+    temp_ofstream foutflag(rg.outfileflag + '.' + tid_str);
+    temp_ofstream foutpos(rg.outfilepos + '.' + tid_str);
+    buffered_ofstream foutorder(rg.outfileorder + '.' + tid_str, std::ios::binary);
+    buffered_ofstream foutorder_s(rg.outfileorder + ".singleton." + tid_str, std::ios::binary);
+    temp_ofstream foutlength(rg.outfilereadlength + '.' + tid_str);
+
+    read_bits<bitset_size> ref, revref, b;
 
     int64_t first_rid;
     // first_rid represents first read of contig, used for left searching
 
     std::list<std::pair<uint32_t,uint64_t>> *to_delete_from_bin = new std::list<std::pair<uint32_t,uint64_t>> [rg.numdict];
+    // dictionary keys and bins of the current batch of shifts (lookup_batch)
+    std::vector<uint64_t> batch_keys(SEARCH_BATCH_REORDER * 2 * rg.numdict);
+    std::vector<uint64_t> batch_bins(SEARCH_BATCH_REORDER * 2 * rg.numdict);
 
     // variables for early stopping
     bool stop_searching = false;
@@ -399,42 +622,31 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
     // negative during left search or due to RC
     // useful for sorting according to starting position in the encoding stage.
 
+    // reads of the part, searched from behind for the next unmatched read
+    // when no match is found
+    const int64_t part_first = shared ? 0 : rg.part_begin(part);
     int64_t remainingpos =
-        rg.numreads -
-        1;  // used for searching next unmatched read when no match is found
-#pragma omp critical
-    {  // doing initial setup and first read
-      current = firstread;
-      // some fix below to make sure no errors occurs when we have very few
-      // reads (comparable to num_threads). basically if read already taken,
-      // this thread just gives up
-      if (rg.numreads == 0) {
-        done = true;
-      } else if (remainingreads[current] == 0) {
-        done = true;
-      } else {
-        remainingreads[current] = 0;
-        unmatched[tid]++;
-      }
-      firstread +=
-          rg.numreads / omp_get_num_threads();  // spread out first read equally
-    }
-#pragma omp barrier
+        (shared ? rg.numreads : rg.part_begin(part + 1)) - 1;
+    current = firstread[part];
+    done = (current == -1);
     if (!done) {
       updaterefcount<bitset_size>(read[current], ref, revref, count, true,
                                   false, 0, read_lengths[current], ref_len, rg);
       cur_read_pos = 0;
       ref_pos = 0;
       first_rid = current;
-      prev_unmatched = true;
+      prev_unmatched = !start_contig_with_duplicates<bitset_size>(
+          current, foutRC, foutorder, foutflag, foutpos, foutlength,
+          read_lengths, rg);
       prev = current;
     }
     while (!done) {
       if (num_reads_thr % 1000000 == 0) {
-        if (num_unmatched_past_1M_thr > STOP_CRITERIA_REORDER * 1000000) {
+        if (num_unmatched_past_1M_thr > rg.stop_criteria * 1000000) {
           stop_searching = true;
         }
         num_unmatched_past_1M_thr = 0;
+        if (part == 0) trim_mapped_pages();
       }
       num_reads_thr++;
       // delete reads from the bins that could not be deleted earlier due to lock contention
@@ -442,14 +654,14 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
         for (auto it = to_delete_from_bin[l].begin(); it != to_delete_from_bin[l].end(); ) {
           uint32_t rid = (*it).first;
           uint64_t startposidx = (*it).second;
-          if (!omp_test_lock(&dict_lock[startposidx & 0xFFFFFF])) {
+          if (!test_lock(dict_lock, startposidx & 0xFFFFFF)) {
             ++it;
             continue;
           }
 	  dict[l].findpos(dictidx, startposidx);
 	  dict[l].remove(dictidx, startposidx, rid);
 	  it = to_delete_from_bin[l].erase(it);
-	  omp_unset_lock(&dict_lock[startposidx & 0xFFFFFF]);
+	  unset_lock(dict_lock, startposidx & 0xFFFFFF);
 	}
       }
 
@@ -460,15 +672,15 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
           if (read_lengths[current] <= dict[l].end) continue;
           b = read[current] & mask1[l];
           ull = (b >> 2 * dict[l].start).to_ullong();
-          startposidx = dict[l].bphf->lookup(ull);
+          startposidx = dict[l].lookup(ull);
           // check if any other thread is modifying same dictpos
-          if (!omp_test_lock(&dict_lock[startposidx & 0xFFFFFF])) {
+          if (!test_lock(dict_lock, startposidx & 0xFFFFFF)) {
             to_delete_from_bin[l].push_back(std::make_pair(current, startposidx));
             continue;
           }
           dict[l].findpos(dictidx, startposidx);
           dict[l].remove(dictidx, startposidx, current);
-          omp_unset_lock(&dict_lock[startposidx & 0xFFFFFF]);
+          unset_lock(dict_lock, startposidx & 0xFFFFFF);
         }
       } else {
         left_search_start = false;
@@ -477,9 +689,16 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
       uint32_t k;
       if (!stop_searching)
         for (int shift = 0; shift < rg.maxshift; shift++) {
+          if (shift % SEARCH_BATCH_REORDER == 0)
+            lookup_batch<bitset_size>(
+                ref, revref, dict, dict_lock, read, shift,
+                std::min(SEARCH_BATCH_REORDER, rg.maxshift - shift), ref_len,
+                batch_keys.data(), batch_bins.data(), rg);
+          const int batch_idx = (shift % SEARCH_BATCH_REORDER) * 2 * rg.numdict;
           // find forward match
           flag = search_match<bitset_size>(
-              ref, mask1, dict_lock, read_lock, mask, read_lengths,
+              ref, &batch_keys[batch_idx], &batch_bins[batch_idx], mask1,
+              dict_lock, read_lock, mask, shiftmask, read_lengths,
               remainingreads, read, dict, k, false, shift, ref_len, rg);
           if (flag == 1) {
             current = k;
@@ -503,13 +722,16 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
               foutflag << 0;  // for unmatched
               int64_t zero = 0;
               foutpos.write((char*)&zero, sizeof(int64_t));
-              foutlength.write((char *)&read_lengths[prev], sizeof(uint16_t));
+              write_read_length(foutlength, prev, read_lengths, rg);
             }
             foutRC << (left_search ? 'r' : 'd');
             foutorder.write((char *)&current, sizeof(uint32_t));
             foutflag << 1;  // for matched
 	    foutpos.write((char*)&cur_read_pos, sizeof(int64_t));
-	    foutlength.write((char *)&read_lengths[current], sizeof(uint16_t));
+	    write_read_length(foutlength, current, read_lengths, rg);
+            write_duplicates<bitset_size>(
+                current, left_search ? 'r' : 'd', cur_read_pos, foutRC,
+                foutorder, foutflag, foutpos, foutlength, read_lengths, rg);
 
             prev_unmatched = false;
             break;
@@ -517,8 +739,10 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
 
           // find reverse match
           flag = search_match<bitset_size>(
-              revref, mask1, dict_lock, read_lock, mask, read_lengths,
-              remainingreads, read, dict, k, true, shift, ref_len, rg);
+              revref, &batch_keys[batch_idx + rg.numdict],
+              &batch_bins[batch_idx + rg.numdict], mask1, dict_lock, read_lock,
+              mask, shiftmask, read_lengths, remainingreads, read, dict, k,
+              true, shift, ref_len, rg);
           if (flag == 1) {
             current = k;
             int ref_len_old = ref_len;
@@ -541,13 +765,16 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
               foutflag << 0;  // for unmatched
               int64_t zero = 0;
 	      foutpos.write((char*)&zero, sizeof(int64_t));
-              foutlength.write((char *)&read_lengths[prev], sizeof(uint16_t));
+              write_read_length(foutlength, prev, read_lengths, rg);
             }
             foutRC << (left_search ? 'd' : 'r');
             foutorder.write((char *)&current, sizeof(uint32_t));
             foutflag << 1;  // for matched
 	    foutpos.write((char*)&cur_read_pos, sizeof(int64_t));
-            foutlength.write((char *)&read_lengths[current], sizeof(uint16_t));
+            write_read_length(foutlength, current, read_lengths, rg);
+            write_duplicates<bitset_size>(
+                current, left_search ? 'd' : 'r', cur_read_pos, foutRC,
+                foutorder, foutflag, foutpos, foutlength, read_lengths, rg);
 
             prev_unmatched = false;
             break;
@@ -573,20 +800,20 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
                 // contig
         {
           left_search = false;
-          for (int64_t j = remainingpos; j >= 0; j--) {
+          for (int64_t j = remainingpos; j >= part_first; j--) {
             if (remainingreads[j] == 1) {
-              if(!omp_test_lock(&remaining_read_lock[j & 0xffffff])) continue;
-              omp_set_lock(&read_lock[j & 0xffffff]);
+              if(!test_lock(remaining_read_lock, j & 0xffffff)) continue;
+              set_lock(read_lock, j & 0xffffff);
               if (remainingreads[j])  // checking again inside critical block
               {
                 current = j;
                 remainingpos = j - 1;
                 remainingreads[j] = 0;
                 flag = 1;
-                unmatched[tid]++;
+                unmatched[part]++;
               }
-              omp_unset_lock(&read_lock[j & 0xffffff]);
-              omp_unset_lock(&remaining_read_lock[j & 0xffffff]);
+              unset_lock(read_lock, j & 0xffffff);
+              unset_lock(remaining_read_lock, j & 0xffffff);
               if (flag == 1) break;
             }
           }
@@ -607,7 +834,9 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
             {
               foutorder_s.write((char *)&prev, sizeof(uint32_t));
             }
-            prev_unmatched = true;
+            prev_unmatched = !start_contig_with_duplicates<bitset_size>(
+                current, foutRC, foutorder, foutflag, foutpos, foutlength,
+                read_lengths, rg);
             first_rid = current;
             prev = current;
           }
@@ -615,52 +844,47 @@ void reorder(std::bitset<bitset_size> *read, bbhashdict *dict,
       }
     }  // while (!done) end
 
-    foutRC.pop();
+    foutRC.close();
     foutorder.close();
-    foutflag.pop();
-    foutpos.pop();
+    foutflag.close();
+    foutpos.close();
     foutorder_s.close();
-    foutlength.pop();
+    foutlength.close();
     for (int i = 0; i < 4; i++) delete[] count[i];
     delete[] count;
     delete[] to_delete_from_bin;
-  }  // parallel end
+  }  // parts end
 
-  delete[] remainingreads;
-  delete[] dict_lock;
-  delete[] read_lock;
-  delete[] remaining_read_lock;
-  std::cout << "Reordering done, "
-            << std::accumulate(unmatched, unmatched + rg.num_thr, 0)
-            << " were unmatched\n";
-  for (int i = 0; i < rg.max_readlen; i++) delete[] mask[i];
+  free_array(remainingreads, rg.numreads);
+  free_lock_array(dict_lock, num_locks);
+  free_lock_array(read_lock, num_locks);
+  free_lock_array(remaining_read_lock, num_locks);
+  uint32_t num_unmatched =
+      std::accumulate(unmatched, unmatched + rg.num_parts, 0);
+  std::cout << "Reordering done, " << num_unmatched << " were unmatched\n";
   delete[] mask;
+  delete[] shiftmask;
   delete[] mask1;
   delete[] unmatched;
-  return;
+  return num_unmatched;
 }
 
 template <size_t bitset_size>
-void writetofile(std::bitset<bitset_size> *read, uint16_t *read_lengths,
+void writetofile(read_bits_array<bitset_size> read, uint16_t *read_lengths,
                  reorder_global<bitset_size> &rg) {
-  std::vector<uint32_t> numreads_s_thr(rg.num_thr, 0);
-// convert bitset to string for all num_thr files in parallel
-#pragma omp parallel
-  {
-    int tid = omp_get_thread_num();
+  std::vector<uint32_t> numreads_s_thr(rg.num_parts, 0);
+// convert bitset to string for all num_parts files in parallel
+#pragma omp parallel for schedule(dynamic)
+  for (int tid = 0; tid < rg.num_parts; tid++) {
     std::string tid_str = std::to_string(tid);
-    std::ofstream fout(rg.outfile + '.' + tid_str, std::ofstream::out|std::ios::binary);
-    std::ofstream fout_s(rg.outfile + ".singleton." + tid_str,
-                         std::ofstream::out|std::ios::binary);
-    std::ifstream finRC(rg.outfileRC + '.' + tid_str, std::ifstream::in);
-    boost::iostreams::filtering_streambuf<boost::iostreams::input> inbufRC;
-    inbufRC.push(boost::iostreams::gzip_decompressor());
-    inbufRC.push(finRC);
-    std::istream inRC(&inbufRC);
-    std::ifstream finorder(rg.outfileorder + '.' + tid_str,
-                           std::ifstream::in | std::ios::binary);
-    std::ifstream finorder_s(rg.outfileorder + ".singleton." + tid_str,
-                             std::ifstream::in | std::ios::binary);
+    buffered_ofstream fout(rg.outfile + '.' + tid_str, std::ofstream::out|std::ios::binary);
+    buffered_ofstream fout_s(rg.outfile + ".singleton." + tid_str,
+                             std::ofstream::out|std::ios::binary);
+    temp_ifstream inRC(rg.outfileRC + '.' + tid_str);
+    buffered_ifstream finorder(rg.outfileorder + '.' + tid_str,
+                               std::ifstream::in | std::ios::binary);
+    buffered_ifstream finorder_s(rg.outfileorder + ".singleton." + tid_str,
+                                 std::ifstream::in | std::ios::binary);
     char s[MAX_READ_LEN + 1], s1[MAX_READ_LEN + 1];
     uint32_t current;
     char c;
@@ -669,47 +893,49 @@ void writetofile(std::bitset<bitset_size> *read, uint16_t *read_lengths,
       finorder.read((char *)&current, sizeof(uint32_t));
       if (c == 'd') {
         uint16_t num_bytes_to_write = ((uint32_t)read_lengths[current] + 4 - 1)/4;
-	fout.write((char*)&read_lengths[current],sizeof(uint16_t));
-	fout.write((char*)&read[current], num_bytes_to_write);
+        if (!rg.fixed_readlen)
+          fout.write((char *)&read_lengths[current], sizeof(uint16_t));
+	fout.write((char*)bits_words(read[current]), num_bytes_to_write);
       } else {
 	bitsettostring<bitset_size>(read[current], s, read_lengths[current], rg);
 	reverse_complement(s, s1, read_lengths[current]);
-	write_dna_in_bits(s1, fout);
+	write_dna_in_bits(s1, fout, !rg.fixed_readlen);
       }
     }
     finorder_s.read((char *)&current, sizeof(uint32_t));
     while (!finorder_s.eof()) {
       numreads_s_thr[tid]++;
       uint16_t num_bytes_to_write = ((uint32_t)read_lengths[current] + 4 - 1)/4;
-      fout_s.write((char*)&read_lengths[current],sizeof(uint16_t));
-      fout_s.write((char*)&read[current], num_bytes_to_write);
+      if (!rg.fixed_readlen)
+        fout_s.write((char *)&read_lengths[current], sizeof(uint16_t));
+      fout_s.write((char*)bits_words(read[current]), num_bytes_to_write);
       finorder_s.read((char *)&current, sizeof(uint32_t));
     }
     fout.close();
     fout_s.close();
-    finRC.close();
+    inRC.close();
     finorder.close();
     finorder_s.close();
   }
 
   uint32_t numreads_s = 0;
-  for (int i = 0; i < rg.num_thr; i++)
+  for (int i = 0; i < rg.num_parts; i++)
     numreads_s += numreads_s_thr[i];
   // write numreads_s to a file
-  std::ofstream fout_s_count(rg.outfile + ".singleton"+".count", std::ofstream::out|std::ios::binary);
+  buffered_ofstream fout_s_count(rg.outfile + ".singleton"+".count", std::ofstream::out|std::ios::binary);
   fout_s_count.write((char*)&numreads_s, sizeof(uint32_t));
   fout_s_count.close();
 
-  // Now combine the num_thr order files
-  std::ofstream fout_s(rg.outfile + ".singleton", std::ofstream::out|std::ios::binary);
-  std::ofstream foutorder_s(rg.outfileorder + ".singleton",
-                            std::ofstream::out | std::ios::binary);
-  for (int tid = 0; tid < rg.num_thr; tid++) {
+  // Now combine the num_parts order files
+  buffered_ofstream fout_s(rg.outfile + ".singleton", std::ofstream::out|std::ios::binary);
+  buffered_ofstream foutorder_s(rg.outfileorder + ".singleton",
+                                std::ofstream::out | std::ios::binary);
+  for (int tid = 0; tid < rg.num_parts; tid++) {
     std::string tid_str = std::to_string(tid);
-    std::ifstream fin_s(rg.outfile + ".singleton." + tid_str,
-                        std::ifstream::in|std::ios::binary);
-    std::ifstream finorder_s(rg.outfileorder + ".singleton." + tid_str,
-                             std::ifstream::in | std::ios::binary);
+    buffered_ifstream fin_s(rg.outfile + ".singleton." + tid_str,
+                            std::ifstream::in|std::ios::binary);
+    buffered_ifstream finorder_s(rg.outfileorder + ".singleton." + tid_str,
+                                 std::ifstream::in | std::ios::binary);
 
     fout_s << fin_s.rdbuf();  // write entire file
     foutorder_s << finorder_s.rdbuf();
@@ -730,9 +956,252 @@ void writetofile(std::bitset<bitset_size> *read, uint16_t *read_lengths,
 }
 
 template <size_t bitset_size>
-void reorder_main(const std::string &temp_dir, const compression_params &cp) {
+void restore_read_ids(const reorder_global<bitset_size> &rg) {
+  // translate the read ids in the order files back from the key order of the
+  // out-of-core mode to the original ids
+  std::vector<std::string> files;
+  for (int tid = 0; tid < rg.num_parts; tid++)
+    files.push_back(rg.outfileorder + '.' + std::to_string(tid));
+  files.push_back(rg.outfileorder + ".singleton");
+#pragma omp parallel for schedule(dynamic)
+  for (size_t f = 0; f < files.size(); f++) {
+    std::fstream forder(files[f],
+                        std::ios::in | std::ios::out | std::ios::binary);
+    forder.seekg(0, forder.end);
+    uint64_t num_ids = forder.tellg() / sizeof(uint32_t);
+    forder.seekg(0, forder.beg);
+    std::vector<uint32_t> ids(num_ids);
+    forder.read((char *)ids.data(), num_ids * sizeof(uint32_t));
+    for (uint32_t &id : ids) id = rg.orig_id[id];
+    forder.seekp(0, forder.beg);
+    forder.write((char *)ids.data(), num_ids * sizeof(uint32_t));
+    forder.close();
+  }
+}
+
+template <size_t bitset_size>
+void set_dict_layout(reorder_global<bitset_size> &rg, const int numdict,
+                     int dict_len) {
+  // numdict contiguous dictionaries of dict_len bases centered in the read
+  if (numdict * dict_len > rg.max_readlen)
+    dict_len = std::max(rg.max_readlen / numdict, 1);
+  int start = std::max(rg.max_readlen / 2 - numdict * dict_len / 2, 0);
+  if (start + numdict * dict_len > rg.max_readlen)
+    start = rg.max_readlen - numdict * dict_len;
+  rg.numdict = numdict;
+  rg.dict_start.resize(numdict);
+  rg.dict_end.resize(numdict);
+  for (int j = 0; j < numdict; j++) {
+    rg.dict_start[j] = start + j * dict_len;
+    rg.dict_end[j] = start + (j + 1) * dict_len - 1;
+  }
+  return;
+}
+
+template <size_t bitset_size>
+void set_reorder_config(reorder_global<bitset_size> &rg,
+                        const reorder_params &rp) {
+  rg.max_search = rp.max_search > 0 ? rp.max_search : MAX_SEARCH_REORDER;
+  rg.thresh = rp.thresh >= 0 ? rp.thresh : THRESH_REORDER;
+  rg.maxshift = rp.max_shift > 0 ? std::min(rp.max_shift, rg.max_readlen)
+                                 : rg.max_readlen / 2;
+  rg.stop_criteria =
+      rp.stop_criteria >= 0 ? rp.stop_criteria : STOP_CRITERIA_REORDER;
+  if (!rp.dict_positions.empty()) {
+    rg.dict_start.clear();
+    rg.dict_end.clear();
+    size_t i = 0;
+    while (i < rp.dict_positions.size()) {
+      size_t j = rp.dict_positions.find(',', i);
+      if (j == std::string::npos) j = rp.dict_positions.size();
+      std::string range = rp.dict_positions.substr(i, j - i);
+      size_t dash = range.find('-');
+      if (dash == std::string::npos)
+        throw std::runtime_error("Invalid dictionary range: " + range);
+      rg.dict_start.push_back(std::stoi(range.substr(0, dash)));
+      rg.dict_end.push_back(std::stoi(range.substr(dash + 1)));
+      i = j + 1;
+    }
+    rg.numdict = rg.dict_start.size();
+  } else {
+    int dict_len = rg.max_readlen > 100 ? MAX_DICT_LEN_REORDER
+                                        : rg.max_readlen * 32 / 100;
+    if (rp.dict_len > 0) dict_len = rp.dict_len;
+    set_dict_layout(rg, rp.num_dict > 0 ? rp.num_dict : NUM_DICT_REORDER,
+                    std::max(dict_len, 1));
+  }
+  for (int j = 0; j < rg.numdict; j++)
+    if (rg.dict_start[j] < 0 || rg.dict_end[j] < rg.dict_start[j] ||
+        rg.dict_end[j] >= rg.max_readlen ||
+        rg.dict_end[j] - rg.dict_start[j] + 1 > MAX_DICT_LEN_REORDER)
+      throw std::runtime_error(
+          "Invalid dictionary range " + std::to_string(rg.dict_start[j]) +
+          "-" + std::to_string(rg.dict_end[j]) + " for max read length " +
+          std::to_string(rg.max_readlen));
+  return;
+}
+
+template <size_t bitset_size>
+bbhashdict *make_dictionaries(const reorder_global<bitset_size> &rg) {
+  bbhashdict *dict = new bbhashdict[rg.num_dict_sets() * rg.numdict];
+  for (int i = 0; i < rg.num_dict_sets(); i++) {
+    for (int j = 0; j < rg.numdict; j++) {
+      dict[i * rg.numdict + j].start = rg.dict_start[j];
+      dict[i * rg.numdict + j].end = rg.dict_end[j];
+    }
+  }
+  return dict;
+}
+
+// fill the dictionaries of make_dictionaries() with the reads (of each part
+// for independent parts), leaving out the reads with exclude[i] != 0
+template <size_t bitset_size>
+void construct_dictionaries(read_bits_array<bitset_size> read,
+                            bbhashdict *dict, uint16_t *read_lengths,
+                            const reorder_global<bitset_size> &rg,
+                            const uint8_t *exclude = NULL) {
+  if (!rg.independent_parts) {
+    constructdictionary<bitset_size>(read, dict, read_lengths, rg.numdict,
+                                     rg.numreads, 2, rg.basedir, rg.num_thr,
+                                     exclude);
+    return;
+  }
+  for (int part = 0; part < rg.num_parts; part++) {
+    if (rg.part_begin(part) == rg.part_begin(part + 1)) continue;
+    constructdictionary<bitset_size>(read, dict + part * rg.numdict,
+                                     read_lengths, rg.numdict,
+                                     rg.part_begin(part + 1), 2, rg.basedir,
+                                     rg.num_thr, exclude, rg.part_begin(part));
+  }
+}
+
+template <size_t bitset_size>
+std::string describe_reorder_config(const reorder_global<bitset_size> &rg) {
+  std::string s = "dictionaries";
+  for (int j = 0; j < rg.numdict; j++)
+    s += (j == 0 ? " " : ",") + std::to_string(rg.dict_start[j]) + "-" +
+         std::to_string(rg.dict_end[j]);
+  s += ", max search " + std::to_string(rg.max_search) + ", max shift " +
+       std::to_string(rg.maxshift);
+  return s;
+}
+
+template <size_t bitset_size>
+void autotune_reorder(read_bits_array<bitset_size> read, uint16_t *read_lengths,
+                      reorder_global<bitset_size> &rg,
+                      const reorder_params &rp) {
+  // run reorder on a sample of the reads with a few variations of the current
+  // config and keep the fastest one among those with (nearly) the best match
+  // rate. Options fixed by the user are not varied.
+  const uint32_t sample_numreads =
+      std::min<uint32_t>(rg.numreads, AUTOTUNE_SAMPLE_REORDER);
+  if (sample_numreads < 1000) return;  // too few reads for meaningful timing
+
+  reorder_global<bitset_size> *trial_rg_pointer =
+      new reorder_global<bitset_size>();
+  reorder_global<bitset_size> &trial_rg = *trial_rg_pointer;
+  trial_rg.basedir = rg.basedir + "/autotune";
+  boost::filesystem::create_directory(trial_rg.basedir);
+  trial_rg.outfile = trial_rg.basedir + "/temp.dna";
+  trial_rg.outfileRC = trial_rg.basedir + "/read_rev.txt";
+  trial_rg.outfileflag = trial_rg.basedir + "/tempflag.txt";
+  trial_rg.outfilepos = trial_rg.basedir + "/temppos.txt";
+  trial_rg.outfileorder = trial_rg.basedir + "/read_order.bin";
+  trial_rg.outfilereadlength = trial_rg.basedir + "/read_lengths.bin";
+  trial_rg.max_readlen = rg.max_readlen;
+  trial_rg.num_thr = rg.num_thr;
+  trial_rg.independent_parts = rg.independent_parts;
+  trial_rg.num_parts = rg.independent_parts
+                           ? deterministic_num_parts(sample_numreads)
+                           : rg.num_parts;
+  trial_rg.paired_end = false;
+  trial_rg.fixed_readlen = rg.fixed_readlen;
+  trial_rg.numreads = sample_numreads;
+  trial_rg.numreads_array[0] = sample_numreads;
+  trial_rg.numreads_array[1] = 0;
+  trial_rg.stop_criteria = rg.stop_criteria;
+  trial_rg.thresh = rg.thresh;
+  setglobalarrays(trial_rg);
+
+  struct trial_config {
+    std::vector<int> dict_start, dict_end;
+    int max_search, maxshift;
+  };
+  std::vector<trial_config> configs;
+  configs.push_back({rg.dict_start, rg.dict_end, rg.max_search, rg.maxshift});
+  const bool layout_fixed =
+      !rp.dict_positions.empty() || rp.num_dict > 0 || rp.dict_len > 0;
+  if (!layout_fixed) {
+    const int dict_len = rg.dict_end[0] - rg.dict_start[0] + 1;
+    std::vector<std::pair<int, int>> layouts = {
+        {1, dict_len}, {rg.numdict + 1, dict_len}, {rg.numdict, dict_len * 2 / 3}};
+    for (auto &layout : layouts) {
+      if (layout.second < 12 || layout.first * layout.second > rg.max_readlen)
+        continue;
+      set_dict_layout(trial_rg, layout.first, layout.second);
+      configs.push_back({trial_rg.dict_start, trial_rg.dict_end,
+                         rg.max_search, rg.maxshift});
+    }
+  }
+  if (rp.max_search <= 0) {
+    configs.push_back(
+        {rg.dict_start, rg.dict_end, rg.max_search / 5, rg.maxshift});
+    configs.push_back(
+        {rg.dict_start, rg.dict_end, rg.max_search * 5, rg.maxshift});
+  }
+  if (rp.max_shift <= 0 && rg.maxshift > 1)
+    configs.push_back(
+        {rg.dict_start, rg.dict_end, rg.max_search, rg.maxshift / 2});
+
+  std::cout << "Autotuning reorder on " << sample_numreads << " reads\n";
+  std::vector<double> match_rate(configs.size()), throughput(configs.size());
+  for (size_t c = 0; c < configs.size(); c++) {
+    trial_rg.numdict = configs[c].dict_start.size();
+    trial_rg.dict_start = configs[c].dict_start;
+    trial_rg.dict_end = configs[c].dict_end;
+    trial_rg.max_search = configs[c].max_search;
+    trial_rg.maxshift = configs[c].maxshift;
+    auto trial_start = std::chrono::steady_clock::now();
+    bbhashdict *dict = make_dictionaries(trial_rg);
+    construct_dictionaries<bitset_size>(read, dict, read_lengths, trial_rg);
+    uint32_t num_unmatched =
+        reorder<bitset_size>(read, dict, read_lengths, trial_rg);
+    delete[] dict;
+    auto trial_end = std::chrono::steady_clock::now();
+    double seconds =
+        std::chrono::duration<double>(trial_end - trial_start).count();
+    match_rate[c] = 1.0 - (double)num_unmatched / sample_numreads;
+    throughput[c] = sample_numreads / std::max(seconds, 1e-6);
+    std::cout << "Config " << c << " (" << describe_reorder_config(trial_rg)
+              << "): match rate " << match_rate[c] << ", "
+              << (uint64_t)throughput[c] << " reads/s\n";
+  }
+  boost::filesystem::remove_all(trial_rg.basedir);
+  delete trial_rg_pointer;
+
+  double best_match_rate =
+      *std::max_element(match_rate.begin(), match_rate.end());
+  size_t best = configs.size();
+  if (rp.deterministic)  // timings vary between runs, use the match rate only
+    best = std::max_element(match_rate.begin(), match_rate.end()) -
+           match_rate.begin();
+  for (size_t c = 0; c < configs.size() && !rp.deterministic; c++) {
+    if (match_rate[c] < best_match_rate - AUTOTUNE_MATCH_TOL_REORDER) continue;
+    if (best == configs.size() || throughput[c] > throughput[best]) best = c;
+  }
+  rg.numdict = configs[best].dict_start.size();
+  rg.dict_start = configs[best].dict_start;
+  rg.dict_end = configs[best].dict_end;
+  rg.max_search = configs[best].max_search;
+  rg.maxshift = configs[best].maxshift;
+  return;
+}
+
+template <size_t bitset_size>
+void reorder_main(const std::string &temp_dir, const compression_params &cp,
+                  const int &num_parts, const reorder_params &rp) {
   reorder_global<bitset_size> *rg_pointer =
-      new reorder_global<bitset_size>(cp.max_readlen);
+      new reorder_global<bitset_size>();
   reorder_global<bitset_size> &rg = *rg_pointer;
   rg.basedir = temp_dir;
   rg.infile[0] = rg.basedir + "/input_clean_1.dna";
@@ -746,17 +1215,11 @@ void reorder_main(const std::string &temp_dir, const compression_params &cp) {
 
   rg.max_readlen = cp.max_readlen;
   rg.num_thr = cp.num_thr;
+  rg.num_parts = num_parts;
+  rg.independent_parts = rp.deterministic;
   rg.paired_end = cp.paired_end;
-  rg.maxshift = rg.max_readlen / 2;
-  bbhashdict *dict = new bbhashdict[rg.numdict];
-  dict[0].start = rg.max_readlen > 100
-                      ? rg.max_readlen / 2 - 32
-                      : rg.max_readlen / 2 - rg.max_readlen * 32 / 100;
-  dict[0].end = rg.max_readlen / 2 - 1;
-  dict[1].start = rg.max_readlen / 2;
-  dict[1].end = rg.max_readlen > 100
-                    ? rg.max_readlen / 2 - 1 + 32
-                    : rg.max_readlen / 2 - 1 + rg.max_readlen * 32 / 100;
+  rg.fixed_readlen = cp.fixed_readlen;
+  set_reorder_config(rg, rp);
 
   rg.numreads = cp.num_reads_clean[0] + cp.num_reads_clean[1];
   rg.numreads_array[0] = cp.num_reads_clean[0];
@@ -764,23 +1227,47 @@ void reorder_main(const std::string &temp_dir, const compression_params &cp) {
 
   omp_set_num_threads(rg.num_thr);
   setglobalarrays(rg);
-  std::bitset<bitset_size> *read = new std::bitset<bitset_size>[rg.numreads];
-  uint16_t *read_lengths = new uint16_t[rg.numreads];
+  read_bits_array<bitset_size> read =
+      read_bits_traits<bitset_size>::alloc(rg.numreads);
+  uint16_t *read_lengths = alloc_array<uint16_t>(rg.numreads);
   std::cout << "Reading file\n";
   readDnaFile<bitset_size>(read, read_lengths, rg);
 
+  if (rp.autotune) autotune_reorder<bitset_size>(read, read_lengths, rg, rp);
+  std::cout << "Reorder config: " << describe_reorder_config(rg) << "\n";
+  bbhashdict *dict = make_dictionaries(rg);
+  if (is_mapped(read)) {
+    std::cout << "Out-of-core mode: reads are memory-mapped, ordering them "
+                 "by dictionary key\n";
+    rg.orig_id = alloc_array<uint32_t>(rg.numreads);
+    key_order<bitset_size>(read, read_lengths, dict[0], 2, 0, rg.numreads,
+                           rg.orig_id);
+    read = permute_array(read, rg.orig_id, rg.numreads);
+    read_lengths = permute_array(read_lengths, rg.orig_id, rg.numreads);
+  }
+  uint32_t num_dups = find_duplicates<bitset_size>(read, read_lengths, rg);
+  std::cout << "Found " << num_dups << " exact duplicate reads\n";
   if (rg.numreads > 0) {
     std::cout << "Constructing dictionaries\n";
-    constructdictionary<bitset_size>(read, dict, read_lengths, rg.numdict,
-                                     rg.numreads, 2, rg.basedir, rg.num_thr);
+    construct_dictionaries<bitset_size>(read, dict, read_lengths, rg,
+                                        rg.dup_flag);
+    numa_report("reads", bits_words(read[0]),
+                rg.numreads * read_bits_traits<bitset_size>::num_words() * 8);
+    for (int j = 0; j < rg.numdict; j++)
+      numa_report("dictionary " + std::to_string(j) + " read ids",
+                  dict[j].read_id, dict[j].dict_numreads * sizeof(uint32_t));
   }
   std::cout << "Reordering reads\n";
   reorder<bitset_size>(read, dict, read_lengths, rg);
   std::cout << "Writing to file\n";
   writetofile<bitset_size>(read, read_lengths, rg);
-  delete[] read;
+  if (rg.orig_id != NULL) restore_read_ids(rg);
+  free_array(rg.orig_id, rg.numreads);
+  free_array(rg.dup_flag, rg.numreads);
+  free_array(rg.dup_next, rg.numreads);
+  free_array(read, rg.numreads);
   delete[] dict;
-  delete[] read_lengths;
+  free_array(read_lengths, rg.numreads);
   delete rg_pointer;
   std::cout << "Done!\n";
 }
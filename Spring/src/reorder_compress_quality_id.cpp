@@ -19,19 +19,38 @@ limitations under the License.
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include "id_compression/include/sam_block.h"
 #include "libbsc/bsc.h"
+#include "memory_util.h"
+#include "permute.h"
 #include "reorder_compress_quality_id.h"
 #include "util.h"
 
 namespace spring {
 
+uint32_t *read_order_quality_id(const std::string &temp_dir,
+                                const compression_params &cp) {
+  std::string file_order = temp_dir + "/read_order.bin";
+  uint32_t *order_array;
+  // array containing index mapping position in original fastq to
+  // position after reordering
+  if (cp.paired_end) {
+    order_array = new uint32_t[cp.num_reads / 2];
+    generate_order_pe(file_order, order_array, cp.num_reads, cp.num_thr);
+  } else {
+    order_array = new uint32_t[cp.num_reads];
+    generate_order_se(file_order, order_array, cp.num_reads, cp.num_thr);
+  }
+  return order_array;
+}
+
 void reorder_compress_quality_id(const std::string &temp_dir,
-                                 const compression_params &cp) {
+                                 const compression_params &cp,
+                                 uint32_t *order_array) {
   // Read some parameters
   uint32_t numreads = cp.num_reads;
-  int num_thr = cp.num_thr;
   bool preserve_id = cp.preserve_id;
   bool preserve_quality = cp.preserve_quality;
   bool paired_end = cp.paired_end;
@@ -40,7 +59,6 @@ void reorder_compress_quality_id(const std::string &temp_dir,
 
   std::string basedir = temp_dir;
 
-  std::string file_order = basedir + "/read_order.bin";
   std::string file_id[2];
   std::string file_quality[2];
   file_id[0] = basedir + "/id_1";
@@ -48,24 +66,21 @@ void reorder_compress_quality_id(const std::string &temp_dir,
   file_quality[0] = basedir + "/quality_1";
   file_quality[1] = basedir + "/quality_2";
 
-  uint32_t *order_array;
-  // array containing index mapping position in original fastq to
-  // position after reordering
-  if (paired_end) {
-    order_array = new uint32_t[numreads / 2];
-    generate_order_pe(file_order, order_array, numreads);
-  } else {
-    order_array = new uint32_t[numreads];
-    generate_order_se(file_order, order_array, numreads);
-  }
-
-  omp_set_num_threads(num_thr);
-
   uint32_t str_array_size =
       (1 + (numreads / 4 - 1) / num_reads_per_block) * num_reads_per_block;
   // smallest multiple of num_reads_per_block bigger than numreads/4
   // numreads/4 chosen so that these many qualities/ids can be stored in
   // memory without exceeding the RAM consumption of reordering stage
+  // (fewer under a memory limit, the files are then read in more passes)
+  uint64_t bytes_per_str = sizeof(std::string) + cp.max_readlen + 1;
+  uint32_t str_array_budget =
+      items_within_budget(bytes_per_str, num_reads_per_block, str_array_size) /
+      num_reads_per_block * num_reads_per_block;
+  if (str_array_budget < str_array_size) {
+    std::cout << "Memory limit: reordering qualities/ids in bins of "
+              << str_array_budget << " reads\n";
+    str_array_size = str_array_budget;
+  }
   std::string *str_array = new std::string[str_array_size];
   // array to load ids and/or qualities into
 
@@ -74,7 +89,7 @@ void reorder_compress_quality_id(const std::string &temp_dir,
     for (int j = 0; j < 2; j++) {
       if (!paired_end && j == 1) break;
       uint32_t num_reads_per_file = paired_end ? numreads / 2 : numreads;
-      reorder_compress(file_quality[j], num_reads_per_file, num_thr,
+      reorder_compress(file_quality[j], num_reads_per_file,
                        num_reads_per_block, str_array, str_array_size,
                        order_array, "quality", cp);
       remove(file_quality[j].c_str());
@@ -86,46 +101,36 @@ void reorder_compress_quality_id(const std::string &temp_dir,
       if (!paired_end && j == 1) break;
       if (j == 1 && paired_id_match) break;
       uint32_t num_reads_per_file = paired_end ? numreads / 2 : numreads;
-      reorder_compress(file_id[j], num_reads_per_file, num_thr,
+      reorder_compress(file_id[j], num_reads_per_file,
                        num_reads_per_block, str_array, str_array_size,
                        order_array, "id", cp);
       remove(file_id[j].c_str());
     }
   }
 
-  delete[] order_array;
   delete[] str_array;
   return;
 }
 
 void generate_order_pe(const std::string &file_order, uint32_t *order_array,
-                       const uint32_t &numreads) {
-  std::ifstream fin_order(file_order, std::ios::binary);
-  uint32_t order;
-  uint32_t pos_after_reordering = 0;
-  uint32_t numreads_by_2 = numreads / 2;
-  for (uint32_t i = 0; i < numreads; i++) {
-    fin_order.read((char *)&order, sizeof(uint32_t));
-    if (order < numreads_by_2) {
-      order_array[order] = pos_after_reordering++;
-    }
-  }
-  fin_order.close();
+                       const uint32_t &numreads, const int &num_thr) {
+  // position after reordering among the reads of file 1
+  uint32_t *order = alloc_array<uint32_t>(numreads);
+  read_uint32_file(file_order, order, numreads);
+  invert_order(order, numreads, numreads / 2, order_array, num_thr);
+  free_array(order, numreads);
 }
 
 void generate_order_se(const std::string &file_order, uint32_t *order_array,
-                       const uint32_t &numreads) {
-  std::ifstream fin_order(file_order, std::ios::binary);
-  uint32_t order;
-  for (uint32_t i = 0; i < numreads; i++) {
-    fin_order.read((char *)&order, sizeof(uint32_t));
-    order_array[order] = i;
-  }
-  fin_order.close();
+                       const uint32_t &numreads, const int &num_thr) {
+  uint32_t *order = alloc_array<uint32_t>(numreads);
+  read_uint32_file(file_order, order, numreads);
+  invert_order(order, numreads, numreads, order_array, num_thr);
+  free_array(order, numreads);
 }
 
 void reorder_compress(const std::string &file_name,
-                      const uint32_t &num_reads_per_file, const int &num_thr,
+                      const uint32_t &num_reads_per_file,
                       const uint32_t &num_reads_per_block,
                       std::string *str_array, const uint32_t &str_array_size,
                       uint32_t *order_array, const std::string &mode,
@@ -137,32 +142,61 @@ void reorder_compress(const std::string &file_name,
     if (num_reads_bin == 0) break;
     uint32_t start_read_bin = i * str_array_size;
     uint32_t end_read_bin = i * str_array_size + num_reads_bin;
-    // Read the file and pick up lines corresponding to this bin
-    std::ifstream f_in(file_name);
-    std::string temp_str;
-    for (uint32_t i = 0; i < num_reads_per_file; i++) {
-      std::getline(f_in, temp_str);
-      if (order_array[i] >= start_read_bin && order_array[i] < end_read_bin)
-        str_array[order_array[i] - start_read_bin] = temp_str;
+    // Read the file and pick up lines corresponding to this bin. The file is
+    // read in batches of QUALITY_ID_BATCH_BYTES, the lines of a batch are
+    // split on this thread and copied to their places in parallel.
+    std::ifstream f_in(file_name, std::ios::binary);
+    std::vector<char> buf;
+    std::vector<uint64_t> line_end;
+    uint64_t carry = 0;  // bytes of an incomplete line from the last batch
+    uint32_t read_num = 0;
+    while (read_num < num_reads_per_file) {
+      buf.resize(carry + QUALITY_ID_BATCH_BYTES);
+      f_in.read(buf.data() + carry, QUALITY_ID_BATCH_BYTES);
+      uint64_t len = carry + f_in.gcount();
+      bool last_batch = f_in.gcount() < QUALITY_ID_BATCH_BYTES;
+      line_end.clear();
+      const char *p = buf.data(), *q;
+      while (read_num + line_end.size() < num_reads_per_file &&
+             (q = (const char *)memchr(p, '\n', buf.data() + len - p))) {
+        line_end.push_back(q - buf.data());
+        p = q + 1;
+      }
+      if (last_batch && read_num + line_end.size() < num_reads_per_file &&
+          p < buf.data() + len) {
+        line_end.push_back(len);  // no newline after the last line
+        p = buf.data() + len;
+      }
+      parallel_blocks(
+          line_end.size(), cp.num_thr,
+          [&](const uint64_t start, const uint64_t end) {
+            for (uint64_t k = start; k < end; k++) {
+              uint32_t order = order_array[read_num + k];
+              if (order < start_read_bin || order >= end_read_bin) continue;
+              uint64_t line_start = k == 0 ? 0 : line_end[k - 1] + 1;
+              str_array[order - start_read_bin].assign(
+                  buf.data() + line_start, line_end[k] - line_start);
+            }
+          },
+          QUALITY_ID_LINES_PER_TASK);
+      read_num += line_end.size();
+      if (last_batch) break;
+      carry = buf.data() + len - p;
+      std::memmove(buf.data(), p, carry);
     }
     f_in.close();
-#pragma omp parallel
-    {
-      uint64_t tid = omp_get_thread_num();
-      uint64_t block_num_offset = start_read_bin / num_reads_per_block;
-      uint64_t block_num = tid;
-      uint32_t *read_lengths_array = NULL;
-      if (mode == "quality")
-        read_lengths_array = new uint32_t[num_reads_per_block];
-      bool done = false;
-      while (!done) {
+    // one task per block, run by the team of the enclosing parallel region
+    uint64_t block_num_offset = start_read_bin / num_reads_per_block;
+    uint64_t num_blocks_bin =
+        (num_reads_bin + num_reads_per_block - 1) / num_reads_per_block;
+#pragma omp taskgroup
+    for (uint64_t block_num = 0; block_num < num_blocks_bin; block_num++) {
+#pragma omp task default(shared) firstprivate(block_num)
+      {
         uint64_t start_read_num = block_num * num_reads_per_block;
-        uint64_t end_read_num = (block_num + 1) * num_reads_per_block;
-        if (start_read_num >= num_reads_bin) break;
-        if (end_read_num >= num_reads_bin) {
-          done = true;
-          end_read_num = num_reads_bin;
-        }
+        uint64_t end_read_num =
+            std::min<uint64_t>((block_num + 1) * num_reads_per_block,
+                               num_reads_bin);
         uint32_t num_reads_block = (uint32_t)(end_read_num - start_read_num);
         std::string outfile_name =
             file_name + "." + std::to_string(block_num_offset + block_num);
@@ -172,19 +206,19 @@ void reorder_compress(const std::string &file_name,
                             num_reads_block);
         } else {
           // store lengths in array for quality compression
+          std::vector<uint32_t> read_lengths_array(num_reads_block);
           for (uint64_t i = 0; i < num_reads_block; i++)
             read_lengths_array[i] = str_array[start_read_num + i].size();
           if (cp.qvz_flag)
             quantize_quality_qvz(str_array + start_read_num, num_reads_block,
-                                 read_lengths_array, cp.qvz_ratio);
+                                 read_lengths_array.data(), cp.qvz_ratio);
           bsc::BSC_str_array_compress(outfile_name.c_str(),
                                       str_array + start_read_num,
-                                      num_reads_block, read_lengths_array);
+                                      num_reads_block,
+                                      read_lengths_array.data());
         }
-        block_num += num_thr;
       }
-      if (mode == "quality") delete[] read_lengths_array;
-    }  // omp parallel
+    }  // omp taskgroup
   }
 }
 
@@ -20,17 +20,26 @@ limitations under the License.
 
 namespace spring {
 
+// order_array[i] is the position after reordering of read i of the input
+// (of file 1 for PE). It is read from read_order.bin, so this must be called
+// before pe_encode() rewrites that file.
+uint32_t *read_order_quality_id(const std::string &temp_dir,
+                                const compression_params &cp);
+
+// The blocks are compressed as tasks: call from within a parallel region to
+// have them spread over its threads.
 void reorder_compress_quality_id(const std::string &temp_dir,
-                                 const compression_params &cp);
+                                 const compression_params &cp,
+                                 uint32_t *order_array);
 
 void generate_order_pe(const std::string &file_order, uint32_t *order_array,
-                       const uint32_t &numreads);
+                       const uint32_t &numreads, const int &num_thr);
 
 void generate_order_se(const std::string &file_order, uint32_t *order_array,
-                       const uint32_t &numreads);
+                       const uint32_t &numreads, const int &num_thr);
 
 void reorder_compress(const std::string &file_name,
-                      const uint32_t &num_reads_per_file, const int &num_thr,
+                      const uint32_t &num_reads_per_file,
                       const uint32_t &num_reads_per_block,
                       std::string *str_array, const uint32_t &str_array_size,
                       uint32_t *order_array, const std::string &mode,
@@ -15,6 +15,7 @@ This code is a modified version of SPRING, originally developed by the Universit
 */
 
 #include <omp.h>
+#include <algorithm>
 #include <cmath>  // abs
 #include <cstdio>
 #include <cstring> // memcpy
@@ -25,6 +26,7 @@ This code is a modified version of SPRING, originally developed by the Universit
 #include <vector>
 
 #include "libbsc/bsc.h"
+#include "memory_util.h"
 #include "reorder_compress_streams.h"
 #include "util.h"
 
@@ -40,6 +42,9 @@ void reorder_compress_streams(const std::string &temp_dir,
   // 2: both reads unaligned (SE read unaligned)
   // 3: first read aligned, second not
   // 4: first read unaligned, second aligned
+  // 5: read (both reads for PE) same as the previous one in the block, nothing
+  // else is stored for it, not even the read length
+  // 6: (SE only) reverse complement of the previous read in the block
   std::string file_pos = basedir + "/read_pos.bin";
   // For order preserving mode PE (SE):
   // Flag 0: Store position of first read (Store pos of read)
@@ -66,7 +71,7 @@ void reorder_compress_streams(const std::string &temp_dir,
   // otherwise store 1
   std::string file_readlength = basedir + "/read_lengths.bin";
   // store read length with 2 bytes for all reads (for PE, store for both
-  // reads by interleaving)
+  // reads by interleaving), not stored if all reads have the same length
   std::string file_unaligned = basedir + "/read_unaligned.txt";
   // store unaligned reads without any newlines
   std::string file_noise = basedir + "/read_noise.txt";
@@ -78,22 +83,30 @@ void reorder_compress_streams(const std::string &temp_dir,
   // load some params
   uint32_t num_reads = cp.num_reads, num_reads_aligned = 0, num_reads_unaligned;
   uint32_t num_reads_by_2 = num_reads / 2;
-  int num_thr = cp.num_thr;
   bool paired_end = cp.paired_end;
   bool preserve_order = cp.preserve_order;
+  // length of all reads, 0 if they do not have the same length
+  const uint16_t fixed_readlen = cp.fixed_readlen ? cp.max_readlen : 0;
 
-  char *RC_arr = new char[num_reads];
-  uint16_t *read_length_arr = new uint16_t[num_reads];
-  bool *flag_arr = new bool[num_reads];
-  uint64_t *pos_in_noise_arr = new uint64_t[num_reads];
-  uint64_t *pos_arr = new uint64_t[num_reads];
-  uint16_t *noise_len_arr = new uint16_t[num_reads];
+  // per-read arrays are spilled to memory-mapped files when they do not fit
+  // under the memory limit
+  char *RC_arr = alloc_mapped_array<char>(num_reads);
+  uint16_t *read_length_arr =
+      fixed_readlen ? NULL : alloc_mapped_array<uint16_t>(num_reads);
+  auto read_length_of = [&](const uint64_t i) -> uint16_t {
+    return fixed_readlen ? fixed_readlen : read_length_arr[i];
+  };
+  bool *flag_arr = alloc_mapped_array<bool>(num_reads);
+  uint64_t *pos_in_noise_arr = alloc_mapped_array<uint64_t>(num_reads);
+  uint64_t *pos_arr = alloc_mapped_array<uint64_t>(num_reads);
+  uint16_t *noise_len_arr = alloc_mapped_array<uint16_t>(num_reads);
 
   // read streams for aligned reads
   std::ifstream f_order;
   if (paired_end || preserve_order) f_order.open(file_order, std::ios::binary);
   std::ifstream f_RC(file_RC);
-  std::ifstream f_readlength(file_readlength, std::ios::binary);
+  std::ifstream f_readlength;
+  if (!fixed_readlen) f_readlength.open(file_readlength, std::ios::binary);
   std::ifstream f_noise(file_noise);
   std::ifstream f_noisepos(file_noisepos, std::ios::binary);
   std::ifstream f_pos(file_pos, std::ios::binary);
@@ -101,8 +114,8 @@ void reorder_compress_streams(const std::string &temp_dir,
   uint64_t noise_array_size = f_noisepos.tellg() / 2;
   f_noisepos.seekg(0, f_noisepos.beg);
   // divide by 2 because we have 2 bytes per noise
-  char *noise_arr = new char[noise_array_size];
-  uint16_t *noisepos_arr = new uint16_t[noise_array_size];
+  char *noise_arr = alloc_mapped_array<char>(noise_array_size);
+  uint16_t *noisepos_arr = alloc_mapped_array<uint16_t>(noise_array_size);
   char rc, noise_char;
   uint32_t order = 0;
   uint64_t current_pos_noise_arr = 0;
@@ -114,10 +127,12 @@ void reorder_compress_streams(const std::string &temp_dir,
   while (f_RC.get(rc)) {
     if (paired_end || preserve_order)
       f_order.read((char *)&order, sizeof(uint32_t));
-    f_readlength.read((char *)&read_length, sizeof(uint16_t));
+    if (!fixed_readlen) {
+      f_readlength.read((char *)&read_length, sizeof(uint16_t));
+      read_length_arr[order] = read_length;
+    }
     f_pos.read((char *)&pos, sizeof(uint64_t));
     RC_arr[order] = rc;
-    read_length_arr[order] = read_length;
     flag_arr[order] = true;  // aligned
     pos_arr[order] = pos;
     pos_in_noise_arr[order] = current_pos_noise_arr;
@@ -150,7 +165,7 @@ void reorder_compress_streams(const std::string &temp_dir,
   f_unaligned_count.read((char*)&unaligned_array_size, sizeof(uint64_t));
   f_unaligned_count.close();
   remove(file_unaligned_count.c_str());
-  char *unaligned_arr = new char[unaligned_array_size];
+  char *unaligned_arr = alloc_mapped_array<char>(unaligned_array_size);
   std::ifstream f_unaligned(file_unaligned, std::ios::binary);
   std::string unaligned_read;
   uint64_t pos_in_unaligned_arr = 0;
@@ -164,15 +179,19 @@ void reorder_compress_streams(const std::string &temp_dir,
   for (uint32_t i = 0; i < num_reads_unaligned; i++) {
     if (paired_end || preserve_order)
       f_order.read((char *)&order, sizeof(uint32_t));
-    f_readlength.read((char *)&read_length, sizeof(uint16_t));
-    read_length_arr[order] = read_length;
+    if (fixed_readlen) {
+      read_length = fixed_readlen;
+    } else {
+      f_readlength.read((char *)&read_length, sizeof(uint16_t));
+      read_length_arr[order] = read_length;
+    }
     pos_arr[order] = current_pos_in_unaligned_arr;
     current_pos_in_unaligned_arr += read_length;
     flag_arr[order] = false;  // unaligned
     if (!(paired_end || preserve_order)) order++;
   }
   if (paired_end || preserve_order) f_order.close();
-  f_readlength.close();
+  if (!fixed_readlen) f_readlength.close();
 
   // delete old streams
   remove(file_noise.c_str());
@@ -184,7 +203,6 @@ void reorder_compress_streams(const std::string &temp_dir,
   remove(file_pos.c_str());
 
   // Now generate new streams and compress blocks in parallel
-  omp_set_num_threads(num_thr);
   uint32_t num_reads_per_block = cp.num_reads_per_block;
 
   // ***************
@@ -199,28 +217,39 @@ void reorder_compress_streams(const std::string &temp_dir,
   std::string tmpfile_unaligned = basedir + "/f";
   std::string tmpfile_readlength = basedir + "/g";
 
-// this is actually number of read pairs per block for PE
-#pragma omp parallel
-  {
-    uint64_t tid = omp_get_thread_num();
-    uint64_t block_num = tid;
-    bool done = false;
-    while (!done) {
+  // 1 if reads a and b decode to the same string, 2 if a is the reverse
+  // complement of b (aligned reads only), 0 otherwise
+  auto duplicate_of = [&](const uint64_t a, const uint64_t b) -> int {
+    if (read_length_of(a) != read_length_of(b) || flag_arr[a] != flag_arr[b])
+      return 0;
+    if (!flag_arr[a])
+      return std::memcmp(unaligned_arr + pos_arr[a], unaligned_arr + pos_arr[b],
+                         read_length_of(a)) == 0;
+    if (pos_arr[a] != pos_arr[b] || noise_len_arr[a] != noise_len_arr[b])
+      return 0;
+    for (uint16_t j = 0; j < noise_len_arr[a]; j++)
+      if (noise_arr[pos_in_noise_arr[a] + j] !=
+              noise_arr[pos_in_noise_arr[b] + j] ||
+          noisepos_arr[pos_in_noise_arr[a] + j] !=
+              noisepos_arr[pos_in_noise_arr[b] + j])
+        return 0;
+    return (RC_arr[a] == RC_arr[b]) ? 1 : 2;
+  };
+
+  // One task per block, which writes the streams of the block and leaves
+  // the zpaq compression of each stream to a task of its own. The tasks are
+  // run by the team of the enclosing parallel region (see compress_segment()).
+  // this is actually number of read pairs per block for PE
+  uint64_t num_reads_blocks = paired_end ? num_reads_by_2 : num_reads;
+  uint64_t num_blocks =
+      (num_reads_blocks + num_reads_per_block - 1) / num_reads_per_block;
+#pragma omp taskgroup
+  for (uint64_t block_num = 0; block_num < num_blocks; block_num++) {
+#pragma omp task default(shared) firstprivate(block_num)
+    {
       uint64_t start_read_num = block_num * num_reads_per_block;
-      uint64_t end_read_num = (block_num + 1) * num_reads_per_block;
-      if (!paired_end) {
-        if (start_read_num >= num_reads) break;
-        if (end_read_num >= num_reads) {
-          done = true;
-          end_read_num = num_reads;
-        }
-      } else {
-        if (start_read_num >= num_reads_by_2) break;
-        if (end_read_num >= num_reads_by_2) {
-          done = true;
-          end_read_num = num_reads_by_2;
-        }
-      }
+      uint64_t end_read_num = std::min<uint64_t>(
+          (block_num + 1) * num_reads_per_block, num_reads_blocks);
       // Open files
       std::ofstream f_flag(tmpfile_flag + '.' + std::to_string(block_num));
       std::ofstream f_noise(tmpfile_noise + '.' + std::to_string(block_num));
@@ -231,8 +260,10 @@ void reorder_compress_streams(const std::string &temp_dir,
       std::ofstream f_RC(tmpfile_RC + '.' + std::to_string(block_num));
       std::ofstream f_unaligned(tmpfile_unaligned + '.' +
                                 std::to_string(block_num));
-      std::ofstream f_readlength(
-          tmpfile_readlength + '.' + std::to_string(block_num), std::ios::binary);
+      std::ofstream f_readlength;
+      if (!fixed_readlen)
+        f_readlength.open(tmpfile_readlength + '.' + std::to_string(block_num),
+                          std::ios::binary);
       std::ofstream f_pos_pair;
       std::ofstream f_RC_pair;
       if (paired_end) {
@@ -246,7 +277,13 @@ void reorder_compress_streams(const std::string &temp_dir,
       // Write streams
       for (uint64_t i = start_read_num; i < end_read_num; i++) {
         if (!paired_end) {
-          f_readlength.write((char *)&read_length_arr[i], sizeof(uint16_t));
+          int dup = (i > start_read_num) ? duplicate_of(i, i - 1) : 0;
+          if (dup != 0) {
+            f_flag << (dup == 1 ? '5' : '6');
+            continue;
+          }
+          if (!fixed_readlen)
+            f_readlength.write((char *)&read_length_arr[i], sizeof(uint16_t));
           if (flag_arr[i] == true) {
             f_flag << '0';
             f_RC << RC_arr[i];
@@ -279,12 +316,20 @@ void reorder_compress_streams(const std::string &temp_dir,
             f_noise << "\n";
           } else {
             f_flag << '2';
-            f_unaligned.write(unaligned_arr + pos_arr[i], read_length_arr[i]);
+            f_unaligned.write(unaligned_arr + pos_arr[i], read_length_of(i));
           }
         } else {
           uint64_t i_p = num_reads_by_2 + i;  // i_pair
-          f_readlength.write((char *)&read_length_arr[i], sizeof(uint16_t));
-          f_readlength.write((char *)&read_length_arr[i_p], sizeof(uint16_t));
+          if (i > start_read_num && duplicate_of(i, i - 1) == 1 &&
+              duplicate_of(i_p, i_p - 1) == 1) {
+            f_flag << '5';
+            continue;
+          }
+          if (!fixed_readlen) {
+            f_readlength.write((char *)&read_length_arr[i], sizeof(uint16_t));
+            f_readlength.write((char *)&read_length_arr[i_p],
+                               sizeof(uint16_t));
+          }
           int64_t pos_pair = (int64_t)pos_arr[i_p] - (int64_t)pos_arr[i];
           int flag;
           if (flag_arr[i] && flag_arr[i_p] && std::abs(pos_pair) < 32767)
@@ -338,7 +383,7 @@ void reorder_compress_streams(const std::string &temp_dir,
             f_RC << RC_arr[i];
           } else {
             // read 1 is unaligned
-            f_unaligned.write(unaligned_arr + pos_arr[i], read_length_arr[i]);
+            f_unaligned.write(unaligned_arr + pos_arr[i], read_length_of(i));
           }
 
           if (flag == 0 || flag == 1 || flag == 4) {
@@ -357,7 +402,7 @@ void reorder_compress_streams(const std::string &temp_dir,
           } else {
             // read 2 is unaligned
             f_unaligned.write(unaligned_arr + pos_arr[i_p],
-                              read_length_arr[i_p]);
+                              read_length_of(i_p));
           }
         }
       }
@@ -369,85 +414,52 @@ void reorder_compress_streams(const std::string &temp_dir,
       f_pos.close();
       f_RC.close();
       f_unaligned.close();
-      f_readlength.close();
+      if (!fixed_readlen) f_readlength.close();
       if (paired_end) {
         f_pos_pair.close();
         f_RC_pair.close();
       }
 
       // Compress files with zpaq and remove uncompressed files
-      std::string infile_zpaq = tmpfile_flag + '.' + std::to_string(block_num);
-      std::string outfile_zpaq = file_flag + '.' + std::to_string(block_num) + ".zpaq";
-      std::string compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-      system(compress_cmd.c_str());
-      remove(infile_zpaq.c_str());
-
       // TODO: Test impact of packing pos file into
       // minimum number of bits
-      infile_zpaq = tmpfile_pos + '.' + std::to_string(block_num);
-      outfile_zpaq = file_pos + '.' + std::to_string(block_num) + ".zpaq";
-      compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-      system(compress_cmd.c_str());
-      remove(infile_zpaq.c_str());
-
-      infile_zpaq = tmpfile_noise + '.' + std::to_string(block_num);
-      outfile_zpaq = file_noise + '.' + std::to_string(block_num) + ".zpaq";
-      compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-      system(compress_cmd.c_str());
-      remove(infile_zpaq.c_str());
-
-      infile_zpaq = tmpfile_noisepos + '.' + std::to_string(block_num);
-      outfile_zpaq = file_noisepos + '.' + std::to_string(block_num) + ".zpaq";
-      compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-      system(compress_cmd.c_str());
-      remove(infile_zpaq.c_str());
-
-      infile_zpaq = tmpfile_unaligned + '.' + std::to_string(block_num);
-      outfile_zpaq = file_unaligned + '.' + std::to_string(block_num) + ".zpaq";
-      compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-      system(compress_cmd.c_str());
-      remove(infile_zpaq.c_str());
-
-      infile_zpaq = tmpfile_readlength + '.' + std::to_string(block_num);
-      outfile_zpaq = file_readlength + '.' + std::to_string(block_num) + ".zpaq";
-      compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-      system(compress_cmd.c_str());
-      remove(infile_zpaq.c_str());
-
-      infile_zpaq = tmpfile_RC + '.' + std::to_string(block_num);
-      outfile_zpaq = file_RC + '.' + std::to_string(block_num) + ".zpaq";
-      compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-      system(compress_cmd.c_str());
-      remove(infile_zpaq.c_str());
-
+      std::string block_str = '.' + std::to_string(block_num);
+      std::vector<std::pair<std::string, std::string>> zpaq_files = {
+          {tmpfile_flag + block_str, file_flag + block_str},
+          {tmpfile_pos + block_str, file_pos + block_str},
+          {tmpfile_noise + block_str, file_noise + block_str},
+          {tmpfile_noisepos + block_str, file_noisepos + block_str},
+          {tmpfile_unaligned + block_str, file_unaligned + block_str},
+          {tmpfile_RC + block_str, file_RC + block_str}};
+      if (!fixed_readlen)
+        zpaq_files.push_back(
+            {tmpfile_readlength + block_str, file_readlength + block_str});
       if (paired_end) {
-          infile_zpaq = file_pos_pair + '.' + std::to_string(block_num);
-          outfile_zpaq = infile_zpaq + ".zpaq";
-          compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-          system(compress_cmd.c_str());
-          remove(infile_zpaq.c_str());
-
-          infile_zpaq = file_RC_pair + '.' + std::to_string(block_num);
-          outfile_zpaq = infile_zpaq + ".zpaq";
-          compress_cmd = "zpaq add " + outfile_zpaq + " " + infile_zpaq + " -method 5";
-          system(compress_cmd.c_str());
-          remove(infile_zpaq.c_str());
+        zpaq_files.push_back(
+            {file_pos_pair + block_str, file_pos_pair + block_str});
+        zpaq_files.push_back(
+            {file_RC_pair + block_str, file_RC_pair + block_str});
+      }
+      for (auto zpaq_file : zpaq_files) {
+#pragma omp task firstprivate(zpaq_file)
+        {
+          zpaq_compress(zpaq_file.first, zpaq_file.second + ".zpaq");
+          remove(zpaq_file.first.c_str());
+        }
       }
-
-      block_num += num_thr;
     }
-  }  // end omp parallel
+  }  // omp taskgroup
 
   // deallocate
-  delete[] RC_arr;
-  delete[] read_length_arr;
-  delete[] flag_arr;
-  delete[] pos_in_noise_arr;
-  delete[] pos_arr;
-  delete[] noise_len_arr;
-  delete[] noise_arr;
-  delete[] noisepos_arr;
-  delete[] unaligned_arr;
+  free_array(RC_arr, num_reads);
+  free_array(read_length_arr, num_reads);
+  free_array(flag_arr, num_reads);
+  free_array(pos_in_noise_arr, num_reads);
+  free_array(pos_arr, num_reads);
+  free_array(noise_len_arr, num_reads);
+  free_array(noise_arr, noise_array_size);
+  free_array(noisepos_arr, noise_array_size);
+  free_array(unaligned_arr, unaligned_array_size);
 
   return;
 }
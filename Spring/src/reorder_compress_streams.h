@@ -20,6 +20,8 @@ limitations under the License.
 
 namespace spring {
 
+// The blocks and their zpaq compression are tasks: call from within a
+// parallel region to have them spread over its threads.
 void reorder_compress_streams(const std::string &temp_dir,
                               const compression_params &cp);
 
@@ -26,9 +26,12 @@ This code is a modified version of SPRING, originally developed by the Universit
 #include <string>
 #include <vector>
 
+#include "bitset_util.h"
+#include "buffered_io.h"
 #include "call_template_functions.h"
 #include "decompress.h"
 #include "encoder.h"
+#include "memory_util.h"
 #include "params.h"
 #include "pe_encode.h"
 #include "preprocess.h"
@@ -40,18 +43,145 @@ This code is a modified version of SPRING, originally developed by the Universit
 
 namespace spring {
 
+// compress the next segment of the input into seg_dir, returns true if reads
+// are left for another segment
+static bool compress_segment(const std::string &seg_dir,
+                             preprocess_input &input, compression_params &cp,
+                             const uint64_t &max_reads, const bool &fasta_flag,
+                             const bool &deep_flag, const reorder_params &rp,
+                             const encoder_params &ep) {
+  std::cout << "Preprocessing ...\n";
+  auto preprocess_start = std::chrono::steady_clock::now();
+  bool more_reads = preprocess(input, seg_dir, cp, fasta_flag, max_reads);
+  auto preprocess_end = std::chrono::steady_clock::now();
+  std::cout << "Preprocessing done!\n";
+  std::cout << "Time for this step: "
+            << std::chrono::duration_cast<std::chrono::seconds>(
+                   preprocess_end - preprocess_start)
+                   .count()
+            << " s\n";
+  std::cout << "Temporary directory size: " << get_directory_size(seg_dir) << "\n";
+
+  // reorder and encoder split the reads into parts searched concurrently, so
+  // their output depends on the thread count and on thread timing. With
+  // --deterministic the number of parts only depends on the number of reads
+  // and each part is searched on its own. All other stages work on blocks of
+  // fixed size and give the same output for any number of threads.
+  const int num_parts = rp.deterministic
+                            ? deterministic_num_parts(cp.num_reads)
+                            : cp.num_thr;
+  if (!cp.long_flag) {
+    std::cout << "Reordering ...\n";
+    auto reorder_start = std::chrono::steady_clock::now();
+    io_stats reorder_io = get_io_stats();
+    call_reorder(seg_dir, cp, num_parts, rp);
+    auto reorder_end = std::chrono::steady_clock::now();
+    std::cout << "Reordering done!\n";
+    std::cout << "Time for this step: "
+              << std::chrono::duration_cast<std::chrono::seconds>(reorder_end -
+                                                                  reorder_start)
+                     .count()
+              << " s\n";
+    print_io_stats(reorder_io);
+
+    std::cout << "seg_dir size: " << get_directory_size(seg_dir) << "\n";
+
+    std::cout << "Encoding ...\n";
+    auto encoder_start = std::chrono::steady_clock::now();
+    io_stats encoder_io = get_io_stats();
+    call_encoder(seg_dir, cp, num_parts, ep, deep_flag);
+    auto encoder_end = std::chrono::steady_clock::now();
+    std::cout << "Encoding done!\n";
+    std::cout << "Time for this step: "
+              << std::chrono::duration_cast<std::chrono::seconds>(encoder_end -
+                                                                  encoder_start)
+                     .count()
+              << " s\n";
+    print_io_stats(encoder_io);
+    std::cout << "Temporary directory size: " << get_directory_size(seg_dir) << "\n";
+
+    // The remaining stages share one team of threads and submit their blocks
+    // as tasks, so that blocks of one stage fill the idle threads at the
+    // tail of another: quality/id compression only needs the order of the
+    // reads and runs alongside pe_encode and the read streams. Under a memory
+    // limit the stages run one after the other as their arrays are sized for
+    // the memory left.
+    const bool rcqi_flag =
+        !cp.preserve_order && (cp.preserve_quality || cp.preserve_id);
+    uint32_t *rcqi_order = NULL;
+    if (rcqi_flag) rcqi_order = read_order_quality_id(seg_dir, cp);
+    const bool overlap = (get_memory_limit() == 0);
+    std::cout << "Compressing streams ...\n";
+    auto streams_start = std::chrono::steady_clock::now();
+#pragma omp parallel num_threads(cp.num_thr)
+#pragma omp single
+    {
+      if (rcqi_flag) {
+#pragma omp task
+        {
+          reorder_compress_quality_id(seg_dir, cp, rcqi_order);
+#pragma omp critical(stage_log)
+          std::cout << "Reordering and compressing quality and/or ids done!\n";
+        }
+        if (!overlap) {
+#pragma omp taskwait
+        }
+      }
+#pragma omp task
+      {
+        if (!cp.preserve_order && cp.paired_end) {
+          pe_encode(seg_dir, cp);
+#pragma omp critical(stage_log)
+          std::cout << "Encoding pairing information done!\n";
+        }
+        reorder_compress_streams(seg_dir, cp);
+#pragma omp critical(stage_log)
+        std::cout << "Reordering and compressing streams done!\n";
+      }
+    }
+    delete[] rcqi_order;
+    auto streams_end = std::chrono::steady_clock::now();
+    std::cout << "Compressing streams done!\n";
+    std::cout << "Time for this step: "
+              << std::chrono::duration_cast<std::chrono::seconds>(streams_end -
+                                                                  streams_start)
+                     .count()
+              << " s\n";
+    std::cout << "Temporary directory size: " << get_directory_size(seg_dir) << "\n";
+  }
+
+  // Write compression params to a file (the decoder takes cp.num_thr as the
+  // number of read_seq.bin parts and picks its own number of threads)
+  cp.num_thr = num_parts;
+  cp.format_version = ARCHIVE_FORMAT_VERSION;
+  std::string compression_params_file = seg_dir + "/cp.bin";
+  std::ofstream f_cp(compression_params_file, std::ios::binary);
+  f_cp.write((char *)&cp, sizeof(compression_params));
+  f_cp.close();
+  return more_reads;
+}
+
 void compress(const std::string &temp_dir,
               const std::vector<std::string> &infile_vec,
               const std::vector<std::string> &outfile_vec, const int &num_thr,
               const bool &pairing_only_flag, const bool &no_quality_flag,
               const bool &no_ids_flag,
               const std::vector<std::string> &quality_opts,
-              const bool &long_flag, const bool &gzip_flag, const bool &fasta_flag, const bool &deep_flag, const int &gpu_id) {
+              const bool &long_flag, const bool &gzip_flag, const bool &fasta_flag, const bool &deep_flag,
+              const std::string &numa_policy, const std::string &huge_pages,
+              const double &max_memory_gb, const std::string &dict_backend,
+              const bool &out_of_core_flag, const uint64_t &max_reads_segment,
+              const reorder_params &rp, const encoder_params &ep) {
   //
   // Ensure that omp parallel regions are executed with the requested
   // #threads.
   //
   omp_set_dynamic(0);
+  init_memory_policy(parse_numa_policy(numa_policy),
+                     parse_huge_pages(huge_pages),
+                     (uint64_t)(max_memory_gb * 1024 * 1024 * 1024));
+  init_out_of_core(temp_dir, out_of_core_flag);
+  set_dict_backend(parse_dict_backend(dict_backend));
 
   std::cout << "Starting compression...\n";
   auto compression_start = std::chrono::steady_clock::now();
@@ -137,90 +267,40 @@ void compress(const std::string &temp_dir,
     }
   }
 
-  std::cout << "Preprocessing ...\n";
-  auto preprocess_start = std::chrono::steady_clock::now();
-  preprocess(infile_1, infile_2, temp_dir, cp, gzip_flag, fasta_flag);
-  auto preprocess_end = std::chrono::steady_clock::now();
-  std::cout << "Preprocessing done!\n";
-  std::cout << "Time for this step: "
-            << std::chrono::duration_cast<std::chrono::seconds>(
-                   preprocess_end - preprocess_start)
-                   .count()
-            << " s\n";
-  std::cout << "Temporary directory size: " << get_directory_size(temp_dir) << "\n";
-
-  if (!long_flag) {
-    std::cout << "Reordering ...\n";
-    auto reorder_start = std::chrono::steady_clock::now();
-    call_reorder(temp_dir, cp);
-    auto reorder_end = std::chrono::steady_clock::now();
-    std::cout << "Reordering done!\n";
-    std::cout << "Time for this step: "
-              << std::chrono::duration_cast<std::chrono::seconds>(reorder_end -
-                                                                  reorder_start)
-                     .count()
-              << " s\n";
-
-    std::cout << "temp_dir size: " << get_directory_size(temp_dir) << "\n";
-
-    std::cout << "Encoding ...\n";
-    auto encoder_start = std::chrono::steady_clock::now();
-    call_encoder(temp_dir, cp, deep_flag, gpu_id);
-    auto encoder_end = std::chrono::steady_clock::now();
-    std::cout << "Encoding done!\n";
-    std::cout << "Time for this step: "
-              << std::chrono::duration_cast<std::chrono::seconds>(encoder_end -
-                                                                  encoder_start)
-                     .count()
-              << " s\n";
-    std::cout << "Temporary directory size: " << get_directory_size(temp_dir) << "\n";
-
-    if (!preserve_order && (preserve_quality || preserve_id)) {
-      std::cout << "Reordering and compressing quality and/or ids ...\n";
-      auto rcqi_start = std::chrono::steady_clock::now();
-      reorder_compress_quality_id(temp_dir, cp);
-      auto rcqi_end = std::chrono::steady_clock::now();
-      std::cout << "Reordering and compressing quality and/or ids done!\n";
-      std::cout << "Time for this step: "
-                << std::chrono::duration_cast<std::chrono::seconds>(rcqi_end -
-                                                                    rcqi_start)
-                       .count()
-                << " s\n";
-      std::cout << "Temporary directory size: " << get_directory_size(temp_dir) << "\n";
-    }
-
-    if (!preserve_order && paired_end) {
-      std::cout << "Encoding pairing information ...\n";
-      auto pe_encode_start = std::chrono::steady_clock::now();
-      pe_encode(temp_dir, cp);
-      auto pe_encode_end = std::chrono::steady_clock::now();
-      std::cout << "Encoding pairing information done!\n";
-      std::cout << "Time for this step: "
-                << std::chrono::duration_cast<std::chrono::seconds>(
-                       pe_encode_end - pe_encode_start)
-                       .count()
-                << " s\n";
-      std::cout << "Temporary directory size: " << get_directory_size(temp_dir) << "\n";
+  // Inputs with more reads than max_reads_segment are split into segments
+  // that are compressed independently, so that read ids within a segment
+  // stay 32-bit. Segment 0 is in the top directory (the layout of a single
+  // segment archive), segment k in segment.k/.
+  uint64_t max_reads = std::min<uint64_t>(
+      max_reads_segment == 0 ? MAX_NUM_READS : max_reads_segment,
+      MAX_NUM_READS);
+  if (paired_end && max_reads < 2)
+    throw std::runtime_error("Segment must hold at least one read pair.");
+  const compression_params cp_options = cp;
+  preprocess_input input(infile_1, infile_2, paired_end, gzip_flag);
+  uint32_t num_segments = 0;
+  uint64_t num_reads_total = 0;
+  bool more_reads = true;
+  while (more_reads) {
+    std::string seg_dir = temp_dir;
+    if (num_segments > 0) {
+      seg_dir = temp_dir + "/segment." + std::to_string(num_segments) + "/";
+      boost::filesystem::create_directory(seg_dir);
+      std::cout << "Segment " << num_segments << "\n";
     }
-
-    std::cout << "Reordering and compressing streams ...\n";
-    auto rcs_start = std::chrono::steady_clock::now();
-    reorder_compress_streams(temp_dir, cp);
-    auto rcs_end = std::chrono::steady_clock::now();
-    std::cout << "Reordering and compressing streams done!\n";
-    std::cout << "Time for this step: "
-              << std::chrono::duration_cast<std::chrono::seconds>(rcs_end -
-                                                                  rcs_start)
-                     .count()
-              << " s\n";
-    std::cout << "Temporary directory size: " << get_directory_size(temp_dir) << "\n";
+    cp = cp_options;
+    more_reads = compress_segment(seg_dir, input, cp, max_reads, fasta_flag,
+                                  deep_flag, rp, ep);
+    num_reads_total += cp.num_reads;
+    num_segments++;
+  }
+  if (num_segments > 1) {
+    std::ofstream f_seg(temp_dir + "/segments.bin", std::ios::binary);
+    f_seg.write((char *)&num_segments, sizeof(uint32_t));
+    f_seg.close();
+    std::cout << "Compressed " << num_reads_total << " reads in "
+              << num_segments << " segments\n";
   }
-
-  // Write compression params to a file
-  std::string compression_params_file = temp_dir + "/cp.bin";
-  std::ofstream f_cp(compression_params_file, std::ios::binary);
-  f_cp.write((char *)&cp, sizeof(compression_params));
-  f_cp.close();
 
   // Print out sizes of reads, quality and id after compression
   namespace fs = boost::filesystem;
@@ -228,8 +308,8 @@ void compress(const std::string &temp_dir,
   uint64_t size_quality = 0;
   uint64_t size_id = 0;
   fs::path p{temp_dir};
-  fs::directory_iterator itr{p};
-  for (; itr != fs::directory_iterator{}; ++itr) {
+  fs::recursive_directory_iterator itr{p};
+  for (; itr != fs::recursive_directory_iterator{}; ++itr) {
     std::string current_file = itr->path().filename().string();
     switch (current_file[0]) {
       case 'r':
@@ -251,7 +331,11 @@ void compress(const std::string &temp_dir,
 
   auto tar_start = std::chrono::steady_clock::now();
   std::cout << "Creating tar archive ...";
-  std::string tar_command = "tar -cf " + outfile + " -C " + temp_dir + " . ";
+  std::string tar_options;
+  if (rp.deterministic)  // fixed member order and metadata
+    tar_options = "--sort=name --mtime=@0 --owner=0 --group=0 --numeric-owner ";
+  std::string tar_command =
+      "tar " + tar_options + "-cf " + outfile + " -C " + temp_dir + " . ";
   int tar_status = std::system(tar_command.c_str());
   if (tar_status != 0)
     throw std::runtime_error("Error occurred during tar archive generation.");
@@ -271,6 +355,10 @@ void compress(const std::string &temp_dir,
                    compression_end - compression_start)
                    .count()
             << " s\n";
+  std::cout << "Peak memory usage: " << peak_rss() / (1024 * 1024) << " MB";
+  if (get_memory_limit() != 0)
+    std::cout << " (limit " << get_memory_limit() / (1024 * 1024) << " MB)";
+  std::cout << "\n";
 
   fs::path p1{outfile};
   std::cout << "\n";
@@ -283,7 +371,7 @@ void decompress(const std::string &temp_dir,
                 const std::vector<std::string> &infile_vec,
                 const std::vector<std::string> &outfile_vec, const int &num_thr,
                 const std::vector<uint64_t> &decompress_range_vec,
-                const bool &gzip_flag, const int &gzip_level, const bool &deep_flag, const int &gpu_id) {
+                const bool &gzip_flag, const int &gzip_level, const int &gpu_id) {
   //
   // Ensure that omp parallel regions are executed with the requested
   // #threads.
@@ -309,14 +397,36 @@ void decompress(const std::string &temp_dir,
     throw std::runtime_error("Error occurred during untarring.");
   std::cout << "Untarring archive done!\n";
 
-  // Read compression params
-  std::string compression_params_file = temp_dir + "/cp.bin";
-  std::ifstream f_cp(compression_params_file, std::ios::binary);
-  if (!f_cp.is_open()) throw std::runtime_error("Can't open parameter file.");
-  f_cp.read((char *)&cp, sizeof(compression_params));
-  if (!f_cp.good())
-    throw std::runtime_error("Can't read compression parameters.");
-  f_cp.close();
+  // Segments (see compress), a single one if there is no segments.bin
+  uint32_t num_segments = 1;
+  std::ifstream f_seg(temp_dir + "/segments.bin", std::ios::binary);
+  if (f_seg.is_open()) {
+    f_seg.read((char *)&num_segments, sizeof(uint32_t));
+    if (!f_seg.good() || num_segments == 0)
+      throw std::runtime_error("Can't read segment count.");
+    f_seg.close();
+  }
+  std::vector<std::string> seg_dir(num_segments, temp_dir);
+  std::vector<compression_params> seg_cp(num_segments);
+  uint64_t num_reads_total = 0;
+  for (uint32_t s = 0; s < num_segments; s++) {
+    if (s > 0) seg_dir[s] = temp_dir + "/segment." + std::to_string(s) + "/";
+    // Read compression params
+    std::string compression_params_file = seg_dir[s] + "/cp.bin";
+    std::ifstream f_cp(compression_params_file, std::ios::binary);
+    if (!f_cp.is_open()) throw std::runtime_error("Can't open parameter file.");
+    f_cp.read((char *)&seg_cp[s], sizeof(compression_params));
+    if (!f_cp.good())
+      throw std::runtime_error("Can't read compression parameters.");
+    f_cp.close();
+    if (seg_cp[s].format_version > ARCHIVE_FORMAT_VERSION)
+      throw std::runtime_error(
+          "Unknown archive format version " +
+          std::to_string(seg_cp[s].format_version) +
+          " (written by a newer version of the program?).");
+    num_reads_total += seg_cp[s].num_reads;
+  }
+  cp = seg_cp[0];
 
   bool paired_end = cp.paired_end;
   bool long_flag = cp.long_flag;
@@ -345,7 +455,7 @@ void decompress(const std::string &temp_dir,
     default:
       throw std::runtime_error("Too many (>2) output files specified");
   }
-  uint64_t num_read_pairs = paired_end ? cp.num_reads / 2 : cp.num_reads;
+  uint64_t num_read_pairs = paired_end ? num_reads_total / 2 : num_reads_total;
   uint64_t start_num = 0;
   uint64_t end_num = num_read_pairs;
   if (decompress_range_vec.size() != 0) {
@@ -361,12 +471,29 @@ void decompress(const std::string &temp_dir,
   }
 
   std::cout << "Decompressing ...\n";
-  if (long_flag)
-    decompress_long(temp_dir, outfile_1, outfile_2, cp, num_thr, start_num,
-                    end_num, gzip_flag, gzip_level, deep_flag, gpu_id);
-  else
-    decompress_short(temp_dir, outfile_1, outfile_2, cp, num_thr, start_num,
-                     end_num, gzip_flag, gzip_level, deep_flag, gpu_id);
+  // decompress the part of the range in each segment, appending to the output
+  uint64_t seg_start = 0;
+  bool append_flag = false;
+  for (uint32_t s = 0; s < num_segments; s++) {
+    uint64_t seg_pairs =
+        paired_end ? seg_cp[s].num_reads / 2 : seg_cp[s].num_reads;
+    uint64_t seg_end = seg_start + seg_pairs;
+    if (start_num < seg_end && end_num > seg_start) {
+      uint64_t local_start = std::max(start_num, seg_start) - seg_start;
+      uint64_t local_end = std::min(end_num, seg_end) - seg_start;
+      if (num_segments > 1) std::cout << "Segment " << s << "\n";
+      if (long_flag)
+        decompress_long(seg_dir[s], outfile_1, outfile_2, seg_cp[s], num_thr,
+                        local_start, local_end, gzip_flag, gzip_level,
+                        append_flag);
+      else
+        decompress_short(seg_dir[s], outfile_1, outfile_2, seg_cp[s], num_thr,
+                         local_start, local_end, gzip_flag, gzip_level,
+                         append_flag, gpu_id);
+      append_flag = true;
+    }
+    seg_start = seg_end;
+  }
 
   delete cp_ptr;
   auto decompression_end = std::chrono::steady_clock::now();
@@ -28,13 +28,17 @@ void compress(const std::string &temp_dir,
               const bool &pairing_only_flag, const bool &no_quality_flag,
               const bool &no_ids_flag,
               const std::vector<std::string> &quality_opts,
-              const bool &long_flag, const bool &gzip_flag, const bool &fasta_flag, const bool &deep_flag, const int &gpu_id);
+              const bool &long_flag, const bool &gzip_flag, const bool &fasta_flag, const bool &deep_flag,
+              const std::string &numa_policy, const std::string &huge_pages,
+              const double &max_memory_gb, const std::string &dict_backend,
+              const bool &out_of_core_flag, const uint64_t &max_reads_segment,
+              const reorder_params &rp, const encoder_params &ep);
 
 void decompress(const std::string &temp_dir,
                 const std::vector<std::string> &infile_vec,
                 const std::vector<std::string> &outfile_vec, const int &num_thr,
                 const std::vector<uint64_t> &decompress_range_vec,
-                const bool &gzip_flag, const int &gzip_level, const bool &deep_flag, const int &gpu_id);
+                const bool &gzip_flag, const int &gzip_level, const int &gpu_id);
 
 std::string random_string(size_t length);
 
@@ -14,16 +14,20 @@ limitations under the License.
 
 #include "util.h"
 #include <algorithm>
+#include <array>
 #include <boost/iostreams/device/back_inserter.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/filesystem.hpp>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <stdexcept>
 #include <string>
 
 #include "id_compression/include/sam_block.h"
 #include "omp.h"
+#include "params.h"
 #include "qvz/include/qvz.h"
 
 namespace spring {
@@ -266,16 +270,17 @@ void modify_id(std::string &id, const uint8_t paired_id_code) {
   }
 }
 
-void write_dna_in_bits(const std::string &read, std::ofstream &fout) {
+void write_dna_in_bits(const std::string &read, std::ostream &fout,
+                       const bool write_length) {
   uint8_t dna2int[128];
   dna2int[(uint8_t)'A'] = 0;
   dna2int[(uint8_t)'C'] = 2; // chosen to align with the bitset representation
   dna2int[(uint8_t)'G'] = 1;
   dna2int[(uint8_t)'T'] = 3;
-  uint8_t bitarray[128];
-  uint8_t pos_in_bitarray = 0;
+  uint8_t bitarray[(MAX_READ_LEN + 3) / 4];
+  uint16_t pos_in_bitarray = 0;
   uint16_t readlen = read.size();
-  fout.write((char *)&readlen, sizeof(uint16_t));
+  if (write_length) fout.write((char *)&readlen, sizeof(uint16_t));
   for (int i = 0; i < readlen / 4; i++) {
     bitarray[pos_in_bitarray] = 0;
     for (int j = 0; j < 4; j++)
@@ -293,15 +298,16 @@ void write_dna_in_bits(const std::string &read, std::ofstream &fout) {
   return;
 }
 
-void read_dna_from_bits(std::string &read, std::ifstream &fin) {
-  uint16_t readlen;
-  uint8_t bitarray[128];
+void read_dna_from_bits(std::string &read, std::istream &fin,
+                        const uint16_t fixed_len) {
+  uint16_t readlen = fixed_len;
+  uint8_t bitarray[(MAX_READ_LEN + 3) / 4];
   const char int2dna[4] = {'A','G','C','T'};
-  fin.read((char *)&readlen, sizeof(uint16_t));
+  if (fixed_len == 0) fin.read((char *)&readlen, sizeof(uint16_t));
   read.resize(readlen);
   uint16_t num_bytes_to_read = ((uint32_t)readlen+4-1)/4;
   fin.read((char*)&bitarray[0],num_bytes_to_read);
-  uint8_t pos_in_bitarray = 0;
+  uint16_t pos_in_bitarray = 0;
   for (int i = 0; i < readlen / 4; i++) {
     for (int j = 0; j < 4; j++) {
       read[4 * i + j] = int2dna[bitarray[pos_in_bitarray] & 3];
@@ -319,15 +325,15 @@ void read_dna_from_bits(std::string &read, std::ifstream &fin) {
   }
 }
 
-void write_dnaN_in_bits(const std::string &read, std::ofstream &fout) {
+void write_dnaN_in_bits(const std::string &read, std::ostream &fout) {
   uint8_t dna2int[128];
   dna2int[(uint8_t)'A'] = 0;
   dna2int[(uint8_t)'C'] = 2; // chosen to align with the bitset representation
   dna2int[(uint8_t)'G'] = 1;
   dna2int[(uint8_t)'T'] = 3;
   dna2int[(uint8_t)'N'] = 4;
-  uint8_t bitarray[256];
-  uint8_t pos_in_bitarray = 0;
+  uint8_t bitarray[(MAX_READ_LEN + 1) / 2];
+  uint16_t pos_in_bitarray = 0;
   uint16_t readlen = read.size();
   fout.write((char *)&readlen, sizeof(uint16_t));
   for (int i = 0; i < readlen / 2; i++) {
@@ -347,15 +353,15 @@ void write_dnaN_in_bits(const std::string &read, std::ofstream &fout) {
   return;
 }
 
-void read_dnaN_from_bits(std::string &read, std::ifstream &fin) {
+void read_dnaN_from_bits(std::string &read, std::istream &fin) {
   uint16_t readlen;
-  uint8_t bitarray[256];
+  uint8_t bitarray[(MAX_READ_LEN + 1) / 2];
   const char int2dna[5] = {'A','G','C','T','N'};
   fin.read((char *)&readlen, sizeof(uint16_t));
   read.resize(readlen);
   uint16_t num_bytes_to_read = ((uint32_t)readlen+2-1)/2;
   fin.read((char*)&bitarray[0],num_bytes_to_read);
-  uint8_t pos_in_bitarray = 0;
+  uint16_t pos_in_bitarray = 0;
   for (int i = 0; i < readlen / 2; i++) {
     for (int j = 0; j < 2; j++) {
       read[2 * i + j] = int2dna[bitarray[pos_in_bitarray] & 15];
@@ -373,6 +379,44 @@ void read_dnaN_from_bits(std::string &read, std::ifstream &fin) {
   }
 }
 
+void pack_bases(const char *bases, const uint64_t len, uint8_t *packed) {
+  // bits 1-2 of the ASCII code xor'ed give A 0, C 1, G 2, T 3 without a
+  // table lookup, which lets the compiler vectorize the loop
+  const uint64_t num_bytes = len / 4;
+  for (uint64_t i = 0; i < num_bytes; i++) {
+    uint8_t b = 0;
+    for (int j = 0; j < 4; j++) {
+      const uint8_t c = bases[4 * i + j];
+      b |= (((c >> 1) ^ (c >> 2)) & 3) << (2 * j);
+    }
+    packed[i] = b;
+  }
+  if (len % 4 != 0) {
+    uint8_t b = 0;
+    for (uint64_t j = 0; j < len % 4; j++) {
+      const uint8_t c = bases[4 * num_bytes + j];
+      b |= (((c >> 1) ^ (c >> 2)) & 3) << (2 * j);
+    }
+    packed[num_bytes] = b;
+  }
+}
+
+void unpack_bases(const uint8_t *packed, const uint64_t len, char *bases) {
+  // four bases for every byte value
+  static const std::array<std::array<char, 4>, 256> bytetobases = [] {
+    const char inttobase[4] = {'A', 'C', 'G', 'T'};
+    std::array<std::array<char, 4>, 256> table;
+    for (int b = 0; b < 256; b++)
+      for (int j = 0; j < 4; j++) table[b][j] = inttobase[(b >> (2 * j)) & 3];
+    return table;
+  }();
+  const uint64_t num_bytes = len / 4;
+  for (uint64_t i = 0; i < num_bytes; i++)
+    memcpy(bases + 4 * i, bytetobases[packed[i]].data(), 4);
+  for (uint64_t j = 0; j < len % 4; j++)
+    bases[4 * num_bytes + j] = bytetobases[packed[num_bytes]][j];
+}
+
 void reverse_complement(char *s, char *s1, const int readlen) {
   for (int j = 0; j < readlen; j++)
     s1[j] = chartorevchar[(uint8_t)s[readlen - j - 1]];
@@ -404,6 +448,37 @@ size_t get_directory_size(const std::string &temp_dir) {
   return size;
 }
 
+int deterministic_num_parts(const uint64_t num_reads) {
+  uint64_t num_parts =
+      (num_reads + DETERMINISTIC_PART_READS - 1) / DETERMINISTIC_PART_READS;
+  return std::max<uint64_t>(
+      1, std::min<uint64_t>(num_parts, DETERMINISTIC_MAX_PARTS));
+}
+
+void zpaq_compress(const std::string &infile, const std::string &outfile) {
+  namespace fs = boost::filesystem;
+  fs::path in{infile};
+  std::string dir = in.has_parent_path() ? in.parent_path().string() : ".";
+  std::string command = "cd " + dir + " && zpaq add " +
+                        fs::absolute(outfile).string() + " " +
+                        in.filename().string() + " -method 5";
+  std::system(command.c_str());
+}
+
+std::string zpaq_extract(const std::string &infile, const std::string &dir,
+                         const std::string &filename) {
+  namespace fs = boost::filesystem;
+  fs::create_directories(dir);
+  std::string command = "zpaq x " + infile + " -to " + dir;
+  std::system(command.c_str());
+  fs::path file = fs::path(dir) / filename;
+  if (fs::exists(file)) return file.string();
+  for (fs::recursive_directory_iterator it(dir), end; it != end; ++it)
+    if (it->path().filename() == filename && fs::is_regular_file(it->path()))
+      return it->path().string();
+  throw std::runtime_error("Extracted file " + filename + " not found");
+}
+
 // below functions based on code at https://github.com/sean-/postgresql-varint/blob/trunk/src/varint.c
 // also on https://github.com/shubhamchandak94/CDTC/blob/master/src/util.cpp
 
@@ -45,11 +45,53 @@ struct compression_params {
   uint32_t max_readlen;
   uint8_t paired_id_code;
   bool paired_id_match;
+  // all reads have length max_readlen (short reads only): no read length is
+  // stored per read in the temporary files or in the archive
+  bool fixed_readlen;
+  // ARCHIVE_FORMAT_VERSION of the writer. Sits in what was padding before, so
+  // that it reads as 0 in older archives (memset before being written).
+  uint8_t format_version;
   int num_reads_per_block;
   int num_reads_per_block_long;
   int num_thr;
 };
 
+// user overrides for the reorder stage (0, negative or empty means default)
+// not stored in the archive since decompression does not depend on them
+struct reorder_params {
+  int num_dict = 0;
+  int dict_len = 0;
+  std::string dict_positions;  // "start-end,start-end,..." (0-based, inclusive)
+  int max_search = 0;
+  int thresh = -1;
+  int max_shift = 0;
+  double stop_criteria = -1.0;
+  bool autotune = false;
+  // reorder in parts of fixed size with dictionaries of their own (see
+  // --deterministic)
+  bool deterministic = false;
+};
+
+// user options of the encoder stage, not stored in the archive either
+struct encoder_params {
+  // place singletons with a minimizer index over the contig consensus
+  // instead of the dictionaries (see --singleton-index)
+  bool singleton_index = false;
+  // code the contig consensus with nucleotide_cm.h instead of zpaq (see
+  // --seq-codec)
+  bool seq_cm = false;
+  // write the deep model weights trained on the first chunk there (see
+  // --deep-save-weights)
+  std::string deep_save_weights;
+  // encode in parts of fixed size with dictionaries of their own (see
+  // --deterministic)
+  bool deterministic = false;
+};
+
+// number of parts of reorder and the encoder with --deterministic, which
+// depends on the number of reads only
+int deterministic_num_parts(const uint64_t num_reads);
+
 uint32_t read_fastq_block(std::istream *fin, std::string *id_array,
                           std::string *read_array, std::string *quality_array,
                           const uint32_t &num_reads, const bool &fasta_flag);
@@ -86,13 +128,24 @@ bool check_id_pattern(const std::string &id_1, const std::string &id_2,
 
 void modify_id(std::string &id, const uint8_t paired_id_code);
 
-void write_dna_in_bits(const std::string &read, std::ofstream &fout);
+// the read is preceded by its length unless write_length is false (reads of
+// fixed length, passed to read_dna_from_bits as fixed_len)
+void write_dna_in_bits(const std::string &read, std::ostream &fout,
+                       const bool write_length = true);
 
-void read_dna_from_bits(std::string &read, std::ifstream &fin);
+void read_dna_from_bits(std::string &read, std::istream &fin,
+                        const uint16_t fixed_len = 0);
 
-void write_dnaN_in_bits(const std::string &read, std::ofstream &fout);
+void write_dnaN_in_bits(const std::string &read, std::ostream &fout);
 
-void read_dnaN_from_bits(std::string &read, std::ifstream &fin);
+void read_dnaN_from_bits(std::string &read, std::istream &fin);
+
+// pack len bases (A, C, G, T only) four per byte, the first base in the low
+// bits, ACGT -> 0123; the last byte is padded with A if len % 4 != 0
+void pack_bases(const char *bases, const uint64_t len, uint8_t *packed);
+
+// inverse of pack_bases, writes len bases
+void unpack_bases(const uint8_t *packed, const uint64_t len, char *bases);
 
 void reverse_complement(char *s, char *s1, const int readlen);
 
@@ -102,6 +155,17 @@ void remove_CR_from_end(std::string &str);
 
 size_t get_directory_size(const std::string &temp_dir);
 
+// zpaq archive outfile of infile. zpaq is run in the directory of infile so
+// that the archive stores the file name only.
+void zpaq_compress(const std::string &infile, const std::string &outfile);
+
+// extract zpaq archive infile into dir (created if needed) and return the
+// path of the extracted file filename. dir must be private to the caller:
+// archives written before zpaq_compress stored the full path of the file,
+// which is then looked up below dir.
+std::string zpaq_extract(const std::string &infile, const std::string &dir,
+                         const std::string &filename);
+
 void write_var_int64(const int64_t val, std::ofstream &fout);
 
 int64_t read_var_int64(std::ifstream &fin);
@@ -0,0 +1,57 @@
+#!/bin/bash
+# Decompresses archives written by a baseline build with the current build.
+# usage: baseline_compat.sh <spring> <baseline spring>
+# The baseline is a build of the format version 0 tree (read_seq.bin parts
+# with a separate tail file), e.g. of commit f05680a. Needs zpaq in PATH.
+
+set -u
+if [ "$#" -ne 2 ]; then
+    echo "Usage: $0 <spring> <baseline spring>"
+    exit 2
+fi
+spring=$(realpath "$1")
+baseline=$(realpath "$2")
+work_dir=$(mktemp -d)
+trap 'rm -rf "$work_dir"' EXIT
+cd "$work_dir"
+
+# reads of random bases (a few with N), numbers of bases that are not
+# multiples of 4 so that the tail files are not empty
+gen_reads() { # file, seed, number of reads, min length, max length
+    awk -v seed="$2" -v n="$3" -v lmin="$4" -v lmax="$5" 'BEGIN {
+        srand(seed); split("A C G T", b, " ");
+        for (i = 1; i <= n; i++) {
+            len = lmin + int(rand() * (lmax - lmin + 1));
+            r = ""; q = "";
+            for (j = 0; j < len; j++) {
+                r = r ((rand() < 0.001) ? "N" : b[1 + int(rand() * 4)]);
+                q = q sprintf("%c", 35 + int(rand() * 30));
+            }
+            printf "@r%d\n%s\n+\n%s\n", i, r, q;
+        }
+    }' > "$1"
+}
+gen_reads se.fq 1 20001 101 101
+gen_reads var.fq 2 20001 60 150
+gen_reads pe_1.fq 3 10001 99 99
+gen_reads pe_2.fq 4 10001 99 99
+gen_reads long.fq 5 301 500 1500
+
+fail=0
+check() { # name, decompressed, original
+    if cmp -s "$2" "$3"; then echo "ok $1"; else echo "FAIL $1"; fail=1; fi
+}
+run() { # name, compress options..., then the inputs
+    name=$1; shift
+    rm -f "$name.sp"
+    if ! "$baseline" -c "$@" -t 3 -o "$name.sp" > "c_$name.log" 2>&1 ||
+       ! "$spring" -d -i "$name.sp" -t 2 -o "$name.out" > "d_$name.log" 2>&1; then
+        echo "FAIL $name"; fail=1; return 1
+    fi
+}
+run se -i se.fq && check se se.out se.fq
+run var -i var.fq && check var var.out var.fq
+run pe -i pe_1.fq pe_2.fq && check pe_1 pe.out.1 pe_1.fq && check pe_2 pe.out.2 pe_2.fq
+run long -l -i long.fq && check long long.out long.fq
+run unordered -r -i se.fq && check unordered <(sort unordered.out) <(sort se.fq)
+exit $fail
@@ -0,0 +1,138 @@
+// Compare the dictionary hash backends (BBHash and pilot_hash) on
+// construction time, lookup throughput and memory.
+// Keys are either n random 64-bit integers or the reordering dictionary keys
+// (2 bits per base of bases start..end) of the reads in a FASTQ file.
+//
+// g++ -O3 -std=c++11 -fopenmp -I../src dict_backend_benchmark.cpp \
+//     ../src/pilot_hash.cpp -o dict_backend_benchmark
+// ./dict_backend_benchmark <num_keys | reads.fastq> [num_thr] [start] [end]
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "BooPHF.h"
+#include "pilot_hash.h"
+
+typedef spring::boomphf::SingleHashFunctor<u_int64_t> hasher_t;
+typedef spring::boomphf::mphf<u_int64_t, hasher_t> boophf_t;
+
+static double seconds_since(std::chrono::steady_clock::time_point t) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t)
+      .count();
+}
+
+static bool read_keys(const std::string &file, int start, int end,
+                      std::vector<uint64_t> &keys) {
+  std::ifstream f(file);
+  if (!f.is_open()) return false;
+  std::string line;
+  uint64_t linenum = 0;
+  while (std::getline(f, line)) {
+    if (linenum++ % 4 != 1 || (int)line.size() <= end) continue;
+    uint64_t key = 0;
+    bool valid = true;
+    for (int i = start; i <= end; i++) {
+      uint64_t code;
+      switch (line[i]) {
+        case 'A': code = 0; break;
+        case 'C': code = 1; break;
+        case 'G': code = 2; break;
+        case 'T': code = 3; break;
+        default: valid = false; code = 0;
+      }
+      key |= code << (2 * (i - start));
+    }
+    if (valid) keys.push_back(key);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  return true;
+}
+
+template <typename Lookup>
+static void time_lookups(const std::string &name, const std::vector<uint64_t> &queries,
+                         Lookup lookup) {
+  auto t = std::chrono::steady_clock::now();
+  uint64_t checksum = 0;
+  for (uint64_t q : queries) checksum += lookup(q);
+  double s = seconds_since(t);
+  std::cout << "  " << name << ": " << queries.size() / s / 1e6
+            << " M lookups/s (checksum " << checksum << ")\n";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cout << "Usage: " << argv[0]
+              << " <num_keys | reads.fastq> [num_thr] [start] [end]\n";
+    return 1;
+  }
+  int num_thr = (argc > 2) ? std::atoi(argv[2]) : 1;
+  int start = (argc > 3) ? std::atoi(argv[3]) : 0;
+  int end = (argc > 4) ? std::atoi(argv[4]) : 31;
+  std::vector<uint64_t> keys;
+  std::mt19937_64 rng(42);
+  if (!read_keys(argv[1], start, end, keys)) {
+    uint64_t n = std::strtoull(argv[1], NULL, 10);
+    for (uint64_t i = 0; i < n; i++) keys.push_back(rng());
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  }
+  uint64_t n = keys.size();
+  if (n == 0) {
+    std::cout << "No keys\n";
+    return 1;
+  }
+  std::cout << "Keys: " << n << ", threads: " << num_thr << "\n";
+
+  // random order member queries and queries for keys not in the set
+  std::vector<uint64_t> member_queries(std::min<uint64_t>(n, 10000000));
+  for (auto &q : member_queries) q = keys[rng() % n];
+  std::vector<uint64_t> other_queries(member_queries.size());
+  for (auto &q : other_queries) q = rng();
+
+  {
+    std::cout << "bbhash:\n";
+    auto t = std::chrono::steady_clock::now();
+    auto data_iterator =
+        spring::boomphf::range(static_cast<const u_int64_t *>(keys.data()),
+                       static_cast<const u_int64_t *>(keys.data() + n));
+    boophf_t bphf(n, data_iterator, num_thr, 5.0, true, false);
+    std::cout << "  construction: " << seconds_since(t) << " s\n";
+    std::cout << "  memory: " << (double)bphf.totalBitSize() / n
+              << " bits/key\n";
+    time_lookups("member lookups", member_queries,
+                 [&](uint64_t q) { return bphf.lookup(q); });
+    time_lookups("other lookups", other_queries,
+                 [&](uint64_t q) { return bphf.lookup(q); });
+  }
+  {
+    std::cout << "pilot:\n";
+    auto t = std::chrono::steady_clock::now();
+    spring::pilot_hash phf;
+    phf.build(keys.data(), n, num_thr);
+    std::cout << "  construction: " << seconds_since(t) << " s\n";
+    std::cout << "  memory: " << 8.0 * phf.num_bytes() / n
+              << " bits/key, table size " << (double)phf.size() / n
+              << " x keys\n";
+    // check perfectness
+    std::vector<bool> seen(phf.size(), false);
+    for (uint64_t k : keys) {
+      uint64_t pos = phf.lookup(k);
+      if (pos >= phf.size() || seen[pos]) {
+        std::cout << "  ERROR: collision or missing key\n";
+        return 1;
+      }
+      seen[pos] = true;
+    }
+    time_lookups("member lookups", member_queries,
+                 [&](uint64_t q) { return phf.lookup(q); });
+    time_lookups("other lookups", other_queries,
+                 [&](uint64_t q) { return phf.lookup(q); });
+  }
+  return 0;
+}